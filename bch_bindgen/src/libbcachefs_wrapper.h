@@ -7,6 +7,7 @@
 #include "data/checksum.h"
 #include "data/io_misc.h"
 #include "data/move.h"
+#include "data/reflink.h"
 #include "data/update.h"
 #include "debug/debug.h"
 #include "init/dev.h"
@@ -239,32 +239,69 @@ int rust_fuse_update_inode_after_write(struct bch_fs *c, subvol_inum inum)
 
 /* ---- readdir ---- */
 
+/*
+ * Like getdents, the offset to resume after an entry is ctx->pos when the next
+ * entry is emitted, or when readdir returns: it isn't necessarily the entry's
+ * own position + 1 (see readdir_inode_order), so each entry is held back until
+ * we know it.
+ */
 struct rust_readdir_ctx {
 	struct dir_context	ctx;
 	void			*opaque;
 	rust_fuse_filldir_fn	filldir;
+
+	bool			have_prev;
+	u64			prev_ino;
+	unsigned		prev_type;
+	unsigned		prev_name_len;
+	char			prev_name[BCH_NAME_MAX];
 };
 
+static int rust_fuse_readdir_flush(struct rust_readdir_ctx *rctx, u64 pos)
+{
+	if (!rctx->have_prev)
+		return 0;
+
+	rctx->have_prev = false;
+	return rctx->filldir(rctx->opaque, rctx->prev_name, rctx->prev_name_len,
+			     rctx->prev_ino, rctx->prev_type, pos);
+}
+
 static int rust_fuse_readdir_actor(struct dir_context *_ctx,
 				   const char *name, int namelen,
 				   loff_t pos, u64 ino, unsigned type)
 {
 	struct rust_readdir_ctx *rctx =
 		container_of(_ctx, struct rust_readdir_ctx, ctx);
-	return rctx->filldir(rctx->opaque, name, (unsigned)namelen,
-			     ino, type, (u64)(pos + 1));
+
+	int ret = rust_fuse_readdir_flush(rctx, pos);
+	if (ret)
+		return ret;
+
+	rctx->have_prev		= true;
+	rctx->prev_ino		= ino;
+	rctx->prev_type		= type;
+	rctx->prev_name_len	= min_t(unsigned, namelen, BCH_NAME_MAX);
+	memcpy(rctx->prev_name, name, rctx->prev_name_len);
+	return 0;
 }
 
-int rust_fuse_readdir(struct bch_fs *c, subvol_inum dir,
-		      u64 pos, void *ctx, rust_fuse_filldir_fn filldir)
+static int rust_fuse_dir_hash_info(struct bch_fs *c, subvol_inum dir,
+				   struct bch_hash_info *dir_hash)
 {
 	struct bch_inode_unpacked bi;
 	int ret = bch2_inode_find_by_inum(c, dir, &bi);
 	if (ret)
 		return ret;
 
+	return bch2_hash_info_init(c, &bi, dir_hash);
+}
+
+int rust_fuse_readdir(struct bch_fs *c, subvol_inum dir,
+		      u64 pos, void *ctx, rust_fuse_filldir_fn filldir)
+{
 	struct bch_hash_info dir_hash;
-	ret = bch2_hash_info_init(c, &bi, &dir_hash);
+	int ret = rust_fuse_dir_hash_info(c, dir, &dir_hash);
 	if (ret)
 		return ret;
 
@@ -275,7 +312,118 @@ int rust_fuse_readdir(struct bch_fs *c, subvol_inum dir,
 		.filldir	= filldir,
 	};
 
-	return bch2_readdir(c, dir, &dir_hash, &rctx.ctx);
+	ret = bch2_readdir(c, dir, &dir_hash, &rctx.ctx);
+	if (ret)
+		return ret;
+
+	rust_fuse_readdir_flush(&rctx, rctx.ctx.pos);
+	return 0;
+}
+
+/* ---- readdirplus ---- */
+
+/*
+ * READDIRPLUS is readdir followed by a lookup of every entry: collect a batch
+ * of dirents, then look their inodes up in inode number order with
+ * bch2_inode_find_by_inums() instead of one random lookup per entry.
+ */
+#define RUST_READDIRPLUS_BATCH	128
+
+struct rust_readdirplus_ent {
+	subvol_inum	target;
+	u64		ino;
+	u64		pos;
+	unsigned	type;
+	unsigned	name_len;
+	char		name[BCH_NAME_MAX];
+};
+
+struct rust_readdirplus_ctx {
+	struct dir_context		ctx;
+	struct rust_readdirplus_ent	*ents;
+	unsigned			nr;
+	/* set by __bch2_readdir() for each entry: may be a child subvolume */
+	subvol_inum			target;
+};
+
+static int rust_fuse_readdirplus_actor(struct dir_context *_ctx,
+				       const char *name, int namelen,
+				       loff_t pos, u64 ino, unsigned type)
+{
+	struct rust_readdirplus_ctx *rctx =
+		container_of(_ctx, struct rust_readdirplus_ctx, ctx);
+
+	/* Offset to resume after the previous entry, as in rust_fuse_readdir(): */
+	if (rctx->nr)
+		rctx->ents[rctx->nr - 1].pos = pos;
+
+	if (rctx->nr == RUST_READDIRPLUS_BATCH)
+		return -1;
+
+	struct rust_readdirplus_ent *e = rctx->ents + rctx->nr++;
+	e->target	= rctx->target;
+	e->ino		= ino;
+	e->type		= type;
+	e->name_len	= min_t(unsigned, namelen, BCH_NAME_MAX);
+	memcpy(e->name, name, e->name_len);
+	return 0;
+}
+
+int rust_fuse_readdirplus(struct bch_fs *c, subvol_inum dir,
+			  u64 pos, void *ctx, rust_fuse_filldirplus_fn filldir)
+{
+	struct bch_hash_info dir_hash;
+	int ret = rust_fuse_dir_hash_info(c, dir, &dir_hash);
+	if (ret)
+		return ret;
+
+	struct rust_readdirplus_ent *ents __free(kvfree) =
+		kvmalloc_array(RUST_READDIRPLUS_BATCH, sizeof(*ents), GFP_KERNEL);
+	subvol_inum *inums __free(kvfree) =
+		kvmalloc_array(RUST_READDIRPLUS_BATCH, sizeof(*inums), GFP_KERNEL);
+	struct bch_inode_unpacked *inodes __free(kvfree) =
+		kvmalloc_array(RUST_READDIRPLUS_BATCH, sizeof(*inodes), GFP_KERNEL);
+	int *inode_ret __free(kvfree) =
+		kvmalloc_array(RUST_READDIRPLUS_BATCH, sizeof(*inode_ret), GFP_KERNEL);
+	if (!ents || !inums || !inodes || !inode_ret)
+		return -ENOMEM;
+
+	struct rust_readdirplus_ctx rctx = {
+		.ctx.actor	= rust_fuse_readdirplus_actor,
+		.ctx.pos	= pos,
+		.ents		= ents,
+	};
+
+	ret = __bch2_readdir(c, dir, &dir_hash, &rctx.ctx, &rctx.target);
+	if (ret)
+		return ret;
+
+	if (rctx.nr)
+		ents[rctx.nr - 1].pos = rctx.ctx.pos;
+
+	for (unsigned i = 0; i < rctx.nr; i++)
+		inums[i] = ents[i].target;
+
+	ret = bch2_inode_find_by_inums(c, inums, rctx.nr, inodes, inode_ret);
+	if (ret)
+		return ret;
+
+	for (unsigned i = 0; i < rctx.nr; i++)
+		if (inode_ret[i] && !bch2_err_matches(inode_ret[i], ENOENT))
+			return inode_ret[i];
+
+	for (unsigned i = 0; i < rctx.nr; i++) {
+		struct rust_readdirplus_ent *e = ents + i;
+
+		/* Unlinked since readdir saw it: */
+		if (inode_ret[i])
+			continue;
+
+		if (filldir(ctx, e->name, e->name_len, e->ino, e->type, e->pos, inodes + i))
+			break;
+	}
+
+	return 0;
 }
 
 /* ---- statfs ---- */
@@ -72,6 +72,15 @@ typedef int (*rust_fuse_filldir_fn)(void *ctx,
 int rust_fuse_readdir(struct bch_fs *c, subvol_inum dir,
 		      u64 pos, void *ctx, rust_fuse_filldir_fn filldir);
 
+/* Readdir plus a batched lookup of each entry's inode */
+typedef int (*rust_fuse_filldirplus_fn)(void *ctx,
+					const char *name, unsigned name_len,
+					u64 ino, unsigned type, u64 pos,
+					const struct bch_inode_unpacked *inode);
+
+int rust_fuse_readdirplus(struct bch_fs *c, subvol_inum dir,
+			  u64 pos, void *ctx, rust_fuse_filldirplus_fn filldir);
+
 /* Accounting */
 struct bch_fs_usage_short rust_bch2_fs_usage_read_short(struct bch_fs *c);
 void rust_fuse_count_inodes(struct bch_fs *c, u64 *nr_inodes);
@@ -138,6 +138,11 @@ int rust_bset_decrypt(struct bch_fs *c, struct bset *i, unsigned offset)
 	return bset_encrypt(c, i, offset);
 }
 
+int rust_bset_decompress(struct bch_fs *c, struct bset *i)
+{
+	return bch2_bset_decompress(c, i);
+}
+
 
 /* Bitmap shim — set_bit is atomic (locked bitops) */
 
@@ -61,6 +61,7 @@ struct bset;
 
 int rust_jset_decrypt(struct bch_fs *c, struct jset *j);
 int rust_bset_decrypt(struct bch_fs *c, struct bset *i, unsigned offset);
+int rust_bset_decompress(struct bch_fs *c, struct bset *i);
 
 /*
  * Bitmap shim — set_bit() is atomic (locked bitops in the kernel),
@@ -59,7 +59,6 @@ int blkdev_issue_zeroout(struct block_device *, sector_t, sector_t, gfp_t, unsig
 #define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
 #define SECTOR_MASK		(PAGE_SECTORS - 1)
 
-#define bdev_max_discard_sectors(bdev)	((void) (bdev), 0)
 #define blk_queue_nonrot(q)		((void) (q), 0)
 
 struct blk_plug {
@@ -69,6 +68,7 @@ static inline void blk_start_plug(struct blk_plug *plug) {}
 static inline void blk_finish_plug(struct blk_plug *plug) {}
 
 unsigned bdev_logical_block_size(struct block_device *bdev);
+unsigned bdev_max_discard_sectors(struct block_device *);
 bool bdev_nonrot(struct block_device *);
 sector_t get_capacity(struct gendisk *disk);
 
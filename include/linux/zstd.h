@@ -180,6 +180,44 @@ zstd_cctx *zstd_init_cctx(void *workspace, size_t workspace_size);
 size_t zstd_compress_cctx(zstd_cctx *cctx, void *dst, size_t dst_capacity,
 	const void *src, size_t src_size, const zstd_parameters *parameters);
 
+/* ======   Dictionaries   ====== */
+
+typedef ZSTD_customMem zstd_custom_mem;
+
+typedef ZSTD_CDict zstd_cdict;
+
+/**
+ * zstd_create_cdict_byreference() - create a compression dictionary
+ * @dict:        The dictionary content. Referenced, not copied: must outlive
+ *               the returned cdict.
+ * @dict_size:   The size of the dictionary.
+ * @cparams:     The compression parameters to digest the dictionary with.
+ * @custom_mem:  Allocator for the cdict's tables.
+ *
+ * Return:       The cdict, or NULL on error.
+ */
+zstd_cdict *zstd_create_cdict_byreference(const void *dict, size_t dict_size,
+	zstd_compression_parameters cparams, zstd_custom_mem custom_mem);
+
+size_t zstd_free_cdict(zstd_cdict *cdict);
+
+/**
+ * zstd_compress_using_cdict() - compress src into dst using a dictionary
+ * @cctx:         The context. Must have been initialized with zstd_init_cctx()
+ *                with a workspace large enough for the cdict's parameters.
+ * @dst:          The buffer to compress src into.
+ * @dst_capacity: The size of the destination buffer.
+ * @src:          The data to compress.
+ * @src_size:     The size of the data to compress.
+ * @cdict:        The dictionary to compress with.
+ *
+ * Return:        The compressed size or an error, which can be checked using
+ *                zstd_is_error().
+ */
+size_t zstd_compress_using_cdict(zstd_cctx *cctx, void *dst,
+	size_t dst_capacity, const void *src, size_t src_size,
+	const zstd_cdict *cdict);
+
 /* ======   Single-pass Decompression   ====== */
 
 typedef ZSTD_DCtx zstd_dctx;
@@ -220,6 +258,38 @@ zstd_dctx *zstd_init_dctx(void *workspace, size_t workspace_size);
 size_t zstd_decompress_dctx(zstd_dctx *dctx, void *dst, size_t dst_capacity,
 	const void *src, size_t src_size);
 
+typedef ZSTD_DDict zstd_ddict;
+
+/**
+ * zstd_create_ddict_byreference() - create a decompression dictionary
+ * @dict:        The dictionary content. Referenced, not copied: must outlive
+ *               the returned ddict.
+ * @dict_size:   The size of the dictionary.
+ * @custom_mem:  Allocator for the ddict.
+ *
+ * Return:       The ddict, or NULL on error.
+ */
+zstd_ddict *zstd_create_ddict_byreference(const void *dict, size_t dict_size,
+	zstd_custom_mem custom_mem);
+
+size_t zstd_free_ddict(zstd_ddict *ddict);
+
+/**
+ * zstd_decompress_using_ddict() - decompress src into dst using a dictionary
+ * @dctx:         The decompression context.
+ * @dst:          The buffer to decompress src into.
+ * @dst_capacity: The size of the destination buffer.
+ * @src:          The zstd compressed data.
+ * @src_size:     The exact size of the data to decompress.
+ * @ddict:        The dictionary the data was compressed with.
+ *
+ * Return:        The decompressed size or an error, which can be checked using
+ *                zstd_is_error().
+ */
+size_t zstd_decompress_using_ddict(zstd_dctx *dctx, void *dst,
+	size_t dst_capacity, const void *src, size_t src_size,
+	const zstd_ddict *ddict);
+
 /* ======   Streaming Buffers   ====== */
 
 /**
@@ -1027,71 +1027,145 @@ int bch2_bucket_gens_init(struct bch_fs *c)
 	return 0;
 }
 
-int bch2_alloc_read(struct bch_fs *c)
+/*
+ * Bucket gens are read in parallel, split by device and by bucket range:
+ * ranges are multiples of KEY_TYPE_BUCKET_GENS_NR, so a bucket_gens key is
+ * only ever seen by one job.
+ *
+ * Keys for devices that don't exist, or outside a device's buckets, are
+ * skipped - not a fsck error, they're checked and repaired by
+ * bch2_check_alloc_key() which runs later.
+ */
+#define ALLOC_READ_CHUNK_MIN	(1ULL << 20)
+
+struct alloc_read_job {
+	struct closure		cl;
+	struct bch_dev		*ca;
+	u64			start;
+	u64			end;
+	u64			time;
+	int			ret;
+};
+
+static unsigned alloc_read_dev_nr_chunks(struct bch_dev *ca)
 {
-	guard(rwsem_read)(&c->state_lock);
+	return clamp_t(u64, div64_u64(ca->mi.nbuckets, ALLOC_READ_CHUNK_MIN),
+		       1, num_online_cpus());
+}
 
-	CLASS(btree_trans, trans)(c);
-	struct bch_dev *ca = NULL;
-	int ret;
+static int alloc_read_range(struct btree_trans *trans, struct bch_dev *ca, u64 start, u64 end)
+{
+	struct bch_fs *c = trans->c;
+
+	start	= max_t(u64, start, ca->mi.first_bucket);
+	end	= min(end, ca->mi.nbuckets);
+	if (start >= end)
+		return 0;
 
 	if (c->sb.version_upgrade_complete >= bcachefs_metadata_version_bucket_gens) {
-		ret = for_each_btree_key(trans, iter, BTREE_ID_bucket_gens, POS_MIN,
-					 BTREE_ITER_prefetch, k, ({
-			u64 start = bucket_gens_pos_to_alloc(k.k->p, 0).offset;
-			u64 end = bucket_gens_pos_to_alloc(bpos_nosnap_successor(k.k->p), 0).offset;
+		unsigned offset;
+		struct bpos gens_start	= alloc_gens_pos(POS(ca->dev_idx, start), &offset);
+		struct bpos gens_end	= alloc_gens_pos(POS(ca->dev_idx, end - 1), &offset);
 
-			if (k.k->type != KEY_TYPE_bucket_gens)
-				continue;
+		return for_each_btree_key_max(trans, iter, BTREE_ID_bucket_gens,
+					      gens_start, gens_end,
+					      BTREE_ITER_prefetch, k, ({
+			u64 k_start = bucket_gens_pos_to_alloc(k.k->p, 0).offset;
+			u64 k_end = bucket_gens_pos_to_alloc(bpos_nosnap_successor(k.k->p), 0).offset;
 
-			ca = bch2_dev_iterate(c, ca, k.k->p.inode);
-			/*
-			 * Not a fsck error because this is checked/repaired by
-			 * bch2_check_alloc_key() which runs later:
-			 */
-			if (!ca) {
-				bch2_btree_iter_set_pos(&iter, POS(k.k->p.inode + 1, 0));
+			if (k.k->type != KEY_TYPE_bucket_gens)
 				continue;
-			}
 
 			const struct bch_bucket_gens *g = bkey_s_c_to_bucket_gens(k).v;
 
-			for (u64 b = max_t(u64, ca->mi.first_bucket, start);
-			     b < min_t(u64, ca->mi.nbuckets, end);
-			     b++)
+			for (u64 b = max(start, k_start); b < min(end, k_end); b++)
 				*bucket_gen(ca, b) = g->gens[b & KEY_TYPE_BUCKET_GENS_MASK];
 			0;
 		}));
 	} else {
-		ret = for_each_btree_key(trans, iter, BTREE_ID_alloc, POS_MIN,
-					 BTREE_ITER_prefetch, k, ({
-			ca = bch2_dev_iterate(c, ca, k.k->p.inode);
-			/*
-			 * Not a fsck error because this is checked/repaired by
-			 * bch2_check_alloc_key() which runs later:
-			 */
-			if (!ca) {
-				bch2_btree_iter_set_pos(&iter, POS(k.k->p.inode + 1, 0));
-				continue;
-			}
-
-			if (k.k->p.offset < ca->mi.first_bucket) {
-				bch2_btree_iter_set_pos(&iter, POS(k.k->p.inode, ca->mi.first_bucket));
-				continue;
-			}
-
-			if (k.k->p.offset >= ca->mi.nbuckets) {
-				bch2_btree_iter_set_pos(&iter, POS(k.k->p.inode + 1, 0));
-				continue;
-			}
-
+		return for_each_btree_key_max(trans, iter, BTREE_ID_alloc,
+					      POS(ca->dev_idx, start),
+					      POS(ca->dev_idx, end - 1),
+					      BTREE_ITER_prefetch, k, ({
 			struct bch_alloc_v4 a;
 			*bucket_gen(ca, k.k->p.offset) = bch2_alloc_to_v4(k, &a)->gen;
 			0;
 		}));
 	}
+}
 
-	bch2_dev_put(ca);
+static int alloc_read_job_run(struct alloc_read_job *job)
+{
+	CLASS(btree_trans, trans)(job->ca->fs);
+
+	return alloc_read_range(trans, job->ca, job->start, job->end);
+}
+
+static CLOSURE_CALLBACK(alloc_read_work)
+{
+	closure_type(job, struct alloc_read_job, cl);
+	u64 start_time = local_clock();
+
+	job->ret	= alloc_read_job_run(job);
+	job->time	= local_clock() - start_time;
+	closure_return(cl);
+}
+
+int bch2_alloc_read(struct bch_fs *c)
+{
+	guard(rwsem_read)(&c->state_lock);
+
+	unsigned nr_jobs = 0;
+	for_each_member_device(c, ca)
+		nr_jobs += alloc_read_dev_nr_chunks(ca);
+
+	if (!nr_jobs)
+		return 0;
+
+	struct alloc_read_job *jobs __free(kfree) = kcalloc(nr_jobs, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs)
+		return bch_err_throw(c, ENOMEM_alloc_read);
+
+	CLASS(closure_stack, cl)();
+	struct alloc_read_job *job = jobs;
+
+	for_each_member_device(c, ca) {
+		unsigned nr = alloc_read_dev_nr_chunks(ca);
+		u64 chunk = round_up(div_u64(ca->mi.nbuckets, nr), KEY_TYPE_BUCKET_GENS_NR);
+
+		for (unsigned i = 0; i < nr; i++, job++) {
+			bch2_dev_get(ca);
+			job->ca		= ca;
+			job->start	= chunk * i;
+			job->end	= i + 1 < nr ? chunk * (i + 1) : ca->mi.nbuckets;
+			closure_call(&job->cl, alloc_read_work, system_unbound_wq, &cl);
+		}
+	}
+	closure_sync_unbounded(&cl);
+
+	CLASS(bch_log_msg_level, msg)(c, LOGLEVEL_info);
+	prt_str(&msg.m, "Read bucket gens:");
+
+	int ret = 0;
+	for (job = jobs; job < jobs + nr_jobs; job++) {
+		ret = ret ?: job->ret;
+
+		/* Jobs for a device are contiguous; report the slowest: */
+		u64 time = job->time;
+		while (job + 1 < jobs + nr_jobs && job[1].ca == job->ca) {
+			bch2_dev_put(job->ca);
+			job++;
+			ret = ret ?: job->ret;
+			time = max(time, job->time);
+		}
+
+		prt_printf(&msg.m, " %s %llu buckets in ", job->ca->name, job->ca->mi.nbuckets);
+		bch2_pr_time_units(&msg.m, time);
+		bch2_dev_put(job->ca);
+	}
+
+	if (ret)
+		msg.m.suppress = true;
 	return ret;
 }
 
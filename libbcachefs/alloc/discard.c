@@ -53,12 +53,19 @@ static void __discard_state_to_text(struct printbuf *out, struct discard_state *
 	prt_printf(out, "bad_data_type:\t%llu\n",	s->bad_data_type);
 	prt_printf(out, "discarded:\t%llu\n",		s->discarded);
 	prt_printf(out, "committed:\t%llu\n",		s->committed);
+	prt_printf(out, "issued:\t%llu\n",		s->issued);
+	prt_printf(out, "merged:\t%llu\n",		s->merged);
 }
 
 void bch2_discards_to_text(struct printbuf *out, struct bch_fs *c, struct discard_state *s)
 {
 	__discard_state_to_text(out, s);
 
+	prt_printf(out, "latency:\t");
+	bch2_pr_time_units(out, mean_and_variance_get_mean(
+			c->times[BCH_TIME_bucket_discard].duration_stats));
+	prt_newline(out);
+
 	prt_printf(out, "Discard release:\n");
 	scoped_guard(printbuf_indent, out) {
 		prt_printf(out, "buffer:\t%llu\n",		s->r.buffer);
@@ -82,6 +89,8 @@ void bch2_discards_to_text(struct printbuf *out, struct bch_fs *c, struct discar
 struct discard_bio {
 	struct bch_dev			*ca;
 	u64				dev_bucket;
+	u32				nr_buckets;
+	u64				submit_time;
 	struct bio			bio;
 };
 
@@ -92,9 +101,11 @@ static void discard_endio(struct bio *_bio)
 	struct bch_fs_discards *d = &ca->fs->discards;
 	struct bpos bucket = u64_to_bucket(bio->dev_bucket);
 
+	bch2_time_stats_update(&ca->fs->times[BCH_TIME_bucket_discard], bio->submit_time);
+
 	scoped_guard(spinlock_irqsave, &d->lock) {
-		darray_find_p(d->in_flight, i,
-			      i->dev_bucket == bio->dev_bucket)->complete = true;
+		for (u64 b = bio->dev_bucket; b < bio->dev_bucket + bio->nr_buckets; b++)
+			darray_find_p(d->in_flight, i, i->dev_bucket == b)->complete = true;
 
 		BUG_ON(!d->refs[bucket.inode]);
 		BUG_ON(!d->ref);
@@ -107,8 +118,12 @@ static void discard_endio(struct bio *_bio)
 	bio_put(&bio->bio);
 }
 
+/*
+ * A bucket that extends the discard being gathered is merged into it: it's in
+ * d->in_flight, but isn't counted in d->refs, which counts discards.
+ */
 static int discard_in_flight_add(struct bch_fs *c, struct bpos bucket,
-				 bool fastpath, bool check)
+				 bool fastpath, bool merge, bool check)
 {
 	u64 dev_bucket = bucket_to_u64(bucket);
 	struct bch_fs_discards *d = &c->discards;
@@ -117,7 +132,7 @@ static int discard_in_flight_add(struct bch_fs *c, struct bpos bucket,
 	if (darray_find_p(d->in_flight, i, i->dev_bucket == dev_bucket))
 		return -EEXIST;
 
-	if (d->refs[bucket.inode] >= DEV_IN_FLIGHT_MAX + fastpath)
+	if (!merge && d->refs[bucket.inode] >= DEV_IN_FLIGHT_MAX + fastpath)
 		return bch_err_throw(c, max_discards_in_flight);
 
 	if (!check) {
@@ -125,29 +140,86 @@ static int discard_in_flight_add(struct bch_fs *c, struct bpos bucket,
 				    ((discard_in_flight) { .dev_bucket = dev_bucket } ),
 				    GFP_NOWAIT));
 
-		d->refs[bucket.inode]++;
-		d->ref++;
+		if (!merge) {
+			d->refs[bucket.inode]++;
+			d->ref++;
+		}
 	}
 
 	return 0;
 }
 
-static void discard_submit(struct bch_dev *ca, struct bpos bucket, bool fastpath)
+static void discard_rate_limit(struct bch_fs *c, u64 sectors)
+{
+	struct bch_fs_discards *d = &c->discards;
+	u64 rate = c->opts.discard_rate_limit >> 9;
+
+	if (!rate)
+		return;
+
+	guard(mutex)(&d->rate_lock);
+	d->rate.rate = min_t(u64, rate, UINT_MAX);
+
+	u64 delay;
+	while ((delay = bch2_ratelimit_delay(&d->rate))) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_timeout(delay);
+	}
+
+	bch2_ratelimit_increment(&d->rate, sectors);
+}
+
+static void discard_submit(struct bch_dev *ca, u64 bucket, u64 nr_buckets)
 {
 	struct bch_fs *c = ca->fs;
 
+	discard_rate_limit(c, nr_buckets * ca->mi.bucket_size);
+
 	struct discard_bio *bio =
 		container_of(bio_alloc_bioset(ca->disk_sb.bdev, 0, REQ_OP_DISCARD, GFP_NOIO,
 					      &c->discards.bioset),
 			     struct discard_bio, bio);
 
 	bio->ca				= ca;
-	bio->dev_bucket			= bucket_to_u64(bucket);
-	bio->bio.bi_iter.bi_sector	= bucket_to_sector(ca, bucket.offset);
-	bio->bio.bi_iter.bi_size	= ca->mi.bucket_size << 9;
+	bio->dev_bucket			= bucket_to_u64(POS(ca->dev_idx, bucket));
+	bio->nr_buckets			= nr_buckets;
+	bio->submit_time		= local_clock();
+	bio->bio.bi_iter.bi_sector	= bucket_to_sector(ca, bucket);
+	bio->bio.bi_iter.bi_size	= (nr_buckets * ca->mi.bucket_size) << 9;
 	bio->bio.bi_end_io		= discard_endio;
 
 	submit_bio(&bio->bio);
+	event_inc(c, discard_issued);
+}
+
+/*
+ * Runs of adjacent buckets - typically freed together, and so next to each
+ * other in the need_discard btree - are gathered into a single discard, up to
+ * opts.discard_max_size: many devices are much slower at lots of small
+ * discards than at one big one.
+ */
+static bool discard_run_extends(struct bch_fs *c, struct discard_state *s,
+				struct bpos bucket, u32 bucket_size)
+{
+	struct discard_run *r = &s->run;
+
+	return r->ca &&
+		r->ca->dev_idx == bucket.inode &&
+		r->end == bucket.offset &&
+		((r->end - r->start + 1) * bucket_size << 9) <= c->opts.discard_max_size;
+}
+
+static void discard_run_submit(struct btree_trans *trans, struct discard_state *s)
+{
+	struct discard_run *r = &s->run;
+
+	if (!r->ca)
+		return;
+
+	bch2_trans_unlock(trans);
+	discard_submit(r->ca, r->start, r->end - r->start);
+	s->issued++;
+	memset(r, 0, sizeof(*r));
 }
 
 static int __discard_mark_free(struct btree_trans *trans,
@@ -237,6 +309,8 @@ static int bch2_discards_complete(struct btree_trans *trans,
 	struct bch_fs_discards *d = &c->discards;
 	int ret = 0;
 
+	discard_run_submit(trans, s);
+
 	closure_wait_event(&d->wait, !discards_pending(d, fastpath, all));
 
 	u64 dev_bucket = 0;
@@ -274,7 +348,8 @@ static int bch2_discard_one_bucket(struct btree_trans *trans,
 	if (unlikely(dev_bucket_nouse(c, bucket)))
 		return 0;
 
-	int ret = discard_in_flight_add(c, bucket, fastpath, true);
+	bool merge = discard_run_extends(c, s, bucket, bucket_size);
+	int ret = discard_in_flight_add(c, bucket, fastpath, merge, true);
 	if (ret) {
 		if (ret == -EEXIST) {
 			s->eexist += bucket_size;
@@ -321,10 +396,20 @@ static int bch2_discard_one_bucket(struct btree_trans *trans,
 			return 0;
 		}
 
-		ret = discard_in_flight_add(c, bucket, fastpath, false);
+		ret = discard_in_flight_add(c, bucket, fastpath, merge, false);
 		if (!ret) {
-			bch2_trans_unlock(trans);
-			discard_submit(ca, bucket, fastpath);
+			if (merge) {
+				s->run.end++;
+				s->merged++;
+				event_inc(c, bucket_discard_merged);
+			} else {
+				discard_run_submit(trans, s);
+				s->run = (struct discard_run) {
+					.ca	= ca,
+					.start	= bucket.offset,
+					.end	= bucket.offset + 1,
+				};
+			}
 			s->discarded += bucket_size;
 			return 0;
 		}
@@ -834,4 +919,5 @@ void bch2_fs_discards_init_early(struct bch_fs *c)
 {
 	INIT_WORK(&c->discards.work, bch2_do_discards_work);
 	spin_lock_init(&c->discards.lock);
+	mutex_init(&c->discards.rate_lock);
 }
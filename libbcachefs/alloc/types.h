@@ -101,6 +101,12 @@ struct write_point {
 		struct dev_stripe_state	stripe;
 
 		u64			sectors_allocated;
+
+		/* compression_adaptive state, protected by lock: */
+		u8			compression_level;
+		u64			compression_level_changed;
+		u64			encode_ns_per_sector;
+		u64			write_ns_per_sector;
 	} __aligned(SMP_CACHE_BYTES);
 
 	struct {
@@ -207,8 +213,17 @@ struct discard_state {
 	u64			bad_data_type;
 	u64			discarded;
 	u64			committed;
+	u64			issued;
+	u64			merged;
 	struct bpos		pos;
 	struct discard_release	r;
+
+	/* Adjacent buckets being gathered into a single discard: */
+	struct discard_run {
+		struct bch_dev	*ca;
+		u64		start;
+		u64		end;
+	}			run;
 };
 
 struct bch_fs_discards {
@@ -221,6 +236,9 @@ struct bch_fs_discards {
 	u8				refs[BCH_SB_MEMBERS_MAX];
 	struct closure_waitlist		wait;
 
+	struct mutex			rate_lock;
+	struct bch_ratelimit		rate;
+
 	struct discard_state		s;
 };
 
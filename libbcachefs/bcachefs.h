@@ -89,6 +89,8 @@
 #include "debug/async_objs_types.h"
 #include "debug/trace.h"
 
+#include "fs/dirent_types.h"
+#include "fs/inode_types.h"
 #include "fs/quota_types.h"
 
 #include "init/error_types.h"
@@ -316,6 +318,10 @@ BCH_DEBUG_PARAMS_ALL()
 	  "Post-read btree node processing")				\
 	x(btree_node_write,						\
 	  "Write btree node to disk")					\
+	x(btree_node_compress,						\
+	  "Compress a bset for a btree node write")			\
+	x(btree_node_decompress,					\
+	  "Decompress a bset after a btree node read")			\
 	x(btree_interior_update_foreground,				\
 	  "Foreground time for topology-changing btree updates "	\
 	  "(splits, compactions, merges); roughly corresponds "		\
@@ -328,14 +334,24 @@ BCH_DEBUG_PARAMS_ALL()
 	  "scan btree node cache for eviction")				\
 	x(btree_key_cache_scan,						\
 	  "scan btree key cache for eviction")				\
+	x(btree_key_cache_evict_age,					\
+	  "Age of clean btree key cache entries when "			\
+	  "evicted by the shrinker")					\
 	x(btree_write_buffer_flush,					\
 	  "Flush btree write buffer to btree")				\
+	x(btree_write_buffer_sort,					\
+	  "Sort and dedup btree write buffer keys for a flush")		\
+	x(btree_write_buffer_insert,					\
+	  "Insert sorted btree write buffer keys into the btree")	\
 	x(btree_gc,							\
 	  "GC pass recalculating oldest generation numbers")		\
 	x(data_write,							\
 	  "Core write path: allocate space, compress, "			\
 	  "encrypt, checksum, issue writes, "				\
 	  "update extents btree")					\
+	x(data_write_encode,						\
+	  "Compress, encrypt and checksum one extent of a "		\
+	  "write on the encode workqueue")				\
 	x(data_read,							\
 	  "Core read path: look up extents btree, "			\
 	  "issue reads, checksum, decrypt, decompress")			\
@@ -351,6 +367,11 @@ BCH_DEBUG_PARAMS_ALL()
 	x(journal_flush_seq,						\
 	  "Flush a journal sequence number to disk "			\
 	  "for sync, fsync, and bucket reuse")				\
+	x(journal_read_bucket,						\
+	  "Journal read on mount: wait for one bucket, then "		\
+	  "checksum, decrypt and add its entries")			\
+	x(journal_read_validate,					\
+	  "Journal read on mount: validate all entries to replay")	\
 	x(journal_pin_flush_btree,					\
 	  "Flush btree journal pins")					\
 	x(journal_pin_flush_key_cache,					\
@@ -383,6 +404,8 @@ BCH_DEBUG_PARAMS_ALL()
 	  "Blocked: writeback throttle")				\
 	x(nocow_lock_contended,						\
 	  "Nocow lock contention")					\
+	x(bucket_discard,						\
+	  "Bucket discard latency")					\
 	x(blocked_discard_journal_flush,				\
 	  "Blocked: discard worker waiting for journal flush "		\
 	  "to advance rewind_seq and release buckets")
@@ -541,6 +564,8 @@ struct bch_dev {
 	/* The rest of this all shows up in sysfs */
 	atomic64_t		cur_latency[2];
 	struct bch2_time_stats_quantiles io_latency[2];
+	/* data writes, for adaptive compression: */
+	atomic64_t		write_ns_per_sector;
 
 #define CONGESTED_MAX		1024
 	atomic_t		congested;
@@ -735,6 +760,8 @@ struct bch_fs {
 	struct bch_fs_discards			discards;
 
 	struct bch_fs_snapshots			snapshots;
+	struct bch_fs_inode_alloc		inode_alloc;
+	struct bch_fs_readdir_cache		readdir_cache;
 
 	spinlock_t				write_error_lock;
 	/*
@@ -753,6 +780,7 @@ struct bch_fs {
 
 	/* IO PATH */
 	struct workqueue_struct	*btree_update_wq;
+	struct workqueue_struct	*write_encode_wq;
 	struct bio_set		bio_read;
 	struct bio_set		bio_read_split;
 	struct bio_set		bio_write;
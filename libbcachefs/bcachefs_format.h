@@ -596,7 +596,10 @@ struct bch_sb_field {
 	  "Tracks which recovery passes have been run "			\
 	  "successfully")						\
 	x(extent_type_u64s,	16,						\
-	  "Per-extent-type size limits")
+	  "Per-extent-type size limits")				\
+	x(compression_dict,	17,						\
+	  "Trained zstd dictionaries for the zstd_dict "		\
+	  "compression type")
 
 enum btree_id_flags {
 	BTREE_IS_extents	= BIT(0),
@@ -758,6 +761,7 @@ enum btree_id {
 #include "data/ec/format.h"
 #include "data/extents_format.h"
 #include "data/extents_sb_format.h"
+#include "data/compress_format.h"
 #include "data/reflink_format.h"
 #include "fs/dirent_format.h"
 #include "fs/inode_format.h"
@@ -1228,6 +1232,8 @@ LE64_BITMASK(BCH_SB_REBALANCE_AC_ONLY,	struct bch_sb, flags[6], 23, 24);
 LE64_BITMASK(BCH_SB_WRITEBACK_TIMEOUT,	struct bch_sb, flags[6], 24, 40);
 LE64_BITMASK(BCH_SB_EXTENT_BP_SHIFT,	struct bch_sb, flags[6], 40, 48);
 LE64_BITMASK(BCH_SB_SCRUB_JOURNAL,	struct bch_sb, flags[6], 48, 50);
+LE64_BITMASK(BCH_SB_METADATA_COMPRESSION_TYPE,
+					struct bch_sb, flags[6], 50, 58);
 
 #define BCH_SB_EXTENT_BP_SHIFT_DEFAULT	10
 
@@ -1262,6 +1268,8 @@ static inline void SET_BCH_SB_BACKGROUND_COMPRESSION_TYPE(struct bch_sb *sb, __u
  * inline_data:			gates KEY_TYPE_inline_data
  * new_siphash:			gates BCH_STR_HASH_siphash
  * new_extent_overwrite:	gates BTREE_NODE_NEW_EXTENT_OVERWRITE
+ * zstd_dict:			gates BCH_COMPRESSION_TYPE_zstd_dict
+ * btree_node_compression:	gates BSET_COMPRESSED
  */
 #define BCH_SB_FEATURES()			\
 	x(lz4,				0)	\
@@ -1287,7 +1295,9 @@ static inline void SET_BCH_SB_BACKGROUND_COMPRESSION_TYPE(struct bch_sb *sb, __u
 	x(casefolding,			20)	\
 	x(no_alloc_info,		21)	\
 	x(small_image,			22)	\
-	x(no_default_sb,		23)
+	x(no_default_sb,		23)	\
+	x(zstd_dict,			24)	\
+	x(btree_node_compression,	25)
 
 #define BCH_SB_FEATURES_ALWAYS				\
 	(BIT_ULL(BCH_FEATURE_new_extent_overwrite)|	\
@@ -1460,7 +1470,8 @@ enum bch_csum_opt {
 	x(gzip,			2)	\
 	x(lz4,			3)	\
 	x(zstd,			4)	\
-	x(incompressible,	5)
+	x(incompressible,	5)	\
+	x(zstd_dict,		6)
 
 enum bch_compression_type {
 #define x(t, n) BCH_COMPRESSION_TYPE_##t = n,
@@ -1473,7 +1484,8 @@ enum bch_compression_type {
 	x(none,		0)		\
 	x(lz4,		1)		\
 	x(gzip,		2)		\
-	x(zstd,		3)
+	x(zstd,		3)		\
+	x(zstd_dict,	4)
 
 enum bch_compression_opts {
 #define x(t, n) BCH_COMPRESSION_OPT_##t = n,
@@ -1838,6 +1850,7 @@ LE32_BITMASK(BSET_CSUM_TYPE,	struct bset, flags, 0, 4);
 LE32_BITMASK(BSET_BIG_ENDIAN,	struct bset, flags, 4, 5);
 LE32_BITMASK(BSET_SEPARATE_WHITEOUTS,
 				struct bset, flags, 5, 6);
+LE32_BITMASK(BSET_COMPRESSED,	struct bset, flags, 6, 7);
 
 /* Sector offset within the btree node: */
 LE32_BITMASK(BSET_OFFSET,	struct bset, flags, 16, 32);
@@ -1898,4 +1911,21 @@ struct btree_node_entry {
 	};
 } __packed __aligned(8);
 
+/*
+ * BSET_COMPRESSED: the bset's keys are replaced by this header followed by the
+ * compressed keys, and bset->u64s covers only what was written. The bset still
+ * owns the space its uncompressed keys would have taken in the node - the rest
+ * of that is left unwritten - so that the in memory layout of the node doesn't
+ * change.
+ *
+ * The header isn't encrypted: walking the bsets in a node needs it.
+ */
+struct bset_compressed {
+	__u8			type;	/* enum bch_compression_type */
+	__u8			pad;
+	__le16			u64s;	/* uncompressed keys, in u64s */
+	__le32			bytes;	/* compressed keys, in bytes */
+	__u8			data[];
+} __packed __aligned(8);
+
 #endif /* _BCACHEFS_FORMAT_H */
@@ -73,6 +73,7 @@
 #define BCH_IOCTL_SUBVOLUME_LIST	_IOWR(0xbc,	31, struct bch_ioctl_subvol_readdir)
 #define BCH_IOCTL_SUBVOLUME_TO_PATH	_IOWR(0xbc,	32, struct bch_ioctl_subvol_to_path)
 #define BCH_IOCTL_SNAPSHOT_TREE		_IOWR(0xbc,	33, struct bch_ioctl_snapshot_tree_query)
+#define BCH_IOCTL_COMPRESSION_DICT_ADD	_IOW(0xbc,	34, struct bch_ioctl_compression_dict)
 
 /* ioctl below act on a particular file, not the filesystem as a whole: */
 
@@ -599,6 +600,24 @@ struct bch_ioctl_snapshot_tree_query {
 	struct bch_ioctl_snapshot_node nodes[];
 };
 
+/*
+ * BCH_IOCTL_COMPRESSION_DICT_ADD: add a trained zstd dictionary
+ *
+ * The dictionary (as produced by ZDICT_trainFromBuffer(), or `bcachefs
+ * compression train`) is appended to the superblock and becomes the dictionary
+ * used for new writes with compression=zstd_dict; existing dictionaries are
+ * kept for reading extents compressed with them.
+ *
+ * @flags	- must be 0
+ * @len		- size of the dictionary, in bytes
+ * @dict	- pointer to the dictionary
+ */
+struct bch_ioctl_compression_dict {
+	__u32			flags;
+	__u32			len;
+	__u64			dict;
+};
+
 /*
  * BCHFS_IOC_PREAD_RAW: O_DIRECT read with extended error reporting.
  *
@@ -150,6 +150,7 @@
 #include "btree/journal_overlay.h"
 #include "btree/key_cache.h"
 #include "btree/locking.h"
+#include "btree/restart_profile.h"
 #include "btree/update.h"
 
 #include "data/extents.h"
@@ -1356,7 +1357,7 @@ int bch2_btree_path_traverse_one(struct btree_trans *trans,
 	int ret = -((int) trans->restarted);
 
 	if (unlikely(ret))
-		goto out;
+		goto out_restarted;
 
 	if (unlikely(!trans->srcu_held))
 		bch2_trans_srcu_lock(trans);
@@ -1434,6 +1435,9 @@ out_uptodate:
 		bch2_btree_path_to_text(&buf, trans, path_idx, trans->paths + path_idx);
 	}));
 out:
+	if (unlikely(trans->restarted))
+		bch2_trans_restart_note_path(trans, path);
+out_restarted:
 	if (bch2_err_matches(ret, BCH_ERR_transaction_restart) != !!trans->restarted)
 		panic("ret %s (%i) trans->restarted %s (%i)\n",
 		      bch2_err_str(ret), ret,
@@ -3423,6 +3427,11 @@ void bch2_trans_iter_init_outlined(struct btree_trans *trans,
 			  enum btree_iter_update_trigger_flags flags,
 			  unsigned long ip)
 {
+	/* Not admitted: do a normal btree lookup, with key cache overlay */
+	if (unlikely(btree_iter_key_cache_admission(btree_id, flags)) &&
+	    !bch2_btree_key_cache_admit(trans->c, btree_id, pos))
+		flags &= ~BTREE_ITER_cached;
+
 	bch2_trans_iter_init_common(trans, iter, btree_id, pos, 0, 0,
 			       bch2_btree_iter_flags(trans, btree_id, 0, flags),
 			       ip);
@@ -3644,6 +3653,10 @@ u32 bch2_trans_begin(struct btree_trans *trans)
 
 	now = local_clock();
 
+	if (unlikely(trans->restarted))
+		bch2_trans_restart_profile_add(trans, now);
+	trans->last_restarted_pos_valid = false;
+
 	if (!IS_ENABLED(CONFIG_BCACHEFS_NO_LATENCY_ACCT) &&
 	    time_after64(now, trans->last_begin_time + 10))
 		__bch2_time_stats_update(&btree_trans_stats(trans)->duration,
@@ -4056,10 +4069,12 @@ void bch2_fs_btree_iter_exit(struct bch_fs *c)
 		darray_exit(&s->trans_kmalloc_trace);
 #endif
 		kfree(s->max_paths_text);
+		bch2_time_stats_exit(&s->duration);
 		bch2_time_stats_exit(&s->lock_hold_times);
 	}
 
 	printbuf_exit(&c->btree.trans.stats_json_buf);
+	bch2_fs_trans_restart_profile_exit(c);
 
 	if (c->btree.trans.barrier_initialized) {
 		synchronize_srcu_expedited(&c->btree.trans.barrier);
@@ -4087,6 +4102,7 @@ void bch2_fs_btree_iter_init_early(struct bch_fs *c)
 	seqmutex_init(&c->btree.trans.lock);
 	mutex_init(&c->btree.trans.stats_json_lock);
 	c->btree.trans.stats_json_buf = PRINTBUF;
+	bch2_fs_trans_restart_profile_init_early(c);
 }
 
 int bch2_fs_btree_iter_init(struct bch_fs *c)
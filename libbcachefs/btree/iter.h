@@ -512,6 +512,18 @@ static inline bool btree_id_cached(enum btree_id btree)
 		 BIT_ULL(BTREE_ID_logged_ops));
 }
 
+/*
+ * Read-only cached lookups in these btrees go through the key cache admission
+ * filter, bch2_btree_key_cache_admit():
+ */
+static inline bool btree_iter_key_cache_admission(enum btree_id btree,
+					enum btree_iter_update_trigger_flags flags)
+{
+	return (flags & (BTREE_ITER_cached|BTREE_ITER_intent)) == BTREE_ITER_cached &&
+		(btree == BTREE_ID_inodes ||
+		 btree == BTREE_ID_alloc);
+}
+
 static inline enum btree_iter_update_trigger_flags
 bch2_btree_iter_flags(struct btree_trans *trans,
 		      unsigned btree_id, unsigned level,
@@ -576,7 +588,8 @@ static inline void __bch2_trans_iter_init(struct btree_trans *trans,
 			  enum btree_iter_update_trigger_flags flags)
 {
 	if (__builtin_constant_p(btree) &&
-	    __builtin_constant_p(flags))
+	    __builtin_constant_p(flags) &&
+	    !btree_iter_key_cache_admission(btree, flags))
 		bch2_trans_iter_init_common(trans, iter, btree, pos, 0, 0,
 				bch2_btree_iter_flags(trans, btree, 0, flags),
 				_THIS_IP_);
@@ -776,33 +776,169 @@ static void bch2_journal_keys_reset(struct bch_fs *c)
 	darray_exit(&keys->overwrites);
 }
 
-static void __journal_keys_sort(struct journal_keys *keys)
+/*
+ * We don't accumulate accounting keys here because we have to compare each
+ * individual accounting key against the version in the btree during replay:
+ */
+static inline bool journal_key_overwrites(struct bch_fs *c,
+					  struct journal_key *old,
+					  struct journal_key *new)
+{
+	return journal_key_k(c, old)->k.type != KEY_TYPE_accounting &&
+		!journal_key_cmp(c, old, new);
+}
+
+/*
+ * Keys are collected in journal order, and on a big journal sorting them is
+ * most of the time spent here: large arrays are split into chunks that are
+ * sorted in parallel, then merged pairwise, each level of merges also in
+ * parallel. The last merge is done here and dedups as it goes.
+ */
+#define JOURNAL_KEYS_SORT_CHUNK_MIN	(1UL << 16)
+
+struct journal_keys_sort_job {
+	struct closure		cl;
+	struct bch_fs		*c;
+	struct journal_key	*src;
+	struct journal_key	*dst;
+	size_t			start;
+	size_t			mid;
+	size_t			end;
+};
+
+static struct journal_key *journal_keys_merge(struct bch_fs *c, struct journal_key *dst,
+					      struct journal_key *l, struct journal_key *l_end,
+					      struct journal_key *r, struct journal_key *r_end,
+					      bool dedup)
+{
+	struct journal_key *start = dst;
+
+	while (l < l_end || r < r_end) {
+		struct journal_key *k = r == r_end ||
+			(l < l_end && journal_sort_key_cmp(l, r, c) < 0) ? l++ : r++;
+
+		if (dedup && dst != start && journal_key_overwrites(c, dst - 1, k))
+			dst--;
+		*dst++ = *k;
+	}
+
+	return dst;
+}
+
+static CLOSURE_CALLBACK(journal_keys_sort_chunk_work)
+{
+	closure_type(s, struct journal_keys_sort_job, cl);
+
+	sort_r_nonatomic(s->src + s->start, s->end - s->start, sizeof(s->src[0]),
+			 journal_sort_key_cmp, NULL, s->c);
+	closure_return(cl);
+}
+
+static CLOSURE_CALLBACK(journal_keys_merge_work)
+{
+	closure_type(s, struct journal_keys_sort_job, cl);
+
+	journal_keys_merge(s->c, s->dst + s->start,
+			   s->src + s->start,	s->src + s->mid,
+			   s->src + s->mid,	s->src + s->end, false);
+	closure_return(cl);
+}
+
+/* Returns false if we couldn't allocate, and the caller should sort serially: */
+static bool journal_keys_sort_parallel(struct bch_fs *c, struct journal_keys *keys,
+				       u64 *sort_ns, u64 *merge_ns)
+{
+	size_t n = keys->nr;
+	unsigned nr_chunks = clamp_t(size_t, n / JOURNAL_KEYS_SORT_CHUNK_MIN,
+				     1, num_online_cpus());
+	if (nr_chunks <= 1)
+		return false;
+
+	struct journal_key *tmp __free(kvfree) =
+		kvmalloc_array(keys->size, sizeof(*tmp), GFP_KERNEL|__GFP_NOWARN);
+	struct journal_keys_sort_job *jobs __free(kfree) =
+		kcalloc(nr_chunks, sizeof(*jobs), GFP_KERNEL);
+	if (!tmp || !jobs)
+		return false;
+
+	CLASS(closure_stack, cl)();
+	u64 start_time = local_clock();
+
+	for (unsigned i = 0; i < nr_chunks; i++) {
+		jobs[i] = (struct journal_keys_sort_job) {
+			.c	= c,
+			.src	= keys->data,
+			.start	= (n * i) / nr_chunks,
+			.end	= (n * (i + 1)) / nr_chunks,
+		};
+		closure_call(&jobs[i].cl, journal_keys_sort_chunk_work, system_unbound_wq, &cl);
+	}
+	closure_sync_unbounded(&cl);
+
+	u64 sorted_time = local_clock();
+	*sort_ns += sorted_time - start_time;
+
+	/* Merge sorted chunks pairwise, alternating between keys->data and tmp: */
+	struct journal_key *src = keys->data, *dst = tmp;
+	unsigned width;
+	for (width = 1; width * 2 < nr_chunks; width *= 2) {
+		struct journal_keys_sort_job *j = jobs;
+
+		for (unsigned i = 0; i < nr_chunks; i += 2 * width, j++) {
+			*j = (struct journal_keys_sort_job) {
+				.c	= c,
+				.src	= src,
+				.dst	= dst,
+				.start	= (n * i) / nr_chunks,
+				.mid	= (n * min(i + width,	  nr_chunks)) / nr_chunks,
+				.end	= (n * min(i + 2 * width, nr_chunks)) / nr_chunks,
+			};
+			closure_call(&j->cl, journal_keys_merge_work, system_unbound_wq, &cl);
+		}
+		closure_sync_unbounded(&cl);
+		swap(src, dst);
+	}
+
+	struct journal_key *mid = src + (n * width) / nr_chunks;
+	keys->nr = journal_keys_merge(c, dst, src, mid, mid, src + n, true) - dst;
+
+	/* Both buffers are keys->size: keep whichever has the result */
+	if (dst != keys->data)
+		swap(keys->data, tmp);
+
+	*merge_ns += local_clock() - sorted_time;
+	return true;
+}
+
+static void __journal_keys_sort(struct journal_keys *keys, u64 *sort_ns, u64 *merge_ns)
 {
 	struct bch_fs *c = container_of(keys, struct bch_fs, journal_keys);
 
+	if (journal_keys_sort_parallel(c, keys, sort_ns, merge_ns))
+		return;
+
+	u64 start_time = local_clock();
+
 	sort_r_nonatomic(keys->data, keys->nr, sizeof(keys->data[0]),
 			 journal_sort_key_cmp, NULL, c);
 
 	cond_resched();
 
+	u64 sorted_time = local_clock();
+	*sort_ns += sorted_time - start_time;
+
 	struct journal_key *dst = keys->data;
 
 	darray_for_each(*keys, src) {
-		/*
-		 * We don't accumulate accounting keys here because we have to
-		 * compare each individual accounting key against the version in
-		 * the btree during replay:
-		 */
-		struct bkey_i *k = journal_key_k(c, src);
-		if (k->k.type != KEY_TYPE_accounting &&
-		    src + 1 < &darray_top(*keys) &&
-		    !journal_key_cmp(c, src, src + 1))
+		if (src + 1 < &darray_top(*keys) &&
+		    journal_key_overwrites(c, src, src + 1))
 			continue;
 
 		*dst++ = *src;
 	}
 
 	keys->nr = dst - keys->data;
+	*merge_ns += local_clock() - sorted_time;
 }
 
 static bool journal_seq_is_rewound(struct bch_fs *c, u64 seq)
@@ -821,6 +957,7 @@ int bch2_journal_keys_sort(struct bch_fs *c)
 	struct journal_keys *keys = &c->journal_keys;
 	size_t nr_read = 0;
 	size_t nr_extra_sorts = 0;
+	u64 start_time = local_clock(), collect_ns, sort_ns = 0, merge_ns = 0;
 
 	/* We may be called more than once - when deciding to rewind because of
 	 * opts.scrub_recent_journal_entries */
@@ -865,7 +1002,7 @@ int bch2_journal_keys_sort(struct bch_fs *c)
 				};
 
 				if (darray_push(keys, n)) {
-					__journal_keys_sort(keys);
+					__journal_keys_sort(keys, &sort_ns, &merge_ns);
 					nr_extra_sorts++;
 
 					if (keys->nr * 8 > keys->size * 7) {
@@ -892,7 +1029,9 @@ int bch2_journal_keys_sort(struct bch_fs *c)
 		darray_push(keys, *i);
 	keys->pre_sort.nr = 0;
 
-	__journal_keys_sort(keys);
+	collect_ns = local_clock() - start_time - sort_ns - merge_ns;
+
+	__journal_keys_sort(keys, &sort_ns, &merge_ns);
 	keys->gap = keys->nr;
 
 	darray_for_each(*keys, i) {
@@ -903,6 +1042,13 @@ int bch2_journal_keys_sort(struct bch_fs *c)
 
 	CLASS(bch_log_msg_level, msg)(c, nr_extra_sorts ? LOGLEVEL_debug : LOGLEVEL_notice);
 	prt_printf(&msg.m, "Journal keys: %zu read, %zu after sorting and compacting", nr_read, keys->nr);
+	prt_str(&msg.m, " (collect ");
+	bch2_pr_time_units(&msg.m, collect_ns);
+	prt_str(&msg.m, ", sort ");
+	bch2_pr_time_units(&msg.m, sort_ns);
+	prt_str(&msg.m, ", merge ");
+	bch2_pr_time_units(&msg.m, merge_ns);
+	prt_char(&msg.m, ')');
 	if (nr_extra_sorts)
 		prt_printf(&msg.m, "Required %zu extra sorts due to low memory", nr_extra_sorts);
 	return 0;
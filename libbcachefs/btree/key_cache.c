@@ -74,6 +74,73 @@ bch2_btree_key_cache_find(struct bch_fs *c, enum btree_id btree_id, struct bpos
 				      bch2_btree_key_cache_params);
 }
 
+/* Admission: */
+
+#define BKEY_CACHED_PRESSURE_WINDOW	(10 * HZ)
+
+static bool bkey_cached_sketch_admit(struct bkey_cached_sketch *sk,
+				     struct bkey_cached_key *key,
+				     unsigned min_freq)
+{
+	u32 h1 = jhash(key, sizeof(*key), 0);
+	u32 h2 = (h1 >> 17) | (h1 << 15);
+	unsigned freq = BKEY_CACHED_SKETCH_MAX;
+
+	for (unsigned i = 0; i < BKEY_CACHED_SKETCH_HASHES; i++) {
+		u8 *v = sk->counters + ((h1 + i * h2) & (BKEY_CACHED_SKETCH_NR - 1));
+		u8 n = READ_ONCE(*v);
+
+		/* racy increments are fine, this is an estimate */
+		if (n < BKEY_CACHED_SKETCH_MAX)
+			WRITE_ONCE(*v, ++n);
+		freq = min_t(unsigned, freq, n);
+	}
+
+	/* Age: halve all counters periodically, so the sketch tracks recent lookups */
+	if (atomic_inc_return(&sk->nr) == BKEY_CACHED_SKETCH_RESET) {
+		for (unsigned i = 0; i < BKEY_CACHED_SKETCH_NR; i++)
+			WRITE_ONCE(sk->counters[i], READ_ONCE(sk->counters[i]) >> 1);
+		atomic_set(&sk->nr, 0);
+	}
+
+	return freq >= min_freq;
+}
+
+/*
+ * Decide whether a read-only cached lookup should create a key cache entry.
+ *
+ * The key cache has no size limit of its own - it's sized by the shrinker - so
+ * we only filter when the shrinker has been freeing entries recently: then a
+ * new entry will displace an existing one, and a one-off scan (find, du,
+ * backups) shouldn't push out the hot set. Otherwise this is just a jiffies
+ * check, and the sketch only sees lookups made under pressure.
+ */
+bool bch2_btree_key_cache_admit(struct bch_fs *c, enum btree_id btree, struct bpos pos)
+{
+	struct bch_fs_btree_key_cache *bc = &c->btree.key_cache;
+	struct bkey_cached_key key = { .btree_id = btree, .pos = pos };
+	unsigned min_freq = c->opts.key_cache_admission;
+
+	if (!min_freq || !bc->sketch.counters)
+		return true;
+
+	if (!time_before(jiffies, READ_ONCE(bc->last_shrink) + BKEY_CACHED_PRESSURE_WINDOW))
+		return true;
+
+	bool admit = bkey_cached_sketch_admit(&bc->sketch, &key, min_freq);
+
+	if (rhashtable_lookup_fast(&bc->table, &key, bch2_btree_key_cache_params)) {
+		this_cpu_inc(bc->admit_stats->hit);
+		return true;
+	}
+
+	if (admit)
+		this_cpu_inc(bc->admit_stats->admitted);
+	else
+		this_cpu_inc(bc->admit_stats->rejected);
+	return admit;
+}
+
 static bool bkey_cached_lock_for_evict(struct bkey_cached *ck)
 {
 	if (!six_trylock_intent(&ck->c.lock))
@@ -92,9 +159,43 @@ static bool bkey_cached_lock_for_evict(struct bkey_cached *ck)
 	return true;
 }
 
+static inline struct bkey_cached_lru *bkey_cached_lru(struct bch_fs_btree_key_cache *bc,
+						      struct bkey_cached *ck)
+{
+	return bc->lru + hash_ptr(ck, BKEY_CACHED_LRU_SHARDS_BITS);
+}
+
+static bool bkey_cached_lru_add(struct bch_fs_btree_key_cache *bc,
+				struct bkey_cached *ck)
+{
+	struct bkey_cached_lru *lru = bkey_cached_lru(bc, ck);
+
+	guard(spinlock)(&lru->lock);
+	if (!list_empty(&ck->lru))
+		return false;
+
+	list_add_tail(&ck->lru, &lru->list);
+	lru->nr++;
+	return true;
+}
+
+static void bkey_cached_lru_del(struct bch_fs_btree_key_cache *bc,
+				struct bkey_cached *ck)
+{
+	struct bkey_cached_lru *lru = bkey_cached_lru(bc, ck);
+
+	guard(spinlock)(&lru->lock);
+	if (!list_empty(&ck->lru)) {
+		list_del_init(&ck->lru);
+		lru->nr--;
+	}
+}
+
 static bool bkey_cached_evict(struct bch_fs_btree_key_cache *c,
 			      struct bkey_cached *ck)
 {
+	bkey_cached_lru_del(c, ck);
+
 	bool ret = !rhashtable_remove_fast(&c->table, &ck->hash,
 				      bch2_btree_key_cache_params);
 	if (ret) {
@@ -150,6 +251,7 @@ static struct bkey_cached *__bkey_cached_alloc(unsigned key_u64s, gfp_t gfp)
 	struct bkey_cached *ck = kmem_cache_zalloc(bch2_key_cache, gfp);
 	if (unlikely(!ck))
 		return NULL;
+	INIT_LIST_HEAD(&ck->lru);
 	ck->k = kmalloc(key_u64s * sizeof(u64), gfp);
 	if (unlikely(!ck->k)) {
 		kmem_cache_free(bch2_key_cache, ck);
@@ -218,25 +320,35 @@ bkey_cached_alloc(struct btree_trans *trans, struct btree_path *path, unsigned k
 			struct bkey_cached, rcu);
 }
 
+/*
+ * Allocation failed: steal the first clean entry we can lock off the lru
+ * lists
+ */
 static struct bkey_cached *
 bkey_cached_reuse(struct bch_fs_btree_key_cache *c)
 {
+	for (struct bkey_cached_lru *lru = c->lru;
+	     lru < c->lru + ARRAY_SIZE(c->lru);
+	     lru++) {
+		struct bkey_cached *ck, *found = NULL;
+
+		scoped_guard(spinlock, &lru->lock)
+			list_for_each_entry(ck, &lru->list, lru)
+				if (!test_bit(BKEY_CACHED_DIRTY, &ck->flags) &&
+				    bkey_cached_lock_for_evict(ck)) {
+					list_del_init(&ck->lru);
+					lru->nr--;
+					found = ck;
+					break;
+				}
 
-	guard(rcu)();
-	struct bucket_table *tbl = rht_dereference_rcu(c->table.tbl, &c->table);
-	struct rhash_head *pos;
-	struct bkey_cached *ck;
-
-	for (unsigned i = 0; i < tbl->size; i++)
-		rht_for_each_entry_rcu(ck, pos, tbl, i, hash) {
-			if (!test_bit(BKEY_CACHED_DIRTY, &ck->flags) &&
-			    bkey_cached_lock_for_evict(ck)) {
-				if (bkey_cached_evict(c, ck))
-					return ck;
-				six_unlock_write(&ck->c.lock);
-				six_unlock_intent(&ck->c.lock);
-			}
+		if (found) {
+			if (bkey_cached_evict(c, found))
+				return found;
+			six_unlock_write(&found->c.lock);
+			six_unlock_intent(&found->c.lock);
 		}
+	}
 	return NULL;
 }
 
@@ -320,6 +432,8 @@ static int btree_key_cache_create(struct btree_trans *trans,
 		goto err;
 
 	atomic_long_inc(&bc->nr_keys);
+	ck->fill_time = local_clock();
+	bkey_cached_lru_add(bc, ck);
 	six_unlock_write(&ck->c.lock);
 
 	enum six_lock_type lock_want = __btree_lock_want(ck_path, 0);
@@ -523,6 +637,10 @@ static int btree_key_cache_flush_pos(struct btree_trans *trans,
 			clear_bit(BKEY_CACHED_DIRTY, &ck->flags);
 			atomic_long_dec(&c->btree.key_cache.nr_dirty);
 		}
+
+		/* Clean now: make it visible to the shrinker again */
+		if (bkey_cached_lru_add(&c->btree.key_cache, ck))
+			c->btree.key_cache.lru_readded++;
 	} else {
 		struct btree_path *path = btree_iter_path(trans, &c_iter);
 		struct btree_path *path2;
@@ -800,75 +918,108 @@ void bch2_btree_key_cache_drop(struct btree_trans *trans,
 	bch2_trans_verify_locks(trans);
 }
 
+#define BKEY_CACHED_EVICT_BATCH		64
+
+/*
+ * Walk one lru shard from the head: pull off a batch of entries we can lock
+ * for eviction under the shard lock, then evict them with the lock dropped.
+ */
+static size_t bkey_cached_lru_scan(struct bch_fs *c,
+				   struct bkey_cached_lru *lru,
+				   size_t nr_to_scan, size_t *freed)
+{
+	struct bch_fs_btree_key_cache *bc = &c->btree.key_cache;
+	struct bkey_cached *batch[BKEY_CACHED_EVICT_BATCH];
+	size_t scanned = 0;
+	bool done = false;
+
+	while (!done) {
+		unsigned nr = 0;
+
+		scoped_guard(spinlock, &lru->lock) {
+			while (nr < ARRAY_SIZE(batch)) {
+				if (scanned >= nr_to_scan || list_empty(&lru->list)) {
+					done = true;
+					break;
+				}
+
+				struct bkey_cached *ck =
+					list_first_entry(&lru->list, struct bkey_cached, lru);
+				scanned++;
+
+				if (test_bit(BKEY_CACHED_DIRTY, &ck->flags)) {
+					list_del_init(&ck->lru);
+					lru->nr--;
+					bc->skipped_dirty++;
+				} else if (test_bit(BKEY_CACHED_ACCESSED, &ck->flags)) {
+					clear_bit(BKEY_CACHED_ACCESSED, &ck->flags);
+					list_move_tail(&ck->lru, &lru->list);
+					bc->skipped_accessed++;
+				} else if (!bkey_cached_lock_for_evict(ck)) {
+					list_move_tail(&ck->lru, &lru->list);
+					bc->skipped_lock_fail++;
+				} else {
+					list_del_init(&ck->lru);
+					lru->nr--;
+					batch[nr++] = ck;
+				}
+			}
+		}
+
+		u64 now = local_clock();
+
+		for (unsigned i = 0; i < nr; i++) {
+			struct bkey_cached *ck = batch[i];
+
+			if (bkey_cached_evict(bc, ck)) {
+				__bch2_time_stats_update(&c->times[BCH_TIME_btree_key_cache_evict_age],
+							 ck->fill_time, now);
+				bkey_cached_free_noassert(bc, ck);
+				bc->freed++;
+				(*freed)++;
+			} else {
+				six_unlock_write(&ck->c.lock);
+				six_unlock_intent(&ck->c.lock);
+			}
+		}
+	}
+
+	return scanned;
+}
+
 static unsigned long bch2_btree_key_cache_scan(struct shrinker *shrink,
 					   struct shrink_control *sc)
 {
 	struct bch_fs *c = shrink->private_data;
 	struct bch_fs_btree_key_cache *bc = &c->btree.key_cache;
-	struct bucket_table *tbl;
-	struct bkey_cached *ck;
 	size_t scanned = 0, freed = 0, nr = sc->nr_to_scan;
-	unsigned iter, start;
+	unsigned iter = bc->shrink_iter, empty = 0;
 
 	u64 start_time = local_clock();
 	guard(srcu)(&c->btree.trans.barrier);
-	guard(rcu)();
 
-	tbl = rht_dereference_rcu(bc->table.tbl, &bc->table);
+	bc->requested_to_free += nr;
 
 	/*
-	 * Scanning is expensive while a rehash is in progress - most elements
-	 * will be on the new hashtable, if it's in progress
-	 *
-	 * A rehash could still start while we're scanning - that's ok, we'll
-	 * still see most elements.
+	 * Spread the scan over the shards, so that one pass ages all of them
+	 * evenly; doesn't touch the hash table, so works during a rehash:
 	 */
-	if (unlikely(tbl->nest))
-		return SHRINK_STOP;
-
-	iter = bc->shrink_iter;
-	if (iter >= tbl->size)
-		iter = 0;
-	start = iter;
-
-	do {
-		struct rhash_head *pos, *next;
-
-		pos = rht_ptr_rcu(&tbl->buckets[iter]);
-
-		while (!rht_is_a_nulls(pos)) {
-			next = rht_dereference_bucket_rcu(pos->next, tbl, iter);
-			ck = container_of(pos, struct bkey_cached, hash);
-
-			if (test_bit(BKEY_CACHED_DIRTY, &ck->flags)) {
-				bc->skipped_dirty++;
-			} else if (test_bit(BKEY_CACHED_ACCESSED, &ck->flags)) {
-				clear_bit(BKEY_CACHED_ACCESSED, &ck->flags);
-				bc->skipped_accessed++;
-			} else if (!bkey_cached_lock_for_evict(ck)) {
-				bc->skipped_lock_fail++;
-			} else if (bkey_cached_evict(bc, ck)) {
-				bkey_cached_free_noassert(bc, ck);
-				bc->freed++;
-				freed++;
-			} else {
-				six_unlock_write(&ck->c.lock);
-				six_unlock_intent(&ck->c.lock);
-			}
+	size_t per_shard = max_t(size_t, DIV_ROUND_UP(nr, BKEY_CACHED_LRU_SHARDS),
+				 BKEY_CACHED_EVICT_BATCH);
 
-			scanned++;
-			if (scanned >= nr)
-				goto out;
+	while (scanned < nr && empty < BKEY_CACHED_LRU_SHARDS) {
+		size_t n = bkey_cached_lru_scan(c, &bc->lru[iter],
+						min(per_shard, nr - scanned), &freed);
 
-			pos = next;
-		}
+		empty = n ? 0 : empty + 1;
+		scanned += n;
+		iter = (iter + 1) % BKEY_CACHED_LRU_SHARDS;
+	}
 
-		iter++;
-		if (iter >= tbl->size)
-			iter = 0;
-	} while (scanned < nr && iter != start);
-out:
 	bc->shrink_iter = iter;
+	bc->scanned += scanned;
+	if (freed)
+		WRITE_ONCE(bc->last_shrink, jiffies);
 
 	bch2_time_stats_update(&c->times[BCH_TIME_btree_key_cache_scan], start_time);
 
@@ -948,6 +1099,8 @@ rehash_wait:
 	rcu_pending_exit(&bc->pending[0]);
 	rcu_pending_exit(&bc->pending[1]);
 
+	free_percpu(bc->admit_stats);
+	kvfree(bc->sketch.counters);
 	free_percpu(bc->nr_pending);
 }
 
@@ -956,10 +1109,22 @@ int bch2_fs_btree_key_cache_init(struct bch_fs_btree_key_cache *bc)
 	struct bch_fs *c = container_of(bc, struct bch_fs, btree.key_cache);
 	struct shrinker *shrink;
 
+	for (struct bkey_cached_lru *lru = bc->lru;
+	     lru < bc->lru + ARRAY_SIZE(bc->lru);
+	     lru++) {
+		spin_lock_init(&lru->lock);
+		INIT_LIST_HEAD(&lru->list);
+	}
+
 	bc->nr_pending = alloc_percpu(size_t);
 	if (!bc->nr_pending)
 		return bch_err_throw(c, ENOMEM_fs_btree_cache_init);
 
+	bc->admit_stats = alloc_percpu(struct bkey_cached_admit_stats);
+	bc->sketch.counters = kvzalloc(BKEY_CACHED_SKETCH_NR, GFP_KERNEL);
+	if (!bc->admit_stats || !bc->sketch.counters)
+		return bch_err_throw(c, ENOMEM_fs_btree_cache_init);
+
 	if (rcu_pending_init(&bc->pending[0], &c->btree.trans.barrier, __bkey_cached_free) ||
 	    rcu_pending_init(&bc->pending[1], &c->btree.trans.barrier, __bkey_cached_free))
 		return bch_err_throw(c, ENOMEM_fs_btree_cache_init);
@@ -990,13 +1155,40 @@ void bch2_btree_key_cache_to_text(struct printbuf *out, struct bch_fs_btree_key_
 	prt_printf(out, "keys:\t%lu\r\n",		atomic_long_read(&bc->nr_keys));
 	prt_printf(out, "dirty:\t%lu\r\n",		atomic_long_read(&bc->nr_dirty));
 	prt_printf(out, "table size:\t%u\r\n",		bc->table.tbl->size);
+
+	size_t lru_nr = 0;
+	for (unsigned i = 0; i < ARRAY_SIZE(bc->lru); i++)
+		lru_nr += READ_ONCE(bc->lru[i].nr);
+	prt_printf(out, "on lru:\t%zu\r\n",		lru_nr);
 	prt_newline(out);
 	prt_printf(out, "shrinker:\n");
 	prt_printf(out, "requested_to_free:\t%lu\r\n",	bc->requested_to_free);
+	prt_printf(out, "scanned:\t%lu\r\n",		bc->scanned);
 	prt_printf(out, "freed:\t%lu\r\n",		bc->freed);
 	prt_printf(out, "skipped_dirty:\t%lu\r\n",	bc->skipped_dirty);
 	prt_printf(out, "skipped_accessed:\t%lu\r\n",	bc->skipped_accessed);
 	prt_printf(out, "skipped_lock_fail:\t%lu\r\n",	bc->skipped_lock_fail);
+	prt_printf(out, "lru_readded:\t%lu\r\n",	bc->lru_readded);
+	if (bc->scanned)
+		prt_printf(out, "freed per scanned:\t%lu%%\r\n",
+			   bc->freed * 100 / bc->scanned);
+
+	struct bkey_cached_admit_stats admit = {};
+	int cpu;
+	if (bc->admit_stats)
+		for_each_possible_cpu(cpu) {
+			struct bkey_cached_admit_stats *s = per_cpu_ptr(bc->admit_stats, cpu);
+
+			admit.hit		+= s->hit;
+			admit.admitted		+= s->admitted;
+			admit.rejected		+= s->rejected;
+		}
+
+	prt_newline(out);
+	prt_printf(out, "admission:\n");
+	prt_printf(out, "hit:\t%llu\r\n",		admit.hit);
+	prt_printf(out, "admitted:\t%llu\r\n",	admit.admitted);
+	prt_printf(out, "rejected:\t%llu\r\n",	admit.rejected);
 	prt_newline(out);
 	prt_printf(out, "pending:\t%zu\r\n",		per_cpu_sum(bc->nr_pending));
 }
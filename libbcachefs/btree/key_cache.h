@@ -41,6 +41,8 @@ int bch2_btree_key_cache_flush_going_ro(struct bch_fs *);
 struct bkey_cached *
 bch2_btree_key_cache_find(struct bch_fs *, enum btree_id, struct bpos);
 
+bool bch2_btree_key_cache_admit(struct bch_fs *, enum btree_id, struct bpos);
+
 int bch2_btree_path_traverse_cached(struct btree_trans *, btree_path_idx_t, unsigned);
 
 bool bch2_btree_insert_key_cached(struct btree_trans *, unsigned,
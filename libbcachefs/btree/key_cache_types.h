@@ -4,12 +4,62 @@
 
 #include "util/rcu_pending.h"
 
+/*
+ * Clean key cache entries are kept on sharded CLOCK lists, so the shrinker can
+ * find eviction candidates without walking the hash table: entries are added
+ * at the tail when created, the shrinker walks from the head, rotating
+ * entries that have been accessed since it last saw them. Dirty entries are
+ * dropped from the list when the shrinker sees them, and put back when they're
+ * flushed.
+ */
+#define BKEY_CACHED_LRU_SHARDS_BITS	4
+#define BKEY_CACHED_LRU_SHARDS		(1U << BKEY_CACHED_LRU_SHARDS_BITS)
+
+struct bkey_cached_lru {
+	spinlock_t		lock;
+	struct list_head	list;
+	size_t			nr;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Admission filter for read-only lookups in the inodes and alloc btrees: a
+ * count-min sketch of recent lookups (u8 counters saturating at
+ * BKEY_CACHED_SKETCH_MAX, halved every BKEY_CACHED_SKETCH_RESET lookups), so
+ * that one-off scans don't displace the hot set while the shrinker is active.
+ */
+#define BKEY_CACHED_SKETCH_BITS		16
+#define BKEY_CACHED_SKETCH_NR		(1U << BKEY_CACHED_SKETCH_BITS)
+#define BKEY_CACHED_SKETCH_HASHES	4
+#define BKEY_CACHED_SKETCH_MAX		15
+#define BKEY_CACHED_SKETCH_RESET	(BKEY_CACHED_SKETCH_NR * 8)
+
+struct bkey_cached_admit_stats {
+	/* already cached */
+	u64			hit;
+	/* passed the filter */
+	u64			admitted;
+	/* read from the btree without creating a key cache entry */
+	u64			rejected;
+};
+
+struct bkey_cached_sketch {
+	u8			*counters;
+	atomic_t		nr;
+};
+
 struct bch_fs_btree_key_cache {
 	struct rhashtable	table;
 	bool			table_init_done;
 
+	struct bkey_cached_lru	lru[BKEY_CACHED_LRU_SHARDS];
+
 	struct shrinker		*shrink;
+	/* next lru shard to scan */
 	unsigned		shrink_iter;
+	/* jiffies, last time the shrinker freed anything */
+	unsigned long		last_shrink;
+
+	struct bkey_cached_sketch sketch;
 
 	/* 0: non pcpu reader locks, 1: pcpu reader locks */
 	struct rcu_pending	pending[2];
@@ -20,10 +70,14 @@ struct bch_fs_btree_key_cache {
 
 	/* shrinker stats */
 	unsigned long		requested_to_free;
+	unsigned long		scanned;
 	unsigned long		freed;
 	unsigned long		skipped_dirty;
 	unsigned long		skipped_accessed;
 	unsigned long		skipped_lock_fail;
+	unsigned long		lru_readded;
+
+	struct bkey_cached_admit_stats __percpu *admit_stats;
 };
 
 struct bkey_cached_key {
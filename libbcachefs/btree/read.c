@@ -14,6 +14,7 @@
 #include "btree/update.h"
 
 #include "data/checksum.h"
+#include "data/compress.h"
 #include "data/extents.h"
 
 #include "debug/async_objs.h"
@@ -569,6 +570,40 @@ fsck_err:
 	return ret;
 }
 
+/*
+ * Decompress a BSET_COMPRESSED bset in place, once it's been checksummed and
+ * decrypted: the space its uncompressed keys need follows it in the node
+ * buffer, so afterwards it looks like it was written uncompressed.
+ */
+int bch2_bset_decompress(struct bch_fs *c, struct bset *i)
+{
+	struct bset_compressed *h = (void *) i->_data;
+	enum bch_compression_type type = h->type;
+	unsigned u64s = le16_to_cpu(h->u64s);
+	size_t src_len = le32_to_cpu(h->bytes);
+	u64 start_time = local_clock();
+	bool used_mempool;
+
+	if (!i->u64s ||
+	    src_len > le16_to_cpu(i->u64s) * sizeof(u64) - sizeof(*h))
+		return bch_err_throw(c, decompress_bset_len_bad);
+
+	void *src = bch2_btree_bounce_alloc(c, src_len, &used_mempool);
+	memcpy(src, h->data, src_len);
+
+	int ret = bch2_decompress_buf(c, type, i->_data, u64s * sizeof(u64), src, src_len);
+
+	bch2_btree_bounce_free(c, src_len, used_mempool, src);
+
+	if (!ret) {
+		i->u64s = cpu_to_le16(u64s);
+		SET_BSET_COMPRESSED(i, false);
+	}
+
+	bch2_time_stats_update(&c->times[BCH_TIME_btree_node_decompress], start_time);
+	return ret;
+}
+
 int bch2_btree_node_read_done(struct bch_fs *c, struct bch_dev *ca,
 			      struct btree *b,
 			      struct bch_io_failures *failed,
@@ -729,6 +764,32 @@ int bch2_btree_node_read_done(struct bch_fs *c, struct bch_dev *ca,
 			}
 		}
 
+		if (BSET_COMPRESSED(i)) {
+			btree_err_on(!i->u64s,
+				     0,
+				     c, ca, b, i, NULL,
+				     bset_bad_compression,
+				     "compressed bset with no compression header");
+
+			sectors = first
+				? btree_bset_sectors(b->data, c->block_bits)
+				: btree_bset_sectors(bne, c->block_bits);
+
+			btree_err_on(b->written + sectors > (ptr_written ?: btree_sectors(c)),
+				     0,
+				     c, ca, b, i, NULL,
+				     bset_past_end_of_btree_node,
+				     "compressed bset past end of btree node (offset %u len %u but written %zu)",
+				     b->written, sectors, ptr_written ?: btree_sectors(c));
+
+			ret = bch2_bset_decompress(c, i);
+			btree_err_on(ret,
+				     0,
+				     c, ca, b, i, NULL,
+				     bset_bad_compression,
+				     "error decompressing bset: %s", bch2_err_str(ret));
+		}
+
 		b->version_ondisk = min(b->version_ondisk,
 					le16_to_cpu(i->version));
 
@@ -1184,7 +1245,7 @@ static bool btree_node_scrub_check(struct bch_fs *c, struct btree_node *data, un
 				}
 			}
 
-			written += vstruct_sectors(data, c->block_bits);
+			written += btree_bset_sectors(data, c->block_bits);
 		} else {
 			if (good_csum_type) {
 				struct bch_csum csum = csum_vstruct(c, BSET_CSUM_TYPE(i), nonce, bne);
@@ -1194,7 +1255,7 @@ static bool btree_node_scrub_check(struct bch_fs *c, struct btree_node *data, un
 				}
 			}
 
-			written += vstruct_sectors(bne, c->block_bits);
+			written += btree_bset_sectors(bne, c->block_bits);
 		}
 	}
 
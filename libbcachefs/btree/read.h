@@ -53,9 +53,25 @@ static inline struct nonce btree_nonce(struct bset *i, unsigned offset)
 	}};
 }
 
+/*
+ * Sectors a bset owns in the node: for a compressed bset, that's what its keys
+ * take uncompressed, not what was written
+ */
+#define btree_bset_sectors(_s, _sector_block_bits)			\
+	(BSET_COMPRESSED(&(_s)->keys)					\
+	 ? round_up(__vstruct_bytes(typeof(*(_s)),			\
+			le16_to_cpu(((struct bset_compressed *)		\
+				     (_s)->keys._data)->u64s)),		\
+		    512 << (_sector_block_bits)) >> 9			\
+	 : vstruct_sectors(_s, _sector_block_bits))
+
 static inline int bset_encrypt(struct bch_fs *c, struct bset *i, unsigned offset)
 {
 	struct nonce nonce = btree_nonce(i, offset);
+	/* the compression header stays in the clear: */
+	void *start = BSET_COMPRESSED(i) && i->u64s
+		? (void *) i->_data + sizeof(struct bset_compressed)
+		: (void *) i->_data;
 	int ret;
 
 	if (!offset) {
@@ -70,10 +86,12 @@ static inline int bset_encrypt(struct bch_fs *c, struct bset *i, unsigned offset
 		nonce = nonce_add(nonce, round_up(bytes, CHACHA_BLOCK_SIZE));
 	}
 
-	return bch2_encrypt(c, BSET_CSUM_TYPE(i), nonce, i->_data,
-			    vstruct_end(i) - (void *) i->_data);
+	return bch2_encrypt(c, BSET_CSUM_TYPE(i), nonce, start,
+			    vstruct_end(i) - start);
 }
 
+int bch2_bset_decompress(struct bch_fs *, struct bset *);
+
 void bch2_btree_node_drop_keys_outside_node(struct btree *);
 
 int bch2_validate_bset_keys(struct bch_fs *, struct bch_dev *,
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/* DOC(trans-restart-profile)
+ *
+ * Transaction restarts are cheap individually but can add up to a large
+ * fraction of the time spent in the btree code, and the aggregate restart
+ * counters don't say which transactions are losing time, or where.
+ *
+ * When enabled (trans_restart_profile=N), bch2_trans_begin() records one in N
+ * restarts into a per-cpu ring buffer: the transaction function, restart
+ * reason, the btree and position of the path traverse that restarted (if the
+ * restart happened in traverse), the restart ip, and the time since the
+ * previous bch2_trans_begin() - the work thrown away by the restart.
+ *
+ * The ring buffers are only allocated the first time a restart is sampled,
+ * so the profiler costs nothing beyond an option check when disabled.
+ */
+
+#include "bcachefs.h"
+
+#include "btree/cache.h"
+#include "btree/iter.h"
+#include "btree/restart_profile.h"
+
+#include "init/error.h"
+
+#include <linux/sort.h>
+
+static struct trans_restart_ring __percpu *trans_restart_profile_get(struct bch_fs *c)
+{
+	struct trans_restart_ring __percpu *rings = READ_ONCE(c->btree.trans.restart_profile);
+	if (likely(rings))
+		return rings;
+
+	/* We may be holding btree locks: can't do reclaim */
+	rings = alloc_percpu_gfp(struct trans_restart_ring, GFP_NOWAIT|__GFP_NOWARN);
+	if (!rings)
+		return NULL;
+
+	int cpu;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(rings, cpu)->lock);
+
+	struct trans_restart_ring __percpu *old =
+		cmpxchg(&c->btree.trans.restart_profile, NULL, rings);
+	if (old) {
+		free_percpu(rings);
+		rings = old;
+	}
+	return rings;
+}
+
+void __bch2_trans_restart_profile_add(struct btree_trans *trans, u64 now)
+{
+	struct bch_fs *c = trans->c;
+	/* may have been changed since the caller checked it: */
+	u32 rate = READ_ONCE(c->opts.trans_restart_profile);
+	if (!rate)
+		return;
+
+	struct trans_restart_ring __percpu *rings = trans_restart_profile_get(c);
+	if (!rings)
+		return;
+
+	guard(preempt)();
+	struct trans_restart_ring *r = this_cpu_ptr(rings);
+
+	guard(spinlock)(&r->lock);
+	if (r->seen++ % rate)
+		return;
+
+	struct trans_restart_sample *s = &r->samples[r->nr++ % TRANS_RESTART_PROFILE_NR];
+
+	s->time		= now;
+	s->lost_ns	= time_after64(now, trans->last_begin_time)
+		? now - trans->last_begin_time : 0;
+	s->ip		= trans->last_restarted_ip;
+	s->err		= trans->restarted;
+	s->fn_idx	= trans->fn_idx;
+	if (trans->last_restarted_pos_valid) {
+		s->btree	= trans->last_restarted_btree;
+		s->pos		= trans->last_restarted_pos;
+	} else {
+		s->btree	= BTREE_ID_NR;
+		s->pos		= POS_MIN;
+	}
+}
+
+void bch2_trans_restart_profile_reset(struct bch_fs *c)
+{
+	struct trans_restart_ring __percpu *rings = READ_ONCE(c->btree.trans.restart_profile);
+	int cpu;
+
+	if (rings)
+		for_each_possible_cpu(cpu) {
+			struct trans_restart_ring *r = per_cpu_ptr(rings, cpu);
+
+			guard(spinlock)(&r->lock);
+			r->seen	= 0;
+			r->nr	= 0;
+		}
+}
+
+DEFINE_DARRAY_NAMED(darray_trans_restart_sample, struct trans_restart_sample);
+
+static int trans_restart_samples_get(struct bch_fs *c, darray_trans_restart_sample *samples)
+{
+	struct trans_restart_ring __percpu *rings = READ_ONCE(c->btree.trans.restart_profile);
+	int cpu;
+
+	if (!rings)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct trans_restart_ring *r = per_cpu_ptr(rings, cpu);
+
+		try(darray_make_room(samples, TRANS_RESTART_PROFILE_NR));
+
+		guard(spinlock)(&r->lock);
+		unsigned nr = min_t(u64, r->nr, TRANS_RESTART_PROFILE_NR);
+		for (unsigned i = 0; i < nr; i++)
+			samples->data[samples->nr++] = r->samples[i];
+	}
+
+	return 0;
+}
+
+static const char *trans_restart_fn_str(unsigned fn_idx)
+{
+	return fn_idx < ARRAY_SIZE(bch2_btree_transaction_fns) &&
+		bch2_btree_transaction_fns[fn_idx]
+		? bch2_btree_transaction_fns[fn_idx]
+		: "(unknown)";
+}
+
+void bch2_trans_restart_profile_json_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	CLASS(darray_trans_restart_sample, samples)();
+
+	int ret = trans_restart_samples_get(c, &samples);
+	if (ret) {
+		out->allocation_failure = true;
+		return;
+	}
+
+	prt_printf(out, "{\"sample_rate\":%u,\"samples\":[", c->opts.trans_restart_profile);
+
+	darray_for_each(samples, s) {
+		if (s != samples.data)
+			prt_char(out, ',');
+
+		prt_printf(out, "{\"fn\":\"%s\",\"reason\":\"%s\",\"btree\":\"%s\",\"pos\":\"",
+			   trans_restart_fn_str(s->fn_idx),
+			   bch2_err_str(s->err),
+			   bch2_btree_id_str(s->btree));
+		bch2_bpos_to_text(out, s->pos);
+		prt_printf(out, "\",\"ip\":\"%pS\",\"lost_ns\":%llu,\"time_ns\":%llu}",
+			   (void *) s->ip, s->lost_ns, s->time);
+	}
+
+	prt_str(out, "]}\n");
+}
+
+/* Aggregated summary, for userspace tools that don't have sysfs: */
+
+struct trans_restart_agg {
+	u8			fn_idx;
+	u8			btree;
+	u16			err;
+	u32			nr;
+	u64			lost_ns;
+};
+
+DEFINE_DARRAY_NAMED(darray_trans_restart_agg, struct trans_restart_agg);
+
+static int trans_restart_agg_cmp(const void *_l, const void *_r)
+{
+	const struct trans_restart_agg *l = _l, *r = _r;
+
+	return cmp_int(r->lost_ns, l->lost_ns);
+}
+
+void bch2_trans_restart_profile_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	CLASS(darray_trans_restart_sample, samples)();
+	CLASS(darray_trans_restart_agg, agg)();
+
+	if (trans_restart_samples_get(c, &samples)) {
+		prt_str(out, "(allocation failure)\n");
+		return;
+	}
+
+	darray_for_each(samples, s) {
+		struct trans_restart_agg *a = darray_find_p(agg, i,
+				i->fn_idx	== s->fn_idx &&
+				i->btree	== s->btree &&
+				i->err		== s->err);
+		if (!a) {
+			if (darray_push(&agg, ((struct trans_restart_agg) {
+					.fn_idx	= s->fn_idx,
+					.btree	= s->btree,
+					.err	= s->err,
+				}))) {
+				prt_str(out, "(allocation failure)\n");
+				return;
+			}
+			a = &darray_last(agg);
+		}
+
+		a->nr++;
+		a->lost_ns += s->lost_ns;
+	}
+
+	darray_sort(agg, trans_restart_agg_cmp);
+
+	prt_printf(out, "transaction restarts sampled (1 in %u): %zu\n",
+		   c->opts.trans_restart_profile, samples.nr);
+
+	printbuf_tabstop_push(out, 40);
+	printbuf_tabstop_push(out, 40);
+	printbuf_tabstop_push(out, 16);
+	printbuf_tabstop_push(out, 8);
+	printbuf_tabstop_push(out, 12);
+
+	prt_printf(out, "fn\treason\tbtree\tnr\r\tlost\r\n");
+
+	darray_for_each(agg, a) {
+		if (a - agg.data >= 20)
+			break;
+
+		prt_printf(out, "%s\t%s\t%s\t%u\r\t",
+			   trans_restart_fn_str(a->fn_idx),
+			   bch2_err_str(a->err),
+			   bch2_btree_id_str(a->btree),
+			   a->nr);
+		bch2_pr_time_units(out, a->lost_ns);
+		prt_printf(out, "\r\n");
+	}
+}
+
+void bch2_fs_trans_restart_profile_exit(struct bch_fs *c)
+{
+#ifndef __KERNEL__
+	/* No sysfs in userspace: print what we collected */
+	if (c->opts.trans_restart_profile &&
+	    c->btree.trans.restart_profile) {
+		CLASS(printbuf, buf)();
+		bch2_trans_restart_profile_to_text(&buf, c);
+		bch2_print_str(c, KERN_INFO, buf.buf);
+	}
+#endif
+	free_percpu(c->btree.trans.restart_profile);
+	printbuf_exit(&c->btree.trans.restart_profile_json_buf);
+}
+
+void bch2_fs_trans_restart_profile_init_early(struct bch_fs *c)
+{
+	mutex_init(&c->btree.trans.restart_profile_json_lock);
+	c->btree.trans.restart_profile_json_buf = PRINTBUF;
+}
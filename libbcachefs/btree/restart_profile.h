@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_BTREE_RESTART_PROFILE_H
+#define _BCACHEFS_BTREE_RESTART_PROFILE_H
+
+/*
+ * Sampling transaction restart profiler
+ *
+ * When the trans_restart_profile option is nonzero, one in every N
+ * transaction restarts is recorded - restart reason, the transaction that
+ * restarted, where it restarted and how much work was thrown away - into a
+ * small per-cpu ring buffer. Samples are exported raw via
+ * internal/trans_restart_profile_json and aggregated by userspace
+ * (bcachefs trans-profile).
+ */
+
+#include "btree/types.h"
+
+#define TRANS_RESTART_PROFILE_NR	128
+
+struct trans_restart_sample {
+	u64			time;
+	/* time from bch2_trans_begin() to the restart being handled */
+	u64			lost_ns;
+	unsigned long		ip;
+	struct bpos		pos;
+	u16			err;
+	u8			fn_idx;
+	u8			btree;
+};
+
+struct trans_restart_ring {
+	spinlock_t		lock;
+	/* restarts seen on this cpu while profiling, for sampling: */
+	u32			seen;
+	/* samples recorded, ring index is nr % TRANS_RESTART_PROFILE_NR: */
+	u64			nr;
+	struct trans_restart_sample samples[TRANS_RESTART_PROFILE_NR];
+};
+
+/*
+ * Called at the end of path traverse: the first traverse that sees a restart
+ * records which btree and position it happened at
+ */
+static inline void bch2_trans_restart_note_path(struct btree_trans *trans,
+						struct btree_path *path)
+{
+	if (!trans->last_restarted_pos_valid) {
+		trans->last_restarted_pos_valid	= true;
+		trans->last_restarted_btree	= path->btree_id;
+		trans->last_restarted_pos	= path->pos;
+	}
+}
+
+void __bch2_trans_restart_profile_add(struct btree_trans *, u64);
+
+static inline void bch2_trans_restart_profile_add(struct btree_trans *trans, u64 now)
+{
+	if (unlikely(trans->c->opts.trans_restart_profile))
+		__bch2_trans_restart_profile_add(trans, now);
+}
+
+void bch2_trans_restart_profile_reset(struct bch_fs *);
+void bch2_trans_restart_profile_json_to_text(struct printbuf *, struct bch_fs *);
+void bch2_trans_restart_profile_to_text(struct printbuf *, struct bch_fs *);
+
+void bch2_fs_trans_restart_profile_exit(struct bch_fs *);
+void bch2_fs_trans_restart_profile_init_early(struct bch_fs *);
+
+#endif /* _BCACHEFS_BTREE_RESTART_PROFILE_H */
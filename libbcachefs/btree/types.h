@@ -23,6 +23,7 @@ struct open_bucket;
 struct btree_update;
 struct btree_trans;
 struct lock_graph;
+struct trans_restart_ring;
 
 /* Btree nodes: */
 
@@ -467,6 +468,9 @@ struct bkey_cached {
 	struct bkey_cached_key	key;
 
 	struct rhash_head	hash;
+	/* bch_fs_btree_key_cache.lru, if clean: */
+	struct list_head	lru;
+	u64			fill_time;
 
 	struct journal_entry_pin journal;
 	u64			seq;
@@ -604,6 +608,7 @@ struct btree_trans {
 	bool			journal_replay_not_finished:1;
 	bool			notrace_relock_fail:1;
 	bool			has_interior_updates:1;
+	bool			last_restarted_pos_valid:1;
 	enum bch_errcode	restarted:16;
 	u32			restart_count;
 #ifdef CONFIG_BCACHEFS_INJECT_TRANSACTION_RESTARTS
@@ -614,6 +619,9 @@ struct btree_trans {
 	u64			last_begin_time;
 	unsigned long		last_begin_ip;
 	unsigned long		last_restarted_ip;
+	/* where the restart happened, if it was in path traverse: */
+	enum btree_id		last_restarted_btree;
+	struct bpos		last_restarted_pos;
 #ifdef CONFIG_BCACHEFS_DEBUG
 	bch_stacktrace		last_restarted_trace;
 #endif
@@ -693,6 +701,10 @@ struct bch_fs_btree_trans {
 
 	struct mutex			stats_json_lock;
 	struct printbuf			stats_json_buf;
+
+	struct trans_restart_ring	__percpu *restart_profile;
+	struct mutex			restart_profile_json_lock;
+	struct printbuf			restart_profile_json_buf;
 };
 
 static inline struct btree_path *btree_iter_path(struct btree_trans *trans, struct btree_iter *iter)
@@ -6,6 +6,7 @@
 #include "btree/sort.h"
 #include "btree/write.h"
 
+#include "data/compress.h"
 #include "data/reconcile/trigger.h"
 #include "data/write.h"
 
@@ -261,6 +262,59 @@ static int validate_bset_for_write(struct bch_fs *c, struct btree *b,
 	return ret;
 }
 
+/*
+ * metadata_compression: compress the keys of a bset we're about to write, in
+ * place. The bset keeps the space its uncompressed keys took in the node -
+ * b->written still advances by that much - but only the compressed keys are
+ * written.
+ *
+ * Returns the number of bytes to write.
+ */
+static unsigned btree_bset_compress(struct bch_fs *c, void *data, struct bset *i,
+				    unsigned bytes_to_write)
+{
+	unsigned compression_opt = c->opts.metadata_compression;
+
+	if (!compression_opt ||
+	    !(c->sb.features & BIT_ULL(BCH_FEATURE_btree_node_compression)))
+		return bytes_to_write;
+
+	/* Only worth it if we write at least a block less: */
+	unsigned hdr_bytes = (void *) i->_data - data + sizeof(struct bset_compressed);
+	unsigned max_bytes = round_up(bytes_to_write, block_bytes(c)) - block_bytes(c);
+	if (max_bytes < hdr_bytes + 64)
+		return bytes_to_write;
+
+	size_t dst_len = max_bytes - hdr_bytes;
+	void *dst = kvmalloc(dst_len, GFP_NOWAIT|__GFP_NOWARN);
+	if (!dst)
+		return bytes_to_write;
+
+	u64 start_time = local_clock();
+	size_t src_len = le16_to_cpu(i->u64s) * sizeof(u64);
+	size_t dst_bytes = bch2_compress_buf(c, compression_opt, dst, dst_len, i->_data, src_len);
+
+	if (dst_bytes) {
+		struct bset_compressed *h = (void *) i->_data;
+
+		h->type		= bch2_compression_opt_to_type(compression_opt);
+		h->pad		= 0;
+		h->u64s		= i->u64s;
+		h->bytes	= cpu_to_le32(dst_bytes);
+		memcpy(h->data, dst, dst_bytes);
+		memset(h->data + dst_bytes, 0, round_up(dst_bytes, sizeof(u64)) - dst_bytes);
+
+		i->u64s = cpu_to_le16(DIV_ROUND_UP(sizeof(*h) + dst_bytes, sizeof(u64)));
+		SET_BSET_COMPRESSED(i, true);
+
+		bytes_to_write = vstruct_end(i) - data;
+	}
+
+	kvfree(dst);
+	bch2_time_stats_update(&c->times[BCH_TIME_btree_node_compress], start_time);
+	return bytes_to_write;
+}
+
 static void btree_write_submit(struct work_struct *work)
 {
 	struct btree_write_bio *wbio = container_of(work, struct btree_write_bio, work);
@@ -284,7 +338,7 @@ void __bch2_btree_node_write(struct bch_fs *c, struct btree *b, unsigned flags)
 	struct btree_node_entry *bne = NULL;
 	struct sort_iter_stack sort_iter;
 	struct nonce nonce;
-	unsigned bytes_to_write, sectors_to_write, bytes, u64s;
+	unsigned bytes_to_write, sectors_to_write, sectors_written, bytes, u64s;
 	u64 seq = 0;
 	bool used_mempool;
 	unsigned long old, new;
@@ -426,9 +480,6 @@ do_write:
 	    b->key.k.type == KEY_TYPE_btree_ptr_v2)
 		BUG_ON(btree_ptr_sectors_written(bkey_i_to_s_c(&b->key)) != sectors_to_write);
 
-	memset(data + bytes_to_write, 0,
-	       (sectors_to_write << 9) - bytes_to_write);
-
 	BUG_ON(b->written + sectors_to_write > btree_sectors(c));
 	BUG_ON(BSET_BIG_ENDIAN(i) != CPU_BIG_ENDIAN);
 	BUG_ON(i->seq != b->data->keys.seq);
@@ -444,11 +495,21 @@ do_write:
 	if (le16_to_cpu(i->version) < bcachefs_metadata_version_current)
 		validate_before_checksum = true;
 
+	/* or compressing: */
+	if (c->opts.metadata_compression)
+		validate_before_checksum = true;
+
 	/* if we're going to be encrypting, check metadata validity first: */
 	if (validate_before_checksum &&
 	    validate_bset_for_write(c, b, i))
 		goto err;
 
+	bytes_to_write = btree_bset_compress(c, data, i, bytes_to_write);
+	sectors_written = round_up(bytes_to_write, block_bytes(c)) >> 9;
+
+	memset(data + bytes_to_write, 0,
+	       (sectors_written << 9) - bytes_to_write);
+
 	ret = bset_encrypt(c, i, b->written << 9);
 	if (bch2_fs_fatal_err_on(ret, c,
 			"encrypting btree node: %s", bch2_err_str(ret)))
@@ -489,9 +550,10 @@ do_write:
 		goto err;
 
 	event_inc_trace(c, btree_node_write, buf, ({
-		prt_printf(&buf, "offset %u sectors %u bytes %u\n",
+		prt_printf(&buf, "offset %u sectors %u written %u bytes %u\n",
 			   b->written,
 			   sectors_to_write,
+			   sectors_written,
 			   bytes_to_write);
 		bch2_btree_pos_to_text(&buf, c, b);
 	}));
@@ -502,7 +564,7 @@ do_write:
 	 */
 
 	wbio = container_of(bio_alloc_bioset(NULL,
-				buf_nr_bvecs(data, sectors_to_write << 9),
+				buf_nr_bvecs(data, sectors_written << 9),
 				REQ_OP_WRITE|REQ_META|REQ_SYNC|REQ_IDLE,
 				GFP_NOFS,
 				&c->btree.bio),
@@ -518,7 +580,7 @@ do_write:
 	wbio->wbio.bio.bi_end_io	= btree_node_write_endio;
 	wbio->wbio.bio.bi_private	= b;
 
-	bch2_bio_map(&wbio->wbio.bio, data, sectors_to_write << 9);
+	bch2_bio_map(&wbio->wbio.bio, data, sectors_written << 9);
 
 	bkey_copy(&wbio->key, &b->key);
 
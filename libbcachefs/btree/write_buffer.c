@@ -158,6 +158,170 @@ static noinline void wb_sort(struct wb_key_ref *base, size_t num)
 	}
 }
 
+/*
+ * Keys are appended to the write buffer in journal order, a journal buffer at
+ * a time, and the updates a transaction or a pass makes (backpointers for an
+ * extent, LRU entries for a bucket sweep) tend to be in key order - so
+ * wb->sorted is typically a sequence of long ascending runs. We do a natural
+ * merge sort, which is linear for presorted input, and fall back to heapsort
+ * when the input is mostly unordered.
+ *
+ * Large flushes are split into chunks that are sorted on write_buffer_wq and
+ * then merged pairwise, each level of merges also in parallel.
+ */
+
+/* Below this average run length merging doesn't pay off, use heapsort: */
+#define WB_SORT_MIN_RUN_SHIFT		3
+#define WB_SORT_CHUNK_MIN_KEYS		(1UL << 14)
+
+static inline size_t wb_run_end(const struct wb_key_ref *base, size_t i, size_t n)
+{
+	while (++i < n && !wb_key_ref_cmp(base + i - 1, base + i))
+		;
+	return i;
+}
+
+static void wb_merge(struct wb_key_ref *dst,
+		     const struct wb_key_ref *l, const struct wb_key_ref *l_end,
+		     const struct wb_key_ref *r, const struct wb_key_ref *r_end)
+{
+	/* Runs that are already in order relative to each other just get copied */
+	if (l < l_end && r < r_end && wb_key_ref_cmp(l_end - 1, r))
+		while (l < l_end && r < r_end)
+			*dst++ = wb_key_ref_cmp(l, r) ? *r++ : *l++;
+
+	memcpy(dst, l, (l_end - l) * sizeof(*l));
+	dst += l_end - l;
+	memcpy(dst, r, (r_end - r) * sizeof(*r));
+}
+
+/* Merge adjacent pairs of runs from @src into @dst, returns runs in @dst: */
+static size_t wb_merge_pass(struct wb_key_ref *dst, const struct wb_key_ref *src, size_t n)
+{
+	size_t i = 0, runs = 0;
+
+	while (i < n) {
+		size_t mid = wb_run_end(src, i, n);
+		size_t end = mid < n ? wb_run_end(src, mid, n) : n;
+
+		wb_merge(dst + i, src + i, src + mid, src + mid, src + end);
+		i = end;
+		runs++;
+	}
+
+	return runs;
+}
+
+static void wb_sort_runs(struct wb_key_ref *base, struct wb_key_ref *tmp, size_t n)
+{
+	size_t runs = 0;
+
+	for (size_t i = 0; i < n; i = wb_run_end(base, i, n))
+		runs++;
+
+	if (runs <= 1)
+		return;
+
+	if (!tmp || runs > (n >> WB_SORT_MIN_RUN_SHIFT)) {
+		wb_sort(base, n);
+		return;
+	}
+
+	struct wb_key_ref *src = base, *dst = tmp;
+	while (wb_merge_pass(dst, src, n) > 1)
+		swap(src, dst);
+
+	if (dst != base)
+		memcpy(base, dst, n * sizeof(*base));
+}
+
+typedef struct {
+	struct closure			cl;
+	struct wb_key_ref		*src;
+	struct wb_key_ref		*dst;
+	size_t				start;
+	size_t				mid;
+	size_t				end;
+} wb_sort_job;
+DEFINE_DARRAY(wb_sort_job);
+
+static CLOSURE_CALLBACK(wb_sort_chunk_work)
+{
+	closure_type(s, wb_sort_job, cl);
+
+	wb_sort_runs(s->src + s->start, s->dst + s->start, s->end - s->start);
+	closure_return(cl);
+}
+
+static CLOSURE_CALLBACK(wb_merge_work)
+{
+	closure_type(s, wb_sort_job, cl);
+
+	wb_merge(s->dst + s->start,
+		 s->src + s->start,	s->src + s->mid,
+		 s->src + s->mid,	s->src + s->end);
+	closure_return(cl);
+}
+
+static unsigned wb_sort_n_chunks(size_t n_keys)
+{
+	return clamp_t(size_t, n_keys / WB_SORT_CHUNK_MIN_KEYS, 1, num_online_cpus());
+}
+
+static void wb_sort_parallel(struct bch_fs *c, struct bch_fs_btree_write_buffer *wb)
+{
+	struct wb_key_ref *base = wb->sorted.data;
+	size_t n = wb->sorted.nr;
+	unsigned nr_chunks = wb_sort_n_chunks(n);
+
+	/* Best effort; without scratch space we heapsort */
+	scoped_guard(memalloc_flags, PF_MEMALLOC_NOFS)
+		darray_resize(&wb->sort_tmp, n);
+	struct wb_key_ref *tmp = wb->sort_tmp.size >= n ? wb->sort_tmp.data : NULL;
+
+	CLASS(darray_wb_sort_job, jobs)();
+	if (nr_chunks <= 1 || !tmp || darray_make_room(&jobs, nr_chunks)) {
+		wb_sort_runs(base, tmp, n);
+		return;
+	}
+
+	CLASS(closure_stack, cl)();
+
+	for (unsigned i = 0; i < nr_chunks; i++)
+		darray_push(&jobs, ((wb_sort_job) {
+			.src	= base,
+			.dst	= tmp,
+			.start	= (n * i) / nr_chunks,
+			.end	= (n * (i + 1)) / nr_chunks,
+		}));
+
+	darray_for_each(jobs, i)
+		closure_call(&i->cl, wb_sort_chunk_work, c->btree.write_buffer_wq, &cl);
+	closure_sync_unbounded(&cl);
+
+	/* Merge sorted chunks pairwise, alternating between base and tmp: */
+	struct wb_key_ref *src = base, *dst = tmp;
+	for (unsigned width = 1; width < nr_chunks; width *= 2) {
+		wb_sort_job *j = jobs.data;
+
+		for (unsigned i = 0; i < nr_chunks; i += 2 * width, j++) {
+			*j = (wb_sort_job) {
+				.src	= src,
+				.dst	= dst,
+				.start	= (n * i) / nr_chunks,
+				.mid	= (n * min(i + width,	  nr_chunks)) / nr_chunks,
+				.end	= (n * min(i + 2 * width, nr_chunks)) / nr_chunks,
+			};
+			closure_call(&j->cl, wb_merge_work, c->btree.write_buffer_wq, &cl);
+		}
+		closure_sync_unbounded(&cl);
+		swap(src, dst);
+	}
+
+	if (src != base)
+		memcpy(base, src, n * sizeof(*base));
+}
+
 static noinline int wb_flush_one_slowpath(struct btree_trans *trans,
 					  struct btree_iter *iter,
 					  struct btree_write_buffered_key *wb)
@@ -367,6 +531,7 @@ struct wb_flush_counters {
 	size_t			fast;
 	size_t			noop;
 	size_t			slowpath;
+	size_t			restarts;
 };
 
 /*
@@ -448,6 +613,8 @@ static int wb_flush_sorted_range(struct btree_trans *trans,
 					   &accounting_accumulated, &cnt->fast, &cnt->noop);
 			if (!write_locked)
 				bch2_trans_begin(trans);
+			if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+				cnt->restarts++;
 		} while (bch2_err_matches(ret, BCH_ERR_transaction_restart));
 
 		if (!ret) {
@@ -471,6 +638,10 @@ static int wb_flush_sorted_range(struct btree_trans *trans,
  * Sharded fastpath. Threshold and shard cap are deliberately conservative:
  * fork/join + per-shard btree_trans setup isn't free, and we need each
  * shard to do enough work to amortize that. Tune empirically.
+ *
+ * Shards are cut at leaf boundaries: if neighbouring shards both had keys in
+ * the same leaf they'd contend on its write lock, restarting each other and
+ * pushing keys into the slowpath.
  */
 #define WB_FLUSH_SHARD_MIN_KEYS		(1UL << 12)
 
@@ -502,6 +673,49 @@ static CLOSURE_CALLBACK(wb_flush_shard_work)
 	closure_return(cl);
 }
 
+static inline struct bpos wb_sorted_pos(struct bch_fs_btree_write_buffer *wb, size_t i)
+{
+	return wb_keys_idx(&wb->flushing, wb->sorted.data[i].idx)->k.k.p;
+}
+
+static int wb_leaf_end(struct btree_trans *trans, enum btree_id btree,
+		       struct bpos pos, struct bpos *end)
+{
+	CLASS(btree_node_iter, iter)(trans, btree, pos, 0, 0, 0);
+	struct btree *b = errptr_try(bch2_btree_iter_peek_node(&iter));
+
+	*end = b ? b->key.k.p : SPOS_MAX;
+	return 0;
+}
+
+/*
+ * Move a shard boundary forward, from @idx to the first key past the end of
+ * the leaf @idx is in:
+ */
+static size_t wb_shard_cut(struct btree_trans *trans,
+			   struct bch_fs_btree_write_buffer *wb,
+			   size_t idx)
+{
+	enum btree_id btree = bch_wb_btree_to_btree_id(wb->idx);
+	size_t l = idx, r = wb->sorted.nr;
+	struct bpos end;
+
+	/* On error, just cut by key count */
+	if (lockrestart_do(trans, wb_leaf_end(trans, btree, wb_sorted_pos(wb, idx), &end)))
+		return idx;
+
+	while (l < r) {
+		size_t m = l + (r - l) / 2;
+
+		if (bpos_le(wb_sorted_pos(wb, m), end))
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	return l;
+}
+
 static int wb_flush_sorted_sharded(struct btree_trans *trans,
 				   struct bch_fs_btree_write_buffer *wb,
 				   bool accounting_replay_done,
@@ -524,14 +738,27 @@ static int wb_flush_sorted_sharded(struct btree_trans *trans,
 
 	CLASS(closure_stack, cl)();
 
-	for (unsigned i = 0; i < n_shards; i++)
+	size_t start = 0;
+	for (unsigned i = 1; i <= n_shards && start < n_keys; i++) {
+		size_t end = (n_keys * i) / n_shards;
+
+		if (end <= start)
+			continue;
+		if (end < n_keys)
+			end = wb_shard_cut(trans, wb, end);
+
 		darray_push(&shards, ((wb_flush_shard) {
 			.c			= c,
 			.wb			= wb,
-			.start			= (n_keys * i) / n_shards,
-			.end			= (n_keys * (i + 1)) / n_shards,
+			.start			= start,
+			.end			= end,
 			.accounting_replay_done	= accounting_replay_done,
 		}));
+		start = end;
+	}
+
+	/* Don't hold node locks from the leaf lookups while the shards run */
+	bch2_trans_unlock(trans);
 
 	darray_for_each(shards, i)
 		closure_call(&i->cl, wb_flush_shard_work, c->btree.write_buffer_wq, &cl);
@@ -544,8 +771,12 @@ static int wb_flush_sorted_sharded(struct btree_trans *trans,
 		cnt->fast	+= s->cnt.fast;
 		cnt->noop	+= s->cnt.noop;
 		cnt->slowpath	+= s->cnt.slowpath;
+		cnt->restarts	+= s->cnt.restarts;
+
+		wb->max_shard_restarts = max_t(u64, wb->max_shard_restarts, s->cnt.restarts);
 	}
 
+	wb->nr_shards += shards.nr;
 	return ret;
 }
 
@@ -574,6 +805,7 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans,
 
 	u64 start_time = local_clock();
 	u64 nr_flushing = wb->flushing.keys.nr;
+	u64 insert_start;
 
 	wb_keys_for_each(&wb->flushing, k)
 		BUG_ON(k->journal_seq > journal_cur_seq(&c->journal));
@@ -605,7 +837,7 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans,
 	 * If that happens, simply skip the key so we can optimistically insert
 	 * as many keys as possible in the fast path.
 	 */
-	wb_sort(wb->sorted.data, wb->sorted.nr);
+	wb_sort_parallel(c, wb);
 
 	/*
 	 * Pre-flush dedup: collapse adjacent same-pos entries.
@@ -661,6 +893,9 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans,
 		wb->sorted.nr = dst - wb->sorted.data;
 	}
 
+	bch2_time_stats_update(&c->times[BCH_TIME_btree_write_buffer_sort], start_time);
+	insert_start = local_clock();
+
 	ret = wb_flush_sorted_sharded(trans, wb, accounting_replay_done, &cnt);
 	if (ret)
 		goto err;
@@ -753,6 +988,7 @@ err:
 
 	bch2_fs_fatal_err_on(ret, c, "%s", bch2_err_str(ret));
 
+	bch2_time_stats_update(&c->times[BCH_TIME_btree_write_buffer_insert], insert_start);
 	bch2_time_stats_update(&c->times[BCH_TIME_btree_write_buffer_flush], start_time);
 
 	wb->nr_flushes++;
@@ -760,10 +996,11 @@ err:
 	wb->nr_keys_flushed		+= nr_flushing;
 	wb->nr_keys_fast		+= cnt.fast;
 	wb->nr_keys_slowpath		+= cnt.slowpath;
+	wb->nr_shard_restarts		+= cnt.restarts;
 
 	event_inc_trace(c, write_buffer_flush, buf,
-		prt_printf(&buf, "flushed %llu fast %zu noop %zu",
-			   nr_flushing, cnt.fast, cnt.noop));
+		prt_printf(&buf, "flushed %llu fast %zu noop %zu restarts %zu",
+			   nr_flushing, cnt.fast, cnt.noop, cnt.restarts));
 
 	return ret;
 }
@@ -1286,6 +1523,9 @@ void bch2_btree_write_buffer_to_text(struct printbuf *out, struct bch_fs *c)
 		prt_printf(out, "keys flushed:\t%llu\n",	wb->nr_keys_flushed);
 		prt_printf(out, "keys fast:\t%llu\n",		wb->nr_keys_fast);
 		prt_printf(out, "keys slowpath:\t%llu\n",	wb->nr_keys_slowpath);
+		prt_printf(out, "flush shards:\t%llu\n",	wb->nr_shards);
+		prt_printf(out, "shard restarts:\t%llu\n",	wb->nr_shard_restarts);
+		prt_printf(out, "max shard restarts:\t%llu\n", wb->max_shard_restarts);
 
 		prt_printf(out, "flush work:\t%s\n",
 			   work_busy(&wb->flush_work) ? "busy" : "idle");
@@ -1294,8 +1534,17 @@ void bch2_btree_write_buffer_to_text(struct printbuf *out, struct bch_fs *c)
 	}
 
 	prt_printf(out, "Time stats (shared):\n");
-	scoped_guard(printbuf_indent, out)
+	scoped_guard(printbuf_indent, out) {
 		bch2_time_stats_to_text(out, &c->times[BCH_TIME_btree_write_buffer_flush]);
+
+		prt_printf(out, "sort:\n");
+		scoped_guard(printbuf_indent, out)
+			bch2_time_stats_to_text(out, &c->times[BCH_TIME_btree_write_buffer_sort]);
+
+		prt_printf(out, "insert:\n");
+		scoped_guard(printbuf_indent, out)
+			bch2_time_stats_to_text(out, &c->times[BCH_TIME_btree_write_buffer_insert]);
+	}
 }
 
 void bch2_fs_btree_write_buffer_exit(struct bch_fs *c)
@@ -1307,6 +1556,7 @@ void bch2_fs_btree_write_buffer_exit(struct bch_fs *c)
 		       !bch2_journal_error(&c->journal));
 
 		darray_exit(&wb->accounting);
+		darray_exit(&wb->sort_tmp);
 		darray_exit(&wb->sorted);
 		darray_exit(&wb->flushing.keys);
 		darray_exit(&wb->inc.keys);
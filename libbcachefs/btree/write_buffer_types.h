@@ -103,6 +103,8 @@ struct bch_fs_btree_write_buffer {
 	enum bch_wb_btree		idx;
 
 	DARRAY(struct wb_key_ref)	sorted;
+	/* scratch space for merging wb->sorted */
+	DARRAY(struct wb_key_ref)	sort_tmp;
 	struct btree_write_buffer_keys	inc;
 	struct btree_write_buffer_keys	flushing;
 
@@ -113,6 +115,10 @@ struct bch_fs_btree_write_buffer {
 	u64				nr_keys_flushed;
 	u64				nr_keys_fast;
 	u64				nr_keys_slowpath;
+	/* sharded flushes: shards run, and restarts hit within shards */
+	u64				nr_shards;
+	u64				nr_shard_restarts;
+	u64				max_shard_restarts;
 
 	DARRAY(struct btree_write_buffered_key) accounting;
 };
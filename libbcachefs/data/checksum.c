@@ -251,8 +251,17 @@ struct bch_csum bch2_checksum_bio(struct bch_fs *c, unsigned type,
 	return __bch2_checksum_bio(c, type, nonce, bio, &iter);
 }
 
-int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
-		     struct nonce nonce, struct bio *bio)
+/* Checksum a range of @bio without touching bio->bi_iter: */
+struct bch_csum bch2_checksum_bio_iter(struct bch_fs *c, unsigned type,
+				       struct nonce nonce, struct bio *bio,
+				       struct bvec_iter iter)
+{
+	return __bch2_checksum_bio(c, type, nonce, bio, &iter);
+}
+
+int __bch2_encrypt_bio_iter(struct bch_fs *c, unsigned type,
+			    struct nonce nonce, struct bio *bio,
+			    struct bvec_iter start)
 {
 	struct bio_vec bv;
 	struct bvec_iter iter;
@@ -265,7 +274,7 @@ int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 
 	bch2_chacha20_init(&chacha_state, &c->chacha20_key, nonce);
 
-	bio_for_each_segment(bv, bio, iter) {
+	__bio_for_each_segment(bv, bio, iter, start) {
 		void *p;
 
 		/*
@@ -286,6 +295,12 @@ int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 	return ret;
 }
 
+int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
+		     struct nonce nonce, struct bio *bio)
+{
+	return __bch2_encrypt_bio_iter(c, type, nonce, bio, bio->bi_iter);
+}
+
 struct bch_csum bch2_checksum_merge(unsigned type, struct bch_csum a,
 				    struct bch_csum b, size_t b_len)
 {
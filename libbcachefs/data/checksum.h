@@ -81,6 +81,9 @@ int bch2_encrypt(struct bch_fs *, unsigned, struct nonce,
 
 struct bch_csum bch2_checksum_bio(struct bch_fs *, unsigned,
 				  struct nonce, struct bio *);
+struct bch_csum bch2_checksum_bio_iter(struct bch_fs *, unsigned,
+				       struct nonce, struct bio *,
+				       struct bvec_iter);
 
 int bch2_rechecksum_bio(struct bch_fs *, struct bio *, struct bversion,
 			struct bch_extent_crc_unpacked,
@@ -88,6 +91,8 @@ int bch2_rechecksum_bio(struct bch_fs *, struct bio *, struct bversion,
 			struct bch_extent_crc_unpacked *,
 			unsigned, unsigned, unsigned);
 
+int __bch2_encrypt_bio_iter(struct bch_fs *, unsigned,
+			    struct nonce, struct bio *, struct bvec_iter);
 int __bch2_encrypt_bio(struct bch_fs *, unsigned,
 		       struct nonce, struct bio *);
 
@@ -99,6 +104,15 @@ static inline int bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 		: 0;
 }
 
+static inline int bch2_encrypt_bio_iter(struct bch_fs *c, unsigned type,
+					struct nonce nonce, struct bio *bio,
+					struct bvec_iter iter)
+{
+	return bch2_csum_type_is_encryption(type)
+		? __bch2_encrypt_bio_iter(c, type, nonce, bio, iter)
+		: 0;
+}
+
 extern const struct bch_sb_field_ops bch_sb_field_ops_crypt;
 
 int bch2_decrypt_sb_key(struct bch_fs *, struct bch_sb_field_crypt *,
@@ -19,6 +19,24 @@
  * level via the `background_compression` option — for example, writing with
  * fast lz4 and recompressing to zstd offline. The reconcile subsystem handles
  * this automatically.
+ *
+ * Extents are compressed independently, so small extents (4-16K) compress
+ * poorly: `compression=zstd_dict` uses zstd with a dictionary trained on
+ * samples of the filesystem's own data (`bcachefs compression train`), stored
+ * in the superblock.
+ *
+ * Before compressing an extent we sample a few strides of it and estimate the
+ * byte entropy; data that looks random (already compressed media, encrypted
+ * blobs) isn't worth running the compressor over, and is marked incompressible
+ * just as if compression had failed.
+ *
+ * We also remember the last few outcomes per inode: once an inode's recent
+ * writes have all been incompressible we skip compression for it, trying again
+ * on an occasional write to notice if its contents change. Those extents are
+ * written uncompressed, not marked incompressible, since their data was never
+ * looked at; data moves (reconcile, background_compression) don't use the
+ * history, so they always make a real attempt and don't rewrite the same
+ * extent over and over.
  */
 #include "bcachefs.h"
 
@@ -26,9 +44,11 @@
 
 #include "data/checksum.h"
 #include "data/compress.h"
+#include "data/compress_dict.h"
 #include "data/extents.h"
 #include "data/write.h"
 
+#include "sb/counters.h"
 #include "sb/io.h"
 
 #include "init/error.h"
@@ -38,6 +58,7 @@
 #include <linux/zstd.h>
 
 #include <linux/module.h>
+#include <linux/random.h>
 
 static bool bch2_verify_compress = IS_ENABLED(CONFIG_BCACHEFS_DEBUG);
 module_param_named(verify_compress, bch2_verify_compress, bool, 0644);
@@ -56,6 +77,8 @@ static inline enum bch_compression_opts bch2_compression_type_to_opt(enum bch_co
 		return BCH_COMPRESSION_OPT_gzip;
 	case BCH_COMPRESSION_TYPE_zstd:
 		return BCH_COMPRESSION_OPT_zstd;
+	case BCH_COMPRESSION_TYPE_zstd_dict:
+		return BCH_COMPRESSION_OPT_zstd_dict;
 	default:
 		BUG();
 	}
@@ -211,25 +234,23 @@ static inline void zlib_set_workspace(z_stream *strm, void *workspace)
 #endif
 }
 
-static int buf_uncompress(struct bch_fs *c,
-			  void *dst, void *src,
-			  struct bch_extent_crc_unpacked crc)
+static int __buf_uncompress(struct bch_fs *c,
+			    enum bch_compression_type compression_type,
+			    void *dst, size_t dst_len,
+			    void *src, size_t src_len)
 {
-	enum bch_compression_opts opt = bch2_compression_type_to_opt(crc.compression_type);
+	enum bch_compression_opts opt = bch2_compression_type_to_opt(compression_type);
 	mempool_t *workspace_pool = &c->compress.workspace[opt];
 	if (unlikely(!mempool_initialized(workspace_pool))) {
 		if (ret_fsck_err(c, compression_type_not_marked_in_sb,
 			     "compression type %s set but not marked in superblock",
-			     __bch2_compression_types[crc.compression_type]))
+			     __bch2_compression_types[compression_type]))
 			try(bch2_check_set_has_compressed_data(c, opt));
 		else
 			return bch_err_throw(c, compression_workspace_not_initialized);
 	}
 
-	size_t src_len = crc.compressed_size << 9;
-	size_t dst_len = crc.uncompressed_size << 9;
-
-	switch (crc.compression_type) {
+	switch (compression_type) {
 	case BCH_COMPRESSION_TYPE_lz4_old:
 	case BCH_COMPRESSION_TYPE_lz4: {
 		int ret = LZ4_decompress_safe_partial(src, dst, src_len, dst_len, dst_len);
@@ -257,17 +278,35 @@ static int buf_uncompress(struct bch_fs *c,
 			return bch_err_throw(c, decompress_gzip);
 		break;
 	}
-	case BCH_COMPRESSION_TYPE_zstd: {
+	case BCH_COMPRESSION_TYPE_zstd:
+	case BCH_COMPRESSION_TYPE_zstd_dict: {
 		ZSTD_DCtx *ctx;
+		zstd_ddict *ddict = NULL;
 		size_t real_src_len = le32_to_cpup(src);
 
 		if (real_src_len > src_len - 4)
 			return bch_err_throw(c, decompress_zstd_src_len_bad);
 
+		if (compression_type == BCH_COMPRESSION_TYPE_zstd_dict) {
+			zstd_frame_header fh;
+
+			if (!zstd_get_frame_header(&fh, src + 4, real_src_len) &&
+			    fh.dictID) {
+				ddict = bch2_compress_dict_ddict(c, fh.dictID);
+				if (IS_ERR(ddict))
+					return PTR_ERR(ddict);
+			}
+		}
+
 		void *workspace = mempool_alloc(workspace_pool, GFP_NOFS);
 		ctx = zstd_init_dctx(workspace, zstd_dctx_workspace_bound());
 
-		size_t ret = zstd_decompress_dctx(ctx,
+		size_t ret = ddict
+			? zstd_decompress_using_ddict(ctx,
+				dst,	dst_len,
+				src + 4, real_src_len,
+				ddict)
+			: zstd_decompress_dctx(ctx,
 				dst,	dst_len,
 				src + 4, real_src_len);
 
@@ -290,6 +329,15 @@ static int buf_uncompress(struct bch_fs *c,
 	return 0;
 }
 
+static int buf_uncompress(struct bch_fs *c,
+			  void *dst, void *src,
+			  struct bch_extent_crc_unpacked crc)
+{
+	return __buf_uncompress(c, crc.compression_type,
+				dst, crc.uncompressed_size << 9,
+				src, crc.compressed_size << 9);
+}
+
 int bch2_bio_uncompress_inplace(struct bch_write_op *op,
 				struct bio *bio)
 {
@@ -372,9 +420,6 @@ static int attempt_compress(struct bch_fs *c,
 	enum bch_compression_type compression_type =
 		__bch2_compression_opt_to_type[compression.type];
 
-	BUG_ON(src_len & 511);
-	BUG_ON(dst_len & 511);
-
 	switch (compression_type) {
 	case BCH_COMPRESSION_TYPE_lz4:
 		if (compression.level < LZ4HC_MIN_CLEVEL) {
@@ -422,7 +467,8 @@ static int attempt_compress(struct bch_fs *c,
 
 		return strm.total_out;
 	}
-	case BCH_COMPRESSION_TYPE_zstd: {
+	case BCH_COMPRESSION_TYPE_zstd:
+	case BCH_COMPRESSION_TYPE_zstd_dict: {
 		/*
 		 * rescale:
 		 * zstd max compression level is 22, our max level is 15
@@ -431,6 +477,14 @@ static int attempt_compress(struct bch_fs *c,
 		ZSTD_parameters params = zstd_get_params(level, c->opts.encoded_extent_max);
 		ZSTD_CCtx *ctx = zstd_init_cctx(workspace, c->compress.zstd_workspace_size);
 
+		/*
+		 * No dictionary yet (or no memory for digesting it): write a
+		 * frame without one, buf_uncompress() checks the frame header
+		 */
+		zstd_cdict *cdict = compression_type == BCH_COMPRESSION_TYPE_zstd_dict
+			? bch2_compress_dict_cdict(c, compression.level, params.cParams)
+			: NULL;
+
 		/*
 		 * ZSTD requires that when we decompress we pass in the exact
 		 * compressed size - rounding it up to the nearest sector
@@ -442,7 +496,12 @@ static int attempt_compress(struct bch_fs *c,
 		 * factor (7 bytes) from the dst buffer size to account for
 		 * that.
 		 */
-		size_t len = zstd_compress_cctx(ctx,
+		size_t len = cdict
+			? zstd_compress_using_cdict(ctx,
+				dst + 4,	dst_len - 4 - 7,
+				src,		src_len,
+				cdict)
+			: zstd_compress_cctx(ctx,
 				dst + 4,	dst_len - 4 - 7,
 				src,		src_len,
 				&params);
@@ -457,11 +516,112 @@ static int attempt_compress(struct bch_fs *c,
 	}
 }
 
+/* Incompressible data detection: */
+
+#define COMPRESS_SAMPLE_STRIDES		16
+#define COMPRESS_SAMPLE_LEN		256
+/*
+ * In quarter bits per byte; the estimate rounds up by a fraction of a quarter
+ * bit, so this is ~7.6 bits per byte - random data comes out at 32-33:
+ */
+#define COMPRESS_ENTROPY_MAX		31
+/* Once this many writes in a row were incompressible, probe one in N: */
+#define COMPRESS_HIST_PROBE		16
+
+/*
+ * Estimate the byte entropy of a sample of @src:
+ * H = log2(n) - sum(c * log2(c)) / n, where the sum is over the byte
+ * histogram; computing log2(x^4) gives us two fractional bits.
+ */
+static bool bch2_compress_sample_incompressible(const void *src, size_t len)
+{
+	size_t stride = len / COMPRESS_SAMPLE_STRIDES;
+	size_t sample_len = min_t(size_t, stride, COMPRESS_SAMPLE_LEN);
+	u16 hist[256] = {};
+	u64 n = 0, sum = 0;
+
+	if (!sample_len)
+		return false;
+
+	for (unsigned i = 0; i < COMPRESS_SAMPLE_STRIDES; i++) {
+		const u8 *p = src + i * stride;
+
+		/* Repeated blocks compress well regardless of their entropy: */
+		if (i && !memcmp(p, src, sample_len))
+			return false;
+
+		for (size_t j = 0; j < sample_len; j++)
+			hist[p[j]]++;
+		n += sample_len;
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(hist); i++)
+		if (hist[i]) {
+			u64 c = hist[i];
+
+			sum += c * ilog2(c * c * c * c);
+		}
+
+	return ilog2(n * n * n * n) - div64_u64(sum, n) >= COMPRESS_ENTROPY_MAX;
+}
+
+/*
+ * History slots are tagged with a hash of the inode number, so that an inode
+ * sharing a slot evicts the previous owner's history instead of inheriting it:
+ */
+static u64 bch2_compress_inode_hist_tag(u64 inum)
+{
+	return hash_64(inum, 56);
+}
+
+static u8 bch2_compress_inode_hist(struct bch_fs *c, u64 inum)
+{
+	u64 v = READ_ONCE(c->compress.inode_hist[hash_64(inum, BCH_COMPRESS_INODE_HIST_BITS)]);
+
+	return v >> 8 == bch2_compress_inode_hist_tag(inum) ? (u8) v : 0;
+}
+
+static void bch2_compress_inode_hist_update(struct bch_fs *c, u64 inum, bool incompressible)
+{
+	u64 *h = &c->compress.inode_hist[hash_64(inum, BCH_COMPRESS_INODE_HIST_BITS)];
+	u8 hist = bch2_compress_inode_hist(c, inum);
+
+	WRITE_ONCE(*h, bch2_compress_inode_hist_tag(inum) << 8 |
+		   (u8) ((hist << 1) | incompressible));
+}
+
+/*
+ * Returns true if we shouldn't bother attempting to compress this extent, and
+ * the compression type to write it with:
+ */
+static bool bch2_compress_skip(struct bch_fs *c, void *src, size_t src_len,
+			       struct bpos write_pos, bool use_history,
+			       unsigned *type)
+{
+	if (use_history &&
+	    bch2_compress_inode_hist(c, write_pos.inode) == U8_MAX &&
+	    get_random_u32_below(COMPRESS_HIST_PROBE)) {
+		event_add(c, data_compress_skip_history, src_len >> 9);
+		*type = BCH_COMPRESSION_TYPE_none;
+		return true;
+	}
+
+	if (bch2_compress_sample_incompressible(src, src_len)) {
+		bch2_compress_inode_hist_update(c, write_pos.inode, true);
+		event_add(c, data_compress_skip_entropy, src_len >> 9);
+		*type = BCH_COMPRESSION_TYPE_incompressible;
+		return true;
+	}
+
+	return false;
+}
+
 static unsigned bch2_compress(struct bch_fs *c,
 			      void *dst, size_t *dst_len,
 			      void *src, size_t *src_len,
 			      unsigned compression_opt,
-			      struct bpos write_pos)
+			      struct bpos write_pos,
+			      bool use_history)
 {
 	union bch_compression_opt compression =
 		(union bch_compression_opt) { .value = compression_opt };
@@ -470,8 +630,13 @@ static unsigned bch2_compress(struct bch_fs *c,
 	if (*src_len <= c->opts.block_size)
 		return BCH_COMPRESSION_TYPE_incompressible;
 
+	unsigned skip_type;
+	if (bch2_compress_skip(c, src, *src_len, write_pos, use_history, &skip_type))
+		return skip_type;
+
 	enum bch_compression_type compression_type =
 		__bch2_compression_opt_to_type[compression.type];
+	size_t orig_src_len = *src_len;
 	int ret = 0;
 
 	/* bch2_compression_decode catches unknown compression types: */
@@ -502,6 +667,9 @@ static unsigned bch2_compress(struct bch_fs *c,
 			break;
 		}
 
+		BUG_ON(*src_len & 511);
+		BUG_ON(*dst_len & 511);
+
 		ret = attempt_compress(c, workspace,
 				       dst, *dst_len,
 				       src, *src_len,
@@ -532,12 +700,16 @@ static unsigned bch2_compress(struct bch_fs *c,
 
 	mempool_free(workspace, workspace_pool);
 
-	if (ret)
-		return BCH_COMPRESSION_TYPE_incompressible;
+	event_add(c, data_compress, orig_src_len >> 9);
 
 	/* Didn't get smaller: */
-	if (round_up(*dst_len, block_bytes(c)) >= *src_len)
+	if (ret || round_up(*dst_len, block_bytes(c)) >= *src_len) {
+		bch2_compress_inode_hist_update(c, write_pos.inode, true);
+		event_add(c, data_compress_fail, orig_src_len >> 9);
 		return BCH_COMPRESSION_TYPE_incompressible;
+	}
+
+	bch2_compress_inode_hist_update(c, write_pos.inode, false);
 
 	unsigned pad = round_up(*dst_len, block_bytes(c)) - *dst_len;
 
@@ -579,7 +751,8 @@ unsigned bch2_bio_compress(struct bch_fs *c,
 			   struct bio *src, size_t *src_len,
 			   unsigned compression_opt,
 			   struct bpos write_pos,
-			   bool bounce_source)
+			   bool bounce_source,
+			   bool use_history)
 {
 	/* Don't consume more than BCH_ENCODED_EXTENT_MAX from @src: */
 	unsigned consume_src = min(src->bi_iter.bi_size, c->opts.encoded_extent_max);
@@ -602,7 +775,8 @@ unsigned bch2_bio_compress(struct bch_fs *c,
 			      dst_data.b, dst_len,
 			      src_data.b, src_len,
 			      compression_opt,
-			      write_pos);
+			      write_pos,
+			      use_history);
 
 	if (compression_type != BCH_COMPRESSION_TYPE_none &&
 	    compression_type != BCH_COMPRESSION_TYPE_incompressible) {
@@ -619,6 +793,75 @@ unsigned bch2_bio_compress(struct bch_fs *c,
 	return compression_type;
 }
 
+/*
+ * Compress @src_iter (at most encoded_extent_max) into a linear buffer; doesn't
+ * touch @src's own iterator, so different ranges of the same bio may be
+ * compressed concurrently:
+ */
+unsigned bch2_bio_compress_to_buf(struct bch_fs *c,
+				  void *dst, size_t *dst_len,
+				  struct bio *src, struct bvec_iter src_iter,
+				  size_t *src_len,
+				  unsigned compression_opt,
+				  struct bpos write_pos,
+				  bool bounce_source,
+				  bool use_history)
+{
+	*src_len = src_iter.bi_size;
+	*dst_len = min(*dst_len, *src_len);
+
+	struct bbuf src_data __cleanup(bbuf_exit) = bounce_source
+		? bio_bounce(c, src, src_iter, READ)
+		: __bio_map_or_bounce(c, src, src_iter, READ);
+
+	return bch2_compress(c,
+			     dst, dst_len,
+			     src_data.b, src_len,
+			     compression_opt,
+			     write_pos,
+			     use_history);
+}
+
+/*
+ * Metadata (btree nodes) isn't sector aligned and is compressed all at once, so
+ * these skip the bouncing and the retrying with less input that extents need:
+ */
+
+/* Returns the compressed size, or 0 if it didn't fit in @dst_len */
+size_t bch2_compress_buf(struct bch_fs *c, unsigned compression_opt,
+			 void *dst, size_t dst_len,
+			 void *src, size_t src_len)
+{
+	union bch_compression_opt compression =
+		(union bch_compression_opt) { .value = compression_opt };
+
+	BUG_ON(compression.type >= BCH_COMPRESSION_OPT_NR);
+
+	mempool_t *workspace_pool = &c->compress.workspace[compression.type];
+	if (!compression.type ||
+	    unlikely(!mempool_initialized(workspace_pool)))
+		return 0;
+
+	void *workspace = mempool_alloc(workspace_pool, GFP_NOFS);
+	int ret = attempt_compress(c, workspace, dst, dst_len, src, src_len, compression);
+	mempool_free(workspace, workspace_pool);
+
+	return max(ret, 0);
+}
+
+int bch2_decompress_buf(struct bch_fs *c,
+			enum bch_compression_type compression_type,
+			void *dst, size_t dst_len,
+			void *src, size_t src_len)
+{
+	if (compression_type == BCH_COMPRESSION_TYPE_none ||
+	    compression_type == BCH_COMPRESSION_TYPE_incompressible ||
+	    compression_type >= BCH_COMPRESSION_TYPE_NR)
+		return bch_err_throw(c, decompress_bad_type);
+
+	return __buf_uncompress(c, compression_type, dst, dst_len, src, src_len);
+}
+
 static int __bch2_fs_compress_init(struct bch_fs *, u64);
 
 #define BCH_FEATURE_none	0
@@ -671,6 +914,8 @@ void bch2_fs_compress_exit(struct bch_fs *c)
 		mempool_exit(&c->compress.workspace[i]);
 	mempool_exit(&c->compress.bounce[WRITE]);
 	mempool_exit(&c->compress.bounce[READ]);
+
+	bch2_fs_compress_dicts_exit(c);
 }
 
 static int __bch2_fs_compress_init(struct bch_fs *c, u64 features)
@@ -693,6 +938,9 @@ static int __bch2_fs_compress_init(struct bch_fs *c, u64 features)
 		{ BCH_FEATURE_zstd, BCH_COMPRESSION_OPT_zstd,
 			max(c->compress.zstd_workspace_size,
 			    zstd_dctx_workspace_bound()) },
+		{ BCH_FEATURE_zstd_dict, BCH_COMPRESSION_OPT_zstd_dict,
+			max(c->compress.zstd_workspace_size,
+			    zstd_dctx_workspace_bound()) },
 	}, *i;
 	bool have_compressed = false;
 
@@ -745,6 +993,9 @@ int bch2_fs_compress_init(struct bch_fs *c)
 
 	f |= compression_opt_to_feature(c->opts.compression);
 	f |= compression_opt_to_feature(c->opts.background_compression);
+	f |= compression_opt_to_feature(c->opts.metadata_compression);
+
+	try(bch2_fs_compress_dicts_init(c));
 
 	return __bch2_fs_compress_init(c, f);
 }
@@ -790,6 +1041,28 @@ int bch2_opt_compression_parse(struct bch_fs *c, const char *_val, u64 *res,
 	return 0;
 }
 
+/*
+ * The level (on our 1-15 scale) that a compression option without an explicit
+ * level compresses at:
+ */
+unsigned bch2_compression_opt_default_level(unsigned type)
+{
+	switch (type) {
+	case BCH_COMPRESSION_OPT_lz4:
+		/* higher levels switch to lz4hc: */
+		return LZ4HC_MIN_CLEVEL - 1;
+	case BCH_COMPRESSION_OPT_gzip:
+		/* Z_DEFAULT_COMPRESSION: */
+		return 6;
+	case BCH_COMPRESSION_OPT_zstd:
+	case BCH_COMPRESSION_OPT_zstd_dict:
+		/* rescaled to zstd's default level, 3: */
+		return 2;
+	default:
+		return 0;
+	}
+}
+
 void bch2_compression_opt_to_text(struct printbuf *out, u64 v)
 {
 	union bch_compression_opt opt = { .value = v };
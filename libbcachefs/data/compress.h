@@ -40,12 +40,20 @@ int bch2_bio_uncompress(struct bch_fs *, struct bio *, struct bio *,
 
 unsigned bch2_bio_compress(struct bch_fs *, struct bio *, size_t *,
 			   struct bio *, size_t *, unsigned,
-			   struct bpos, bool);
+			   struct bpos, bool, bool);
+unsigned bch2_bio_compress_to_buf(struct bch_fs *, void *, size_t *,
+				  struct bio *, struct bvec_iter, size_t *,
+				  unsigned, struct bpos, bool, bool);
+
+size_t bch2_compress_buf(struct bch_fs *, unsigned, void *, size_t, void *, size_t);
+int bch2_decompress_buf(struct bch_fs *, enum bch_compression_type,
+			void *, size_t, void *, size_t);
 
 int bch2_check_set_has_compressed_data(struct bch_fs *, unsigned);
 void bch2_fs_compress_exit(struct bch_fs *);
 int bch2_fs_compress_init(struct bch_fs *);
 
+unsigned bch2_compression_opt_default_level(unsigned);
 void bch2_compression_opt_to_text(struct printbuf *, u64);
 
 int bch2_opt_compression_parse(struct bch_fs *, const char *, u64 *, struct printbuf *);
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * Trained zstd dictionaries, for BCH_COMPRESSION_TYPE_zstd_dict
+ *
+ * Extents are compressed independently, and zstd doesn't have much to work
+ * with on small extents: a dictionary trained on samples of the filesystem's
+ * data (`bcachefs compression train`) gives it a head start.
+ *
+ * Dictionaries live in the compression_dict superblock field, and are append
+ * only: new writes use the newest, and the dictionary id zstd writes into the
+ * frame header says which one an extent needs to be decompressed. zstd_dict
+ * extents written before any dictionary was added are plain zstd frames with
+ * no dictionary id.
+ *
+ * The digested forms zstd actually uses - a cdict per compression level and a
+ * ddict - are created on first use.
+ */
+
+#include "bcachefs.h"
+
+#include "data/compress_dict.h"
+
+#include "sb/io.h"
+
+#include "util/vstructs.h"
+
+#include <linux/unaligned.h>
+
+struct bch_compress_dict {
+	u32			id;
+	u32			bytes;
+	void			*data;
+	zstd_ddict		*ddict;
+	zstd_cdict		*cdict[16];
+};
+
+static u32 zstd_dict_id(const void *data, size_t bytes)
+{
+	return bytes >= 8 && get_unaligned_le32(data) == BCH_ZSTD_DICT_MAGIC
+		? get_unaligned_le32(data + 4)
+		: 0;
+}
+
+/* The digested dictionaries are created from the IO paths: */
+static void *zstd_dict_alloc(void *opaque, size_t size)
+{
+	return kvmalloc(size, GFP_NOFS|__GFP_NOWARN);
+}
+
+static void zstd_dict_free(void *opaque, void *p)
+{
+	kvfree(p);
+}
+
+static const zstd_custom_mem zstd_dict_mem = {
+	.customAlloc	= zstd_dict_alloc,
+	.customFree	= zstd_dict_free,
+};
+
+zstd_cdict *bch2_compress_dict_cdict(struct bch_fs *c, unsigned level,
+				     zstd_compression_parameters cparams)
+{
+	unsigned nr = smp_load_acquire(&c->compress.nr_dicts);
+	if (!nr)
+		return NULL;
+
+	struct bch_compress_dict *d = c->compress.dicts[nr - 1];
+	zstd_cdict *cdict = READ_ONCE(d->cdict[level]);
+	if (likely(cdict))
+		return cdict;
+
+	cdict = zstd_create_cdict_byreference(d->data, d->bytes, cparams, zstd_dict_mem);
+	if (!cdict)
+		return NULL;
+
+	zstd_cdict *old = cmpxchg(&d->cdict[level], NULL, cdict);
+	if (old) {
+		zstd_free_cdict(cdict);
+		cdict = old;
+	}
+	return cdict;
+}
+
+zstd_ddict *bch2_compress_dict_ddict(struct bch_fs *c, u32 id)
+{
+	unsigned nr = smp_load_acquire(&c->compress.nr_dicts);
+	struct bch_compress_dict *d = NULL;
+
+	for (unsigned i = 0; i < nr; i++)
+		if (c->compress.dicts[i]->id == id)
+			d = c->compress.dicts[i];
+
+	if (!d)
+		return ERR_PTR(bch_err_throw(c, decompress_zstd_dict_missing));
+
+	zstd_ddict *ddict = READ_ONCE(d->ddict);
+	if (likely(ddict))
+		return ddict;
+
+	ddict = zstd_create_ddict_byreference(d->data, d->bytes, zstd_dict_mem);
+	if (!ddict)
+		return ERR_PTR(bch_err_throw(c, ENOMEM_compression_dict));
+
+	zstd_ddict *old = cmpxchg(&d->ddict, NULL, ddict);
+	if (old) {
+		zstd_free_ddict(ddict);
+		ddict = old;
+	}
+	return ddict;
+}
+
+static void compress_dict_free(struct bch_compress_dict *d)
+{
+	if (!d)
+		return;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(d->cdict); i++)
+		if (d->cdict[i])
+			zstd_free_cdict(d->cdict[i]);
+	if (d->ddict)
+		zstd_free_ddict(d->ddict);
+	kvfree(d->data);
+	kfree(d);
+}
+
+static struct bch_compress_dict *compress_dict_alloc(u32 id, const void *data, size_t bytes)
+{
+	struct bch_compress_dict *d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return NULL;
+
+	d->id		= id;
+	d->bytes	= bytes;
+	d->data		= kvmalloc(bytes, GFP_KERNEL);
+	if (!d->data) {
+		kfree(d);
+		return NULL;
+	}
+
+	memcpy(d->data, data, bytes);
+	return d;
+}
+
+/* Readers don't take a lock: dicts[] is published by the store to nr_dicts */
+static void compress_dict_publish(struct bch_fs *c, struct bch_compress_dict *d)
+{
+	unsigned nr = c->compress.nr_dicts;
+
+	c->compress.dicts[nr] = d;
+	smp_store_release(&c->compress.nr_dicts, nr + 1);
+}
+
+#define for_each_sb_compression_dict(_f, _e)					\
+	for (struct bch_compression_dict *_e = (_f)->start;			\
+	     (void *) _e < vstruct_end(&(_f)->field);				\
+	     _e = vstruct_next(_e))
+
+int bch2_compress_dict_add(struct bch_fs *c, const void *data, size_t bytes)
+{
+	u32 id = zstd_dict_id(data, bytes);
+	if (!id || bytes > BCH_COMPRESS_DICT_MAX_BYTES)
+		return bch_err_throw(c, EINVAL_compression_dict_bad);
+
+	struct bch_compress_dict *d = compress_dict_alloc(id, data, bytes);
+	if (!d)
+		return bch_err_throw(c, ENOMEM_compression_dict);
+
+	guard(memalloc_flags)(PF_MEMALLOC_NOFS);
+	guard(mutex)(&c->sb_lock);
+
+	int ret = 0;
+	for (unsigned i = 0; i < c->compress.nr_dicts; i++)
+		if (c->compress.dicts[i]->id == id) {
+			ret = bch_err_throw(c, EINVAL_compression_dict_exists);
+			goto err;
+		}
+
+	if (c->compress.nr_dicts == BCH_COMPRESS_DICTS_MAX) {
+		ret = bch_err_throw(c, EINVAL_compression_dict_too_many);
+		goto err;
+	}
+
+	struct bch_sb_field_compression_dict *f =
+		bch2_sb_field_get(c->disk_sb.sb, compression_dict);
+	unsigned u64s = f ? le32_to_cpu(f->field.u64s) : sizeof(*f) / sizeof(u64);
+	unsigned entry_u64s = DIV_ROUND_UP(bytes, sizeof(u64));
+
+	f = bch2_sb_field_resize(&c->disk_sb, compression_dict,
+				 u64s + sizeof(struct bch_compression_dict) / sizeof(u64) + entry_u64s);
+	if (!f) {
+		ret = bch_err_throw(c, ENOSPC_sb_compression_dict);
+		goto err;
+	}
+
+	struct bch_compression_dict *e = (void *) ((u64 *) &f->field + u64s);
+	e->u64s		= cpu_to_le32(entry_u64s);
+	e->id		= cpu_to_le32(id);
+	e->bytes	= cpu_to_le32(bytes);
+	e->pad		= 0;
+	memcpy(e->data, data, bytes);
+	memset(e->data + bytes, 0, entry_u64s * sizeof(u64) - bytes);
+
+	ret = bch2_write_super(c);
+	if (ret)
+		goto err;
+
+	compress_dict_publish(c, d);
+	return 0;
+err:
+	compress_dict_free(d);
+	return ret;
+}
+
+void bch2_fs_compress_dicts_exit(struct bch_fs *c)
+{
+	for (unsigned i = 0; i < c->compress.nr_dicts; i++)
+		compress_dict_free(c->compress.dicts[i]);
+	c->compress.nr_dicts = 0;
+}
+
+int bch2_fs_compress_dicts_init(struct bch_fs *c)
+{
+	struct bch_sb_field_compression_dict *f =
+		bch2_sb_field_get(c->disk_sb.sb, compression_dict);
+	if (!f)
+		return 0;
+
+	for_each_sb_compression_dict(f, e) {
+		struct bch_compress_dict *d =
+			compress_dict_alloc(le32_to_cpu(e->id), e->data, le32_to_cpu(e->bytes));
+		if (!d)
+			return bch_err_throw(c, ENOMEM_compression_dict);
+
+		compress_dict_publish(c, d);
+	}
+
+	return 0;
+}
+
+static int bch2_sb_compression_dict_validate(struct bch_sb *sb, struct bch_sb_field *f,
+					     enum bch_validate_flags flags, struct printbuf *err)
+{
+	struct bch_sb_field_compression_dict *d = field_to_type(f, compression_dict);
+	u32 ids[BCH_COMPRESS_DICTS_MAX];
+	unsigned nr = 0;
+
+	for_each_sb_compression_dict(d, e) {
+		if ((u64 *) e->_data > (u64 *) vstruct_end(f) ||
+		    le32_to_cpu(e->u64s) > (u64 *) vstruct_end(f) - e->_data) {
+			prt_printf(err, "entry %u overruns end of field", nr);
+			return -BCH_ERR_invalid_sb_compression_dict;
+		}
+
+		u32 bytes = le32_to_cpu(e->bytes);
+		if (DIV_ROUND_UP(bytes, sizeof(u64)) != le32_to_cpu(e->u64s) ||
+		    bytes > BCH_COMPRESS_DICT_MAX_BYTES) {
+			prt_printf(err, "entry %u has bad size %u", nr, bytes);
+			return -BCH_ERR_invalid_sb_compression_dict;
+		}
+
+		u32 id = le32_to_cpu(e->id);
+		if (!id || zstd_dict_id(e->data, bytes) != id) {
+			prt_printf(err, "entry %u: id %u does not match dictionary header", nr, id);
+			return -BCH_ERR_invalid_sb_compression_dict;
+		}
+
+		if (nr == BCH_COMPRESS_DICTS_MAX) {
+			prt_printf(err, "too many dictionaries (max %u)", BCH_COMPRESS_DICTS_MAX);
+			return -BCH_ERR_invalid_sb_compression_dict;
+		}
+
+		for (unsigned i = 0; i < nr; i++)
+			if (ids[i] == id) {
+				prt_printf(err, "duplicate dictionary id %u", id);
+				return -BCH_ERR_invalid_sb_compression_dict;
+			}
+
+		ids[nr++] = id;
+	}
+
+	return 0;
+}
+
+static void bch2_sb_compression_dict_to_text(struct printbuf *out,
+					     struct bch_fs *c, struct bch_sb *sb,
+					     struct bch_sb_field *f)
+{
+	struct bch_sb_field_compression_dict *d = field_to_type(f, compression_dict);
+
+	for_each_sb_compression_dict(d, e) {
+		prt_printf(out, "id %u:\t", le32_to_cpu(e->id));
+		prt_units_u64(out, le32_to_cpu(e->bytes));
+		prt_newline(out);
+	}
+}
+
+const struct bch_sb_field_ops bch_sb_field_ops_compression_dict = {
+	.validate	= bch2_sb_compression_dict_validate,
+	.to_text	= bch2_sb_compression_dict_to_text,
+};
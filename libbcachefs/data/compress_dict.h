@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_DATA_COMPRESS_DICT_H
+#define _BCACHEFS_DATA_COMPRESS_DICT_H
+
+#include <linux/zstd.h>
+
+/* ZDICT_MAGICNUMBER: dictionaries without it are raw content, which we don't take */
+#define BCH_ZSTD_DICT_MAGIC		0xEC30A437
+#define BCH_COMPRESS_DICT_MAX_BYTES	(64U << 10)
+
+zstd_cdict *bch2_compress_dict_cdict(struct bch_fs *, unsigned,
+				     zstd_compression_parameters);
+zstd_ddict *bch2_compress_dict_ddict(struct bch_fs *, u32);
+
+int bch2_compress_dict_add(struct bch_fs *, const void *, size_t);
+
+void bch2_fs_compress_dicts_exit(struct bch_fs *);
+int bch2_fs_compress_dicts_init(struct bch_fs *);
+
+extern const struct bch_sb_field_ops bch_sb_field_ops_compression_dict;
+
+#endif /* _BCACHEFS_DATA_COMPRESS_DICT_H */
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_COMPRESS_FORMAT_H
+#define _BCACHEFS_COMPRESS_FORMAT_H
+
+/*
+ * Trained zstd dictionaries, for BCH_COMPRESSION_TYPE_zstd_dict.
+ *
+ * Dictionaries are only ever appended: extents record which dictionary they
+ * were compressed with via the dictionary id in the zstd frame header, so a
+ * dictionary can't be removed while any extent might still reference it.
+ */
+struct bch_compression_dict {
+	__le32			u64s;	/* size of data, in u64s */
+	__le32			id;	/* zstd dictionary id, from the dictionary header */
+	__le32			bytes;	/* size of data, in bytes */
+	__le32			pad;
+	__u8			data[0];
+	__u64			_data[];
+};
+
+struct bch_sb_field_compression_dict {
+	struct bch_sb_field	field;
+	struct bch_compression_dict start[];
+};
+
+#endif /* _BCACHEFS_COMPRESS_FORMAT_H */
@@ -2,10 +2,29 @@
 #ifndef _BCACHEFS_DATA_COMPRESS_TYPES_H
 #define _BCACHEFS_DATA_COMPRESS_TYPES_H
 
+#define BCH_COMPRESS_INODE_HIST_BITS	10
+#define BCH_COMPRESS_DICTS_MAX		8
+
+struct bch_compress_dict;
+
 struct bch_fs_compress {
 	mempool_t		bounce[2];
 	mempool_t		workspace[BCH_COMPRESSION_OPT_NR];
 	size_t			zstd_workspace_size;
+
+	/*
+	 * Recent compression outcomes, hashed by inode number: a tag identifying
+	 * the inode in the high bits, then one bit per write, set if the data
+	 * was incompressible
+	 */
+	u64			inode_hist[1U << BCH_COMPRESS_INODE_HIST_BITS];
+
+	/*
+	 * Trained zstd dictionaries, oldest first: appended to under sb_lock,
+	 * the newest is used for new writes
+	 */
+	unsigned		nr_dicts;
+	struct bch_compress_dict *dicts[BCH_COMPRESS_DICTS_MAX];
 };
 
 #endif /* _BCACHEFS_DATA_COMPRESS_TYPES_H */
@@ -807,6 +807,26 @@ void bch2_latency_acct(struct bch_dev *ca, u64 submit_time, int rw)
 	__bch2_time_stats_update(&ca->io_latency[rw].stats, submit_time, now);
 }
 
+static void bch2_write_rate_acct(struct bch_dev *ca, u64 submit_time, unsigned sectors)
+{
+	atomic64_t *rate = &ca->write_ns_per_sector;
+	u64 now = local_clock();
+
+	if (!sectors || !time_after64(now, submit_time))
+		return;
+
+	u64 v = div_u64(now - submit_time, sectors);
+	u64 old = atomic64_read(rate), new;
+
+	do {
+		new = old ? ewma_add(old, v, 5) : v;
+	} while (!atomic64_try_cmpxchg(rate, &old, new));
+}
+
+#else
+
+static inline void bch2_write_rate_acct(struct bch_dev *ca, u64 submit_time, unsigned sectors) {}
+
 #endif
 
 /* Allocate, free from mempool: */
@@ -1202,6 +1222,7 @@ void bch2_submit_wbio_replicas(struct bch_write_bio *wbio, struct bch_fs *c,
 		n->have_ioref		= ca != NULL;
 		n->nocow		= nocow;
 		n->submit_time		= local_clock();
+		n->sectors		= bio_sectors(&n->bio);
 		n->inode_offset		= bkey_start_offset(&k->k);
 		if (nocow)
 			n->nocow_bucket	= PTR_BUCKET_NR(ca, ptr);
@@ -1451,6 +1472,8 @@ static void bch2_write_endio(struct bio *bio)
 
 	bch2_account_io_completion(ca, BCH_MEMBER_ERROR_write,
 				   wbio->submit_time, !bio->bi_status);
+	if (ca && !bio->bi_status)
+		bch2_write_rate_acct(ca, wbio->submit_time, wbio->sectors);
 
 	if (unlikely(bio->bi_status)) {
 		guard(spinlock_irqsave)(&c->write_error_lock);
@@ -1679,6 +1702,391 @@ csum_err:
 	return bch_err_throw(c, data_write_csum);
 }
 
+/*
+ * compression_adaptive: each write point steps its compression level up or
+ * down depending on whether compressing a sector takes longer than its devices
+ * take to write what it compresses to. If the compressor is the bottleneck we
+ * step down; if the devices are more than twice as slow there's CPU to spare,
+ * and we step up.
+ *
+ * Device write speed is the latency of data writes per sector, so it's only
+ * meaningful relative to how fast we compress - it doesn't account for queue
+ * depth. Levels are between compression_level_min and the level the
+ * compression option specifies, and change at most every 100ms. Without an
+ * explicit level we never go above the algorithm's default: stepping up is only
+ * done when asked for with type:level (e.g. plain lz4 must not turn into lz4hc).
+ */
+static void write_compression_level_range(struct bch_fs *c,
+					  union bch_compression_opt opt,
+					  unsigned *min, unsigned *max)
+{
+	*max = opt.level ?: bch2_compression_opt_default_level(opt.type);
+	*min = min_t(unsigned, c->opts.compression_level_min, *max);
+}
+
+static unsigned bch2_write_compression_opt(struct bch_write_op *op, struct write_point *wp)
+{
+	struct bch_fs *c = op->c;
+	union bch_compression_opt opt = { .value = op->compression_opt };
+
+	if (!opt.type || !c->opts.compression_adaptive)
+		return op->compression_opt;
+
+	unsigned min, max;
+	write_compression_level_range(c, opt, &min, &max);
+
+	opt.level = clamp_t(unsigned, wp->compression_level, min, max);
+	return opt.value;
+}
+
+static u64 write_point_dev_ns_per_sector(struct bch_fs *c, struct write_point *wp)
+{
+	struct open_bucket *ob;
+	unsigned i;
+	u64 ret = 0;
+
+	/* Every replica has to be written - the slowest device is what counts: */
+	open_bucket_for_each(c, &wp->ptrs, ob, i)
+		ret = max_t(u64, ret, atomic64_read(&ob_dev(c, ob)->write_ns_per_sector));
+	return ret;
+}
+
+static void bch2_write_compression_update(struct bch_fs *c, struct write_point *wp,
+					  unsigned compression_opt, u64 duration,
+					  size_t src_len, size_t dst_len)
+{
+	union bch_compression_opt opt = { .value = compression_opt };
+	unsigned sectors = src_len >> 9;
+
+	if (!opt.type || !c->opts.compression_adaptive || !sectors)
+		return;
+
+	u64 dev_ns = write_point_dev_ns_per_sector(c, wp);
+	if (!dev_ns)
+		return;
+
+	u64 encode	= div_u64(duration, sectors);
+	u64 write	= div_u64(dev_ns * (dst_len >> 9), sectors);
+
+	wp->encode_ns_per_sector = wp->encode_ns_per_sector
+		? ewma_add(wp->encode_ns_per_sector, encode, 3)
+		: encode;
+	wp->write_ns_per_sector = wp->write_ns_per_sector
+		? ewma_add(wp->write_ns_per_sector, write, 3)
+		: write;
+
+	u64 now = local_clock();
+	if (now - wp->compression_level_changed < 100 * NSEC_PER_MSEC)
+		return;
+
+	unsigned min, max;
+	write_compression_level_range(c, opt, &min, &max);
+
+	unsigned level = clamp_t(unsigned, wp->compression_level, min, max);
+
+	if (wp->encode_ns_per_sector > wp->write_ns_per_sector && level > min) {
+		level--;
+		event_inc(c, data_compress_level_down);
+	} else if (wp->encode_ns_per_sector * 2 < wp->write_ns_per_sector && level < max) {
+		level++;
+		event_inc(c, data_compress_level_up);
+	} else {
+		return;
+	}
+
+	wp->compression_level		= level;
+	wp->compression_level_changed	= now;
+	/* Start measuring the new level from scratch: */
+	wp->encode_ns_per_sector	= 0;
+	wp->write_ns_per_sector		= 0;
+}
+
+static void write_point_compression_to_text(struct printbuf *out, struct bch_fs *c,
+					    struct write_point *wp)
+{
+	guard(mutex)(&wp->lock);
+
+	if (!wp->compression_level)
+		return;
+
+	prt_printf(out, "%lu:\t%u\t", wp->write_point, wp->compression_level);
+	bch2_pr_time_units(out, wp->encode_ns_per_sector);
+	prt_tab_rjust(out);
+	bch2_pr_time_units(out, wp->write_ns_per_sector);
+	prt_tab_rjust(out);
+	prt_newline(out);
+}
+
+void bch2_write_compression_adaptive_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	struct bch_fs_allocator *a = &c->allocator;
+
+	printbuf_tabstop_push(out, 24);
+	printbuf_tabstop_push(out, 8);
+	printbuf_tabstop_push(out, 16);
+	printbuf_tabstop_push(out, 16);
+
+	prt_printf(out, "write point\tlevel\tencode/sector\rwrite/sector\r\n");
+
+	for (struct write_point *wp = a->write_points;
+	     wp < a->write_points + ARRAY_SIZE(a->write_points);
+	     wp++)
+		write_point_compression_to_text(out, c, wp);
+	write_point_compression_to_text(out, c, &c->copygc.write_point);
+	write_point_compression_to_text(out, c, &a->reconcile_write_point);
+
+	prt_newline(out);
+	prt_printf(out, "device write/sector:\n");
+
+	for_each_member_device(c, ca) {
+		prt_printf(out, "%s\t", ca->name);
+		bch2_pr_time_units(out, atomic64_read(&ca->write_ns_per_sector));
+		prt_newline(out);
+	}
+}
+
+/*
+ * Large bounced writes are split into encoded_extent_max extents that are each
+ * compressed, encrypted and checksummed independently - so encode a batch of
+ * them at a time on write_encode_wq.
+ *
+ * Compression runs first, into a buffer per extent, since that determines
+ * where each extent lands in @dst; extents are then laid out, given their
+ * nonces and appended to the keylist in order, exactly as the serial loop in
+ * bch2_write_extent() would.
+ */
+struct write_encode_job {
+	struct closure			cl;
+	struct bch_write_op		*op;
+	struct bio			*src;
+	struct bio			*dst;
+	struct bvec_iter		src_iter;
+	struct bvec_iter		dst_iter;
+	void				*buf;
+	size_t				src_len;
+	size_t				dst_len;
+	unsigned			compression_opt;
+	struct bch_extent_crc_unpacked	crc;
+	struct bversion			version;
+	u64				start_time;
+	u64				compress_time;
+	int				ret;
+};
+
+static CLOSURE_CALLBACK(write_encode_compress_work)
+{
+	closure_type(j, struct write_encode_job, cl);
+	struct bch_write_op *op = j->op;
+
+	u64 start = local_clock();
+
+	j->crc.compression_type =
+		bch2_bio_compress_to_buf(op->c, j->buf, &j->dst_len,
+					 j->src, j->src_iter, &j->src_len,
+					 j->compression_opt, op->pos,
+					 !(op->flags & BCH_WRITE_pages_stable),
+					 !(op->flags & BCH_WRITE_move));
+	j->compress_time = local_clock() - start;
+	closure_return(cl);
+}
+
+static CLOSURE_CALLBACK(write_encode_work)
+{
+	closure_type(j, struct write_encode_job, cl);
+	struct bch_write_op *op = j->op;
+	struct bch_fs *c = op->c;
+	struct nonce nonce = extent_nonce(j->version, j->crc);
+
+	if (!crc_is_compressed(j->crc)) {
+		struct bvec_iter src_iter = j->src_iter;
+		struct bvec_iter dst_iter = j->dst_iter;
+
+		bio_copy_data_iter(j->dst, &dst_iter, j->src, &src_iter);
+	}
+
+	j->ret = bch2_encrypt_bio_iter(c, op->csum_type, nonce, j->dst, j->dst_iter);
+	if (!j->ret) {
+		j->crc.csum = bch2_checksum_bio_iter(c, op->csum_type, nonce,
+						     j->dst, j->dst_iter);
+		j->crc.csum_type = op->csum_type;
+	}
+
+	bch2_time_stats_update(&c->times[BCH_TIME_data_write_encode], j->start_time);
+	closure_return(cl);
+}
+
+static void write_encode_bufs_free(struct write_encode_job *jobs, unsigned nr)
+{
+	for (unsigned i = 0; i < nr; i++) {
+		kvfree(jobs[i].buf);
+		jobs[i].buf = NULL;
+	}
+}
+
+static bool write_encode_parallel(struct bch_write_op *op, struct bio *src)
+{
+	struct bch_fs *c = op->c;
+
+	return  c->write_encode_wq &&
+		!(op->flags & BCH_WRITE_data_encoded) &&
+		(op->compression_opt || op->csum_type) &&
+		min(c->opts.write_encode_depth, num_online_cpus()) > 1 &&
+		src->bi_iter.bi_size > c->opts.encoded_extent_max;
+}
+
+static int bch2_write_extent_parallel(struct bch_write_op *op, struct write_point *wp,
+				      struct bio *src, struct bio *dst,
+				      unsigned *total_input, unsigned *total_output)
+{
+	struct bch_fs *c = op->c;
+	unsigned chunk = c->opts.encoded_extent_max;
+	unsigned max = min(c->opts.write_encode_depth, num_online_cpus());
+	unsigned compression_opt = bch2_write_compression_opt(op, wp);
+
+	struct write_encode_job *jobs __free(kfree) =
+		kcalloc(max, sizeof(*jobs), GFP_NOFS|__GFP_NOWARN);
+	if (!jobs)
+		return 0;
+
+	/* The serial loop handles the tail, it's no more than one extent: */
+	while (src->bi_iter.bi_size > chunk &&
+	       dst->bi_iter.bi_size > chunk) {
+		struct bvec_iter src_iter = src->bi_iter;
+		unsigned dst_avail = dst->bi_iter.bi_size;
+		unsigned nr = 0;
+
+		while (nr < max && src_iter.bi_size && dst_avail) {
+			struct write_encode_job *j = jobs + nr++;
+			unsigned len = min3(src_iter.bi_size, dst_avail, chunk);
+
+			memset(j, 0, sizeof(*j));
+			j->op			= op;
+			j->src			= src;
+			j->dst			= dst;
+			j->src_iter		= src_iter;
+			j->src_iter.bi_size	= len;
+			j->src_len		= len;
+			j->dst_len		= len;
+			j->compression_opt	= compression_opt;
+			j->crc.compression_type	= op->incompressible
+				? BCH_COMPRESSION_TYPE_incompressible
+				: 0;
+			j->start_time		= local_clock();
+
+			bio_advance_iter(src, &src_iter, len);
+			dst_avail -= len;
+		}
+
+		if (bch2_keylist_realloc(&op->insert_keys,
+					 op->inline_keys,
+					 ARRAY_SIZE(op->inline_keys),
+					 nr * BKEY_EXTENT_U64s_MAX))
+			break;
+
+		CLASS(closure_stack, cl)();
+
+		if (op->compression_opt) {
+			for (unsigned i = 0; i < nr; i++) {
+				jobs[i].buf = kvmalloc(jobs[i].dst_len, GFP_NOFS|__GFP_NOWARN);
+				if (!jobs[i].buf) {
+					write_encode_bufs_free(jobs, i);
+					return 0;
+				}
+			}
+
+			for (unsigned i = 0; i < nr; i++)
+				closure_call(&jobs[i].cl, write_encode_compress_work,
+					     c->write_encode_wq, &cl);
+			closure_sync_unbounded(&cl);
+		}
+
+		struct bvec_iter dst_iter = dst->bi_iter;
+		unsigned src_done = 0;
+
+		for (unsigned i = 0; i < nr; i++) {
+			struct write_encode_job *j = jobs + i;
+			bool compressed = crc_is_compressed(j->crc);
+			bool last = false;
+
+			if (!compressed)
+				j->src_len = j->dst_len = j->src_iter.bi_size;
+
+			/* Jobs ran concurrently, so count their throughput together: */
+			if (op->compression_opt)
+				bch2_write_compression_update(c, wp, compression_opt,
+							      div_u64(j->compress_time, nr),
+							      j->src_len, j->dst_len);
+
+			/*
+			 * As in the serial loop, uncompressed extents are only
+			 * limited to encoded_extent_max if they're checksummed;
+			 * otherwise the rest of the write goes in this one:
+			 */
+			if (!compressed && !op->csum_type) {
+				j->src_len = j->dst_len = min(src->bi_iter.bi_size - src_done,
+							      dst_iter.bi_size);
+				j->src_iter.bi_size = j->src_len;
+				last = true;
+			}
+			src_done += j->src_len;
+
+			j->crc.compressed_size		= j->dst_len >> 9;
+			j->crc.uncompressed_size	= j->src_len >> 9;
+			j->crc.live_size		= j->src_len >> 9;
+
+			j->version = op->version;
+			if (bch2_csum_type_is_encryption(op->csum_type)) {
+				if (bversion_zero(j->version)) {
+					j->version.lo = atomic64_inc_return(&c->key_version);
+				} else {
+					j->crc.nonce = op->nonce;
+					op->nonce += j->src_len >> 9;
+				}
+			}
+
+			j->dst_iter		= dst_iter;
+			j->dst_iter.bi_size	= j->dst_len;
+			bio_advance_iter(dst, &dst_iter, j->dst_len);
+
+			if (compressed) {
+				memcpy_to_bio(dst, j->dst_iter, j->buf);
+
+				/* Only part of the chunk fit: later chunks start in the wrong place */
+				if (j->src_len < j->src_iter.bi_size)
+					last = true;
+			}
+
+			if (last) {
+				nr = i + 1;
+				break;
+			}
+		}
+
+		for (unsigned i = 0; i < nr; i++)
+			closure_call(&jobs[i].cl, write_encode_work, c->write_encode_wq, &cl);
+		closure_sync_unbounded(&cl);
+
+		write_encode_bufs_free(jobs, max);
+
+		for (unsigned i = 0; i < nr; i++)
+			if (jobs[i].ret)
+				return jobs[i].ret;
+
+		for (unsigned i = 0; i < nr; i++) {
+			struct write_encode_job *j = jobs + i;
+
+			init_append_extent(op, wp, j->version, j->crc);
+
+			bio_advance(dst, j->dst_len);
+			bio_advance(src, j->src_len);
+			*total_output	+= j->dst_len;
+			*total_input	+= j->src_len;
+		}
+	}
+
+	return 0;
+}
+
 static int bch2_write_extent(struct bch_write_op *op, struct write_point *wp,
 			     struct bio **_dst)
 {
@@ -1739,6 +2147,28 @@ static int bch2_write_extent(struct bch_write_op *op, struct write_point *wp,
 #endif
 	saved_iter = dst->bi_iter;
 
+	bool encode_parallel = bounce && !page_alloc_failed &&
+		write_encode_parallel(op, src);
+#ifdef CONFIG_BCACHEFS_DEBUG
+	/* bch2_maybe_corrupt_bio() is applied per extent, in the loop below: */
+	encode_parallel &= !write_corrupt_ratio;
+#endif
+	if (encode_parallel) {
+		ret = bch2_write_extent_parallel(op, wp, src, dst,
+						 &total_input, &total_output);
+		if (ret)
+			goto err;
+
+		if (!dst->bi_iter.bi_size ||
+		    !src->bi_iter.bi_size ||
+		    !wp->sectors_free ||
+		    bch2_keylist_realloc(&op->insert_keys,
+					 op->inline_keys,
+					 ARRAY_SIZE(op->inline_keys),
+					 BKEY_EXTENT_U64s_MAX))
+			goto encode_done;
+	}
+
 	do {
 		struct bch_extent_crc_unpacked crc = { 0 };
 		struct bversion version = op->version;
@@ -1756,13 +2186,23 @@ static int bch2_write_extent(struct bch_write_op *op, struct write_point *wp,
 		       bch2_csum_type_is_encryption(op->crc.csum_type));
 		BUG_ON(op->compression_opt && !bounce);
 
-		crc.compression_type = op->incompressible
-			? BCH_COMPRESSION_TYPE_incompressible
-			: op->compression_opt
-			? bch2_bio_compress(c, dst, &dst_len, src, &src_len,
-					    op->compression_opt,
-					    op->pos, !(op->flags & BCH_WRITE_pages_stable))
-			: 0;
+		if (op->incompressible) {
+			crc.compression_type = BCH_COMPRESSION_TYPE_incompressible;
+		} else if (op->compression_opt) {
+			unsigned compression_opt = bch2_write_compression_opt(op, wp);
+			u64 start = local_clock();
+
+			crc.compression_type =
+				bch2_bio_compress(c, dst, &dst_len, src, &src_len,
+						  compression_opt,
+						  op->pos, !(op->flags & BCH_WRITE_pages_stable),
+						  !(op->flags & BCH_WRITE_move));
+
+			bch2_write_compression_update(c, wp, compression_opt,
+						      local_clock() - start, src_len,
+						      crc_is_compressed(crc) ? dst_len : src_len);
+		}
+
 		if (!crc_is_compressed(crc)) {
 			dst_len = min(dst->bi_iter.bi_size, src->bi_iter.bi_size);
 			dst_len = min_t(unsigned, dst_len, wp->sectors_free << 9);
@@ -1870,7 +2310,7 @@ static int bch2_write_extent(struct bch_write_op *op, struct write_point *wp,
 				      op->inline_keys,
 				      ARRAY_SIZE(op->inline_keys),
 				      BKEY_EXTENT_U64s_MAX));
-
+encode_done:
 	more = src->bi_iter.bi_size != 0;
 
 	dst->bi_iter = saved_iter;
@@ -2573,6 +3013,8 @@ void bch2_write_op_to_text(struct printbuf *out, struct bch_write_op *op)
 
 void bch2_fs_io_write_exit(struct bch_fs *c)
 {
+	if (c->write_encode_wq)
+		destroy_workqueue(c->write_encode_wq);
 	bioset_exit(&c->replica_set);
 	bioset_exit(&c->bio_write);
 }
@@ -2580,7 +3022,9 @@ void bch2_fs_io_write_exit(struct bch_fs *c)
 int bch2_fs_io_write_init(struct bch_fs *c)
 {
 	if (bioset_init(&c->bio_write,   1, offsetof(struct bch_write_bio, bio), BIOSET_NEED_BVECS) ||
-	    bioset_init(&c->replica_set, 4, offsetof(struct bch_write_bio, bio), 0))
+	    bioset_init(&c->replica_set, 4, offsetof(struct bch_write_bio, bio), 0) ||
+	    !(c->write_encode_wq = alloc_workqueue("bcachefs_write_encode",
+				WQ_HIGHPRI|WQ_MEM_RECLAIM|WQ_UNBOUND, 0)))
 		return bch_err_throw(c, ENOMEM_bio_write_init);
 
 	return 0;
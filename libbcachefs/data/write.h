@@ -74,6 +74,8 @@ extern const char * const bch2_write_flags[];
 void __bch2_write_op_to_text(struct printbuf *, struct bch_write_op *);
 void bch2_write_op_to_text(struct printbuf *, struct bch_write_op *);
 
+void bch2_write_compression_adaptive_to_text(struct printbuf *, struct bch_fs *);
+
 void bch2_fs_io_write_exit(struct bch_fs *);
 int bch2_fs_io_write_init(struct bch_fs *);
 
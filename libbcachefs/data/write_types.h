@@ -52,6 +52,7 @@ struct bch_write_bio {
 
 	struct bch_io_failures	failed;
 	u8			dev;
+	u32			sectors;
 
 	unsigned		split:1,
 				bounce:1,
@@ -111,7 +111,7 @@ void bch2_btree_node_ondisk_to_text(struct printbuf *out, struct bch_fs *c,
 
 			bset_encrypt(c, i, offset << 9);
 
-			sectors = vstruct_sectors(n_ondisk, c->block_bits);
+			sectors = btree_bset_sectors(n_ondisk, c->block_bits);
 		} else {
 			struct btree_node_entry *bne = (void *) n_ondisk + (offset << 9);
 
@@ -136,7 +136,20 @@ void bch2_btree_node_ondisk_to_text(struct printbuf *out, struct bch_fs *c,
 
 			bset_encrypt(c, i, offset << 9);
 
-			sectors = vstruct_sectors(bne, c->block_bits);
+			sectors = btree_bset_sectors(bne, c->block_bits);
+		}
+
+		if (BSET_COMPRESSED(i)) {
+			if (offset + sectors > btree_sectors(c)) {
+				prt_printf(out, "compressed bset past end of btree node\n");
+				goto out;
+			}
+
+			ret = bch2_bset_decompress(c, i);
+			if (ret) {
+				prt_printf(out, "error decompressing bset: %s\n", bch2_err_str(ret));
+				goto out;
+			}
 		}
 
 		prt_printf(out, "  offset %u version %u, journal seq %llu\n",
@@ -22,6 +22,7 @@
 #include "btree/iter.h"
 #include "btree/key_cache.h"
 #include "btree/read.h"
+#include "btree/restart_profile.h"
 #include "btree/update.h"
 #include "btree/write.h"
 #include "btree/write_buffer.h"
@@ -32,6 +33,7 @@
 #include "data/move.h"
 #include "data/nocow_locking.h"
 #include "data/reconcile/work.h"
+#include "data/write.h"
 
 #include "debug/sysfs.h"
 #include "debug/tests.h"
@@ -193,6 +195,7 @@ read_attribute(btree_write_stats);
 
 read_attribute(btree_cache_size);
 read_attribute(compression_stats);
+read_attribute(compression_adaptive_stats);
 read_attribute(errors);
 read_attribute(journal_debug);
 read_attribute(journal_reclaim);
@@ -380,6 +383,9 @@ SHOW(bch2_fs)
 	if (attr == &sysfs_compression_stats)
 		bch2_compression_stats_to_text(out, c);
 
+	if (attr == &sysfs_compression_adaptive_stats)
+		bch2_write_compression_adaptive_to_text(out, c);
+
 	if (attr == &sysfs_errors)
 		bch2_fs_errors_to_text(out, c);
 
@@ -539,6 +545,7 @@ struct attribute *bch2_fs_files[] = {
 	&sysfs_recovery_status,
 
 	&sysfs_compression_stats,
+	&sysfs_compression_adaptive_stats,
 	&sysfs_errors,
 
 #ifdef CONFIG_BCACHEFS_TESTS
@@ -751,6 +758,50 @@ struct bin_attribute bin_attr_btree_trans_stats_json = {
 	.write	= bch2_btree_trans_stats_json_write,
 };
 
+/* transaction restart profile - JSON via bin_attribute */
+
+static ssize_t bch2_trans_restart_profile_json_read(struct file *file,
+		struct kobject *kobj, const struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct bch_fs *c = container_of(kobj, struct bch_fs, internal);
+	struct printbuf *out = &c->btree.trans.restart_profile_json_buf;
+
+	guard(mutex)(&c->btree.trans.restart_profile_json_lock);
+
+	/* Same as btree_trans_stats_json: only regenerate at the start of a read */
+	if (off == 0) {
+		printbuf_reset(out);
+		bch2_trans_restart_profile_json_to_text(out, c);
+
+		if (out->allocation_failure)
+			return -ENOMEM;
+	}
+
+	if (off >= out->pos)
+		return 0;
+
+	size_t n = min_t(size_t, count, out->pos - off);
+	memcpy(buf, out->buf + off, n);
+	return n;
+}
+
+static ssize_t bch2_trans_restart_profile_json_write(struct file *file,
+		struct kobject *kobj, const struct bin_attribute *attr,
+		char *buf, loff_t off, size_t count)
+{
+	struct bch_fs *c = container_of(kobj, struct bch_fs, internal);
+
+	bch2_trans_restart_profile_reset(c);
+	return count;
+}
+
+struct bin_attribute bin_attr_trans_restart_profile_json = {
+	.attr	= { .name = "trans_restart_profile_json", .mode = 0644 },
+	.read	= bch2_trans_restart_profile_json_read,
+	.write	= bch2_trans_restart_profile_json_write,
+};
+
 /* options */
 
 static ssize_t sysfs_opt_show(struct bch_fs *c,
@@ -907,13 +958,23 @@ struct attribute *bch2_fs_time_stats_files[] = {
 
 /* time stats - JSON */
 
+/*
+ * The histogram is coarsened to fit in a page, but don't ever hand out
+ * truncated - invalid - JSON if it somehow still doesn't:
+ */
+static int sysfs_time_stats_json(struct printbuf *out, struct bch2_time_stats *stats)
+{
+	bch2_time_stats_json_to_text(out, stats, NULL, 0);
+	return out->pos < PAGE_SIZE ? 0 : -EFBIG;
+}
+
 SHOW(bch2_fs_time_stats_json)
 {
 	struct bch_fs *c = container_of(kobj, struct bch_fs, time_stats_json);
 
 #define x(name, ...)							\
 	if (attr == &sysfs_time_stat_##name)				\
-		bch2_time_stats_json_to_text(out, &c->times[BCH_TIME_##name], NULL, 0);
+		return sysfs_time_stats_json(out, &c->times[BCH_TIME_##name]);
 	BCH_TIME_STATS()
 #undef x
 
@@ -999,10 +1060,10 @@ SHOW(bch2_dev)
 		bch2_time_stats_to_text(out, &ca->io_latency[WRITE].stats);
 
 	if (attr == &sysfs_io_latency_stats_read_json)
-		bch2_time_stats_json_to_text(out, &ca->io_latency[READ].stats, NULL, 0);
+		return sysfs_time_stats_json(out, &ca->io_latency[READ].stats);
 
 	if (attr == &sysfs_io_latency_stats_write_json)
-		bch2_time_stats_json_to_text(out, &ca->io_latency[WRITE].stats, NULL, 0);
+		return sysfs_time_stats_json(out, &ca->io_latency[WRITE].stats);
 
 #ifndef CONFIG_BCACHEFS_NO_LATENCY_ACCT
 	if (attr == &sysfs_congested)
@@ -123,9 +123,11 @@
 	x(ENOMEM,			ENOMEM_compression_bounce_read_init)	\
 	x(ENOMEM,			ENOMEM_compression_bounce_write_init)	\
 	x(ENOMEM,			ENOMEM_compression_workspace_init)	\
+	x(ENOMEM,			ENOMEM_compression_dict)		\
 	x(ENOMEM,			ENOMEM_backpointer_mismatches_bitmap)	\
 	x(EIO,				compression_workspace_not_initialized)	\
 	x(ENOMEM,			ENOMEM_bucket_gens)			\
+	x(ENOMEM,			ENOMEM_alloc_read)			\
 	x(ENOMEM,			ENOMEM_buckets_nouse)			\
 	x(ENOMEM,			ENOMEM_usage_init)			\
 	x(ENOMEM,			ENOMEM_btree_node_read_all_replicas)	\
@@ -143,8 +145,10 @@
 	x(ENOMEM,			ENOMEM_gc_repair_key)			\
 	x(ENOMEM,			ENOMEM_fsck_extent_ends_at)		\
 	x(ENOMEM,			ENOMEM_fsck_add_nlink)			\
+	x(ENOMEM,			ENOMEM_inode_find_batch)		\
 	x(ENOMEM,			ENOMEM_journal_key_insert)		\
 	x(ENOMEM,			ENOMEM_journal_keys_sort)		\
+	x(ENOMEM,			ENOMEM_journal_replay)			\
 	x(ENOMEM,			ENOMEM_read_superblock_clean)		\
 	x(ENOMEM,			ENOMEM_fs_alloc)			\
 	x(ENOMEM,			ENOMEM_fs_name_alloc)			\
@@ -171,6 +175,7 @@
 	x(ENOSPC,			ENOSPC_sb_members)			\
 	x(ENOSPC,			ENOSPC_sb_members_v2)			\
 	x(ENOSPC,			ENOSPC_sb_extent_type_u64s)		\
+	x(ENOSPC,			ENOSPC_sb_compression_dict)		\
 	x(ENOSPC,			ENOSPC_sb_crypt)			\
 	x(ENOSPC,			ENOSPC_sb_downgrade)			\
 	x(ENOSPC,			ENOSPC_btree_slot)			\
@@ -253,6 +258,7 @@
 	x(BCH_ERR_fsck,			fsck_ask)				\
 	x(BCH_ERR_fsck,			fsck_fix)				\
 	x(BCH_ERR_fsck,			fsck_delete_bkey)			\
+	x(BCH_ERR_fsck,			fsck_deferred)				\
 	x(BCH_ERR_fsck,			fsck_ignore)				\
 	x(BCH_ERR_fsck,			fsck_errors_not_fixed)			\
 	x(BCH_ERR_fsck,			fsck_repair_unimplemented)		\
@@ -378,6 +384,10 @@
 	x(EINVAL,			EINVAL_ioctl_disk_resize_journal_v2_bad_flags)	\
 	x(EINVAL,			EINVAL_ioctl_disk_resize_journal_v2_too_big)	\
 	x(EINVAL,			EINVAL_ioctl_not_started)			\
+	x(EINVAL,			EINVAL_ioctl_compression_dict_bad_flags)	\
+	x(EINVAL,			EINVAL_compression_dict_bad)			\
+	x(EINVAL,			EINVAL_compression_dict_exists)			\
+	x(EINVAL,			EINVAL_compression_dict_too_many)		\
 	x(EINVAL,			EINVAL_journal_write_overran_available_space)	\
 	x(EINVAL,			EINVAL_journal_bucket_not_found)		\
 	x(EINVAL,			EINVAL_journal_seq_overflow)			\
@@ -481,6 +491,7 @@
 	x(BCH_ERR_invalid_sb,		invalid_sb_ext)				\
 	x(BCH_ERR_invalid_sb,		invalid_sb_downgrade)			\
 	x(BCH_ERR_invalid_sb,		invalid_sb_extent_type_u64s)		\
+	x(BCH_ERR_invalid_sb,		invalid_sb_compression_dict)		\
 	x(BCH_ERR_invalid,		invalid_bkey)				\
 	x(BCH_ERR_operation_blocked,    nocow_lock_blocked)			\
 	x(EROFS,			journal_shutdown)			\
@@ -525,6 +536,9 @@
 	x(BCH_ERR_decompress,		decompress_gzip)			\
 	x(BCH_ERR_decompress,		decompress_zstd_src_len_bad)		\
 	x(BCH_ERR_decompress,		decompress_zstd_size_mismatch)		\
+	x(BCH_ERR_decompress,		decompress_zstd_dict_missing)		\
+	x(BCH_ERR_decompress,		decompress_bad_type)			\
+	x(BCH_ERR_decompress,		decompress_bset_len_bad)		\
 	x(EIO,				data_write)				\
 	x(BCH_ERR_data_write,		data_write_io)				\
 	x(BCH_ERR_data_write,		data_write_csum)			\
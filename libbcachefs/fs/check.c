@@ -144,7 +144,7 @@ static int create_lostfound(struct btree_trans *trans, u32 snapshot_tree,
 	root_inode->bi_nlink++;
 
 	CLASS(btree_iter_uninit, lostfound_iter)(trans);
-	try(bch2_inode_create(trans, &lostfound_iter, lostfound, snapshot, cpu,
+	try(bch2_inode_create(trans, &lostfound_iter, lostfound, snapshot, cpu, 0,
 			      inode_opt_get(c, root_inode, inodes_32bit)));
 
 	bch2_btree_iter_set_snapshot(&lostfound_iter, snapshot);
@@ -445,7 +445,7 @@ static int reconstruct_subvol(struct btree_trans *trans, u32 snapshotid, u32 sub
 
 		new_inode.bi_subvol = subvolid;
 
-		try(bch2_inode_create(trans, &inode_iter, &new_inode, snapshotid, cpu, false));
+		try(bch2_inode_create(trans, &inode_iter, &new_inode, snapshotid, cpu, 0, false));
 		try(bch2_btree_iter_traverse(&inode_iter));
 		try(bch2_inode_write(trans, &inode_iter, &new_inode));
 
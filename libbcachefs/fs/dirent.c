@@ -14,6 +14,7 @@
 #include "snapshots/subvolume.h"
 
 #include <linux/dcache.h>
+#include <linux/sort.h>
 
 #if IS_ENABLED(CONFIG_UNICODE)
 int bch2_casefold(struct btree_trans *trans, const struct bch_hash_info *info,
@@ -590,9 +591,13 @@ int bch2_empty_dir_trans(struct btree_trans *trans, subvol_inum dir)
 		bch2_empty_dir_snapshot(trans, dir.inum, dir.subvol, snapshot);
 }
 
-static int bch2_dir_emit(struct dir_context *ctx, struct bkey_s_c_dirent d, subvol_inum target)
+static int bch2_dir_emit(struct dir_context *ctx, struct bkey_s_c_dirent d,
+			 subvol_inum target, subvol_inum *target_out)
 {
 	struct qstr name = bch2_dirent_get_name(d);
+
+	if (target_out)
+		*target_out = target;
 	/*
 	 * Although not required by the kernel code, updating ctx->pos is needed
 	 * for the bcachefs FUSE driver. Without this update, the FUSE
@@ -610,10 +615,311 @@ static int bch2_dir_emit(struct dir_context *ctx, struct bkey_s_c_dirent d, subv
 	return !ret;
 }
 
-int bch2_readdir(struct bch_fs *c, subvol_inum inum,
-		 struct bch_hash_info *hash_info,
-		 struct dir_context *ctx)
+/*
+ * readdir_inode_order: the hash space is split into a fixed number of windows,
+ * returned in order, and entries within a window are returned sorted by inode
+ * number - so that a readdir followed by a stat of every entry walks the
+ * inodes btree (mostly) in order.
+ *
+ * Window boundaries don't depend on what's in the directory, and readdir
+ * cookies are still dirent offsets - the offset of the last entry returned,
+ * plus one - so resuming means looking that entry up, and continuing after its
+ * (inode, offset) in its window: entries that existed throughout are never
+ * skipped or repeated. If the last entry returned has since been deleted, we
+ * restart its window, and entries may be returned twice.
+ *
+ * Each pass over a window picks out the next BCH_READDIR_PASS_MAX entries,
+ * with copies of their dirents, so memory use is bounded however many entries
+ * end up in one window. A pass that one readdir call doesn't use up is kept in
+ * c->readdir_cache, keyed by the cookie the next call will resume from, so we
+ * scan a window about once per BCH_READDIR_PASS_MAX entries returned, not once
+ * per call; entries are then returned as they were when the pass was read.
+ *
+ * Since windows are a fixed fraction of the hash space, this only buys much
+ * locality in directories with tens of thousands of entries or more: a
+ * smaller directory has only a few entries in each window.
+ */
+#define BCH_READDIR_WINDOW_BITS		8
+#define BCH_READDIR_PASS_MAX		1024
+
+static int readdir_ent_cmp(const void *_l, const void *_r)
+{
+	const struct readdir_ent *l = _l, *r = _r;
+
+	return cmp_int(l->inum, r->inum) ?: cmp_int(l->offset, r->offset);
+}
+
+static unsigned readdir_window_shift(const struct bch_hash_info *info)
+{
+	unsigned hash_bits = info->is_31bit			? 31
+		: info->type == BCH_STR_HASH_crc32c		? 32
+		: 63;
+
+	return hash_bits - BCH_READDIR_WINDOW_BITS;
+}
+
+/* Returns > 0 if there's no dirent at @offset visible in @dir's subvolume: */
+static int readdir_dirent_get(struct btree_trans *trans, subvol_inum dir, u64 offset,
+			      subvol_inum *target)
+{
+	u32 snapshot;
+	try(bch2_subvolume_get_snapshot(trans, dir.subvol, &snapshot));
+
+	CLASS(btree_iter, iter)(trans, BTREE_ID_dirents, SPOS(dir.inum, offset, snapshot), 0);
+	struct bkey_s_c k = bkey_try(bch2_btree_iter_peek_slot(&iter));
+	if (k.k->type != KEY_TYPE_dirent)
+		return 1;
+
+	return bch2_dirent_read_target(trans, dir, bkey_s_c_to_dirent(k), target);
+}
+
+static void readdir_pass_exit(struct readdir_pass *p)
+{
+	darray_exit(&p->ents);
+	darray_exit(&p->keys);
+}
+
+/* Keep the first @nr entries in inode number order, and only their dirents: */
+static int readdir_pass_trim(struct readdir_pass *p, size_t nr)
+{
+	sort(p->ents.data, p->ents.nr, sizeof(p->ents.data[0]), readdir_ent_cmp, NULL);
+	p->ents.nr = min(p->ents.nr, nr);
+
+	darray_u64 keys = {};
+	darray_for_each(p->ents, i) {
+		struct bkey_i *k = (void *) (p->keys.data + i->key);
+		int ret = darray_make_room(&keys, k->k.u64s);
+		if (ret) {
+			darray_exit(&keys);
+			return ret;
+		}
+
+		i->key = keys.nr;
+		bkey_copy((void *) (keys.data + keys.nr), k);
+		keys.nr += k->k.u64s;
+	}
+
+	darray_exit(&p->keys);
+	p->keys = keys;
+	return 0;
+}
+
+static int readdir_pass_add(struct btree_trans *trans, struct readdir_pass *p,
+			    struct bch_hash_info *hash_info, struct bkey_s_c k)
+{
+	subvol_inum target;
+	bool need_second_pass = false, repaired_inode = false;
+	int ret = bch2_str_hash_check_key(trans, NULL, &bch2_dirent_hash_desc,
+					  hash_info, k,
+					  &need_second_pass, &repaired_inode) ?:
+		bch2_dirent_read_target(trans, p->dir, bkey_s_c_to_dirent(k), &target);
+	if (ret)
+		return min(ret, 0);
+
+	struct readdir_ent e = {
+		.inum		= target.inum,
+		.offset		= k.k->p.offset,
+		.target_subvol	= target.subvol,
+	};
+
+	if (p->have_after && readdir_ent_cmp(&e, &p->after) <= 0)
+		return 0;
+
+	/* Only the first BCH_READDIR_PASS_MAX are wanted: */
+	if (p->ents.nr == BCH_READDIR_PASS_MAX * 2)
+		try(readdir_pass_trim(p, BCH_READDIR_PASS_MAX));
+
+	try(darray_make_room(&p->keys, k.k->u64s));
+
+	e.key = p->keys.nr;
+	bkey_reassemble((void *) (p->keys.data + p->keys.nr), k);
+	p->keys.nr += k.k->u64s;
+
+	return darray_push(&p->ents, e);
+}
+
+/*
+ * Read the next BCH_READDIR_PASS_MAX entries in the current window after
+ * @p->after, in inode number order:
+ */
+static int readdir_pass_read(struct btree_trans *trans, struct readdir_pass *p,
+			     struct bch_hash_info *hash_info, unsigned shift)
+{
+	u64 start	= p->window << shift;
+	u64 end		= p->window + 1 < 1ULL << BCH_READDIR_WINDOW_BITS
+		? start + (1ULL << shift) - 1
+		: U64_MAX;
+
+	p->idx		= 0;
+	p->ents.nr	= 0;
+	p->keys.nr	= 0;
+
+	int ret = for_each_btree_key_in_subvolume_max(trans, iter, BTREE_ID_dirents,
+				   POS(p->dir.inum, start),
+				   POS(p->dir.inum, end),
+				   p->dir.subvol, 0, k, ({
+			if (k.k->type != KEY_TYPE_dirent)
+				continue;
+
+			readdir_pass_add(trans, p, hash_info, k);
+		}));
+	if (ret < 0)
+		return ret;
+
+	try(readdir_pass_trim(p, BCH_READDIR_PASS_MAX));
+
+	p->more = p->ents.nr == BCH_READDIR_PASS_MAX;
+	return 0;
+}
+
+/*
+ * Find a cached pass we can resume from @pos: either where the last call
+ * stopped, or just after an entry it already returned - callers that hold back
+ * the last entry (the FUSE shims) resume from one entry earlier:
+ */
+static bool readdir_cache_get(struct bch_fs *c, subvol_inum dir, u64 pos,
+			      struct readdir_pass *p)
+{
+	struct bch_fs_readdir_cache *rc = &c->readdir_cache;
+
+	guard(mutex)(&rc->lock);
+	for (struct readdir_pass *i = rc->p; i < rc->p + ARRAY_SIZE(rc->p); i++) {
+		if (!i->dir.inum || !subvol_inum_eq(i->dir, dir))
+			continue;
+
+		if (i->pos != pos) {
+			size_t j = i->idx;
+
+			while (j && i->ents.data[j - 1].offset + 1 != pos)
+				--j;
+			if (!j)
+				continue;
+
+			i->idx		= j;
+			i->after	= i->ents.data[j - 1];
+			i->have_after	= true;
+		}
+
+		*p = *i;
+		memset(i, 0, sizeof(*i));
+		return true;
+	}
+
+	return false;
+}
+
+/* Stash @p for the readdir call that resumes from @p->pos, evicting the LRU: */
+static void readdir_cache_put(struct bch_fs *c, struct readdir_pass *p)
+{
+	struct bch_fs_readdir_cache *rc = &c->readdir_cache;
+
+	guard(mutex)(&rc->lock);
+	struct readdir_pass *victim = rc->p;
+	for (struct readdir_pass *i = rc->p; i < rc->p + ARRAY_SIZE(rc->p); i++) {
+		if (!i->dir.inum) {
+			victim = i;
+			break;
+		}
+		if (time_before(i->last_used, victim->last_used))
+			victim = i;
+	}
+
+	readdir_pass_exit(victim);
+
+	p->last_used = jiffies;
+	*victim = *p;
+	memset(p, 0, sizeof(*p));
+}
+
+void bch2_fs_readdir_cache_exit(struct bch_fs *c)
+{
+	for (unsigned i = 0; i < ARRAY_SIZE(c->readdir_cache.p); i++)
+		readdir_pass_exit(&c->readdir_cache.p[i]);
+}
+
+static int bch2_readdir_inode_order(struct bch_fs *c, subvol_inum inum,
+				    struct bch_hash_info *hash_info,
+				    struct dir_context *ctx,
+				    subvol_inum *target_out)
+{
+	CLASS(btree_trans, trans)(c);
+	struct readdir_pass p __cleanup(readdir_pass_exit) = {};
+
+	unsigned shift = readdir_window_shift(hash_info);
+	u64 nr_windows = 1ULL << BCH_READDIR_WINDOW_BITS;
+
+	if (!readdir_cache_get(c, inum, ctx->pos, &p)) {
+		/* [0,2) are dots, so this is 0 if we haven't returned anything yet: */
+		u64 last = ctx->pos > 2 ? ctx->pos - 1 : 0;
+
+		p.dir		= inum;
+		p.window	= last >> shift;
+		p.more		= true;
+
+		if (last) {
+			subvol_inum target;
+			int ret = lockrestart_do(trans, readdir_dirent_get(trans, inum, last, &target));
+			if (ret < 0)
+				return ret;
+
+			if (!ret) {
+				p.after = (struct readdir_ent) { .inum = target.inum, .offset = last };
+				p.have_after = true;
+			}
+		}
+	}
+
+	while (p.window < nr_windows) {
+		if (p.idx == p.ents.nr) {
+			if (p.more) {
+				try(readdir_pass_read(trans, &p, hash_info, shift));
+			} else {
+				p.window++;
+				p.have_after	= false;
+				p.more		= true;
+			}
+			continue;
+		}
+
+		struct readdir_ent *i = &p.ents.data[p.idx];
+		struct bkey_s_c_dirent d = bkey_i_to_s_c_dirent((void *) (p.keys.data + i->key));
+		struct qstr name = bch2_dirent_get_name(d);
+
+		/* dir_emit() can fault and block: */
+		bch2_trans_unlock(trans);
+
+		if (target_out)
+			*target_out = (subvol_inum) { .subvol = i->target_subvol, .inum = i->inum };
+
+		if (!dir_emit(ctx, name.name, name.len, i->inum,
+			      vfs_d_type(d.v->d_type))) {
+			p.pos = ctx->pos;
+			readdir_cache_put(c, &p);
+			return 0;
+		}
+
+		ctx->pos	= i->offset + 1;
+		p.after		= *i;
+		p.have_after	= true;
+		p.idx++;
+	}
+
+	return 0;
+}
+
+/*
+ * @target_out, if non NULL, is set to the (subvolume, inode) of each entry
+ * just before it's emitted - the inode number dir_emit() is passed isn't
+ * enough to find a subvolume root:
+ */
+int __bch2_readdir(struct bch_fs *c, subvol_inum inum,
+		   struct bch_hash_info *hash_info,
+		   struct dir_context *ctx,
+		   subvol_inum *target_out)
 {
+	if (c->opts.readdir_inode_order)
+		return bch2_readdir_inode_order(c, inum, hash_info, ctx, target_out);
+
 	struct bkey_buf sk __cleanup(bch2_bkey_buf_exit);
 	bch2_bkey_buf_init(&sk);
 
@@ -639,12 +945,19 @@ int bch2_readdir(struct bch_fs *c, subvol_inum inum,
 			if (ret2 > 0)
 				continue;
 
-			ret2 ?: (bch2_trans_unlock(trans), bch2_dir_emit(ctx, dirent, target));
+			ret2 ?: (bch2_trans_unlock(trans), bch2_dir_emit(ctx, dirent, target, target_out));
 		}));
 
 	return ret < 0 ? ret : 0;
 }
 
+int bch2_readdir(struct bch_fs *c, subvol_inum inum,
+		 struct bch_hash_info *hash_info,
+		 struct dir_context *ctx)
+{
+	return __bch2_readdir(c, inum, hash_info, ctx, NULL);
+}
+
 /* fsck */
 
 static int lookup_first_inode(struct btree_trans *trans, u64 inode_nr,
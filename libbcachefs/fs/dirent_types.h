@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_FS_DIRENT_TYPES_H
+#define _BCACHEFS_FS_DIRENT_TYPES_H
+
+#include "snapshots/types.h"
+#include "util/darray.h"
+
+#define BCH_READDIR_CACHE_NR		8
+
+struct readdir_ent {
+	/* sort key: inode number of the target */
+	u64			inum;
+	u64			offset;
+	u32			target_subvol;
+	/* offset of the dirent in readdir_pass.keys, in u64s */
+	u32			key;
+};
+
+DEFINE_DARRAY_NAMED(darray_readdir_ent, struct readdir_ent);
+
+/*
+ * readdir_inode_order: one pass over a window of a directory, sorted by inode
+ * number, and how far we've got through it; kept between readdir calls, keyed
+ * by the cookie the next call will resume from:
+ */
+struct readdir_pass {
+	subvol_inum		dir;
+	u64			pos;
+	unsigned long		last_used;
+
+	u64			window;
+	/* last entry returned, if any, in this window */
+	struct readdir_ent	after;
+	bool			have_after;
+	/* window may have more entries after this pass */
+	bool			more;
+
+	size_t			idx;
+	darray_readdir_ent	ents;
+	darray_u64		keys;
+};
+
+struct bch_fs_readdir_cache {
+	struct mutex		lock;
+	struct readdir_pass	p[BCH_READDIR_CACHE_NR];
+};
+
+#endif /* _BCACHEFS_FS_DIRENT_TYPES_H */
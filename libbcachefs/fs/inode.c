@@ -29,6 +29,7 @@
 #include "util/varint.h"
 
 #include <linux/random.h>
+#include <linux/sort.h>
 #include <linux/unaligned.h>
 
 #define x(name, ...)	#name,
@@ -401,6 +402,80 @@ int bch2_inode_find_by_inum(struct bch_fs *c, subvol_inum inum,
 	return lockrestart_do(trans, bch2_inode_find_by_inum_trans(trans, inum, inode));
 }
 
+struct inode_find_batch_ent {
+	u32		subvol;
+	u64		inum;
+	unsigned	idx;
+};
+
+static int inode_find_batch_cmp(const void *_l, const void *_r)
+{
+	const struct inode_find_batch_ent *l = _l, *r = _r;
+
+	return cmp_int(l->subvol, r->subvol) ?: cmp_int(l->inum, r->inum);
+}
+
+static int inode_find_batch_one(struct btree_iter *iter, u64 inum,
+				struct bch_inode_unpacked *inode)
+{
+	bch2_btree_iter_set_pos(iter, POS(0, inum));
+	struct bkey_s_c k = bkey_try(bch2_btree_iter_peek_slot(iter));
+
+	return bkey_is_inode(k.k)
+		? bch2_inode_unpack(k, inode)
+		: -BCH_ERR_ENOENT_inode;
+}
+
+/*
+ * Look up a batch of inodes - e.g. everything readdir just returned: dirents
+ * are in hash order, so looking those up one at a time is a random btree
+ * lookup each. Sorted, they're a single forward pass over the inodes btree
+ * with one iterator, mostly staying on the leaf we're already on.
+ *
+ * @ret[i] is set to the result for @inums[i] (0, or e.g. ENOENT_inode); the
+ * return value is only for errors that aren't specific to one inode.
+ */
+int bch2_inode_find_by_inums(struct bch_fs *c, const subvol_inum *inums, unsigned nr,
+			     struct bch_inode_unpacked *inodes, int *ret)
+{
+	struct inode_find_batch_ent *sorted __free(kvfree) =
+		kvmalloc_array(nr, sizeof(*sorted), GFP_KERNEL);
+	if (!sorted)
+		return bch_err_throw(c, ENOMEM_inode_find_batch);
+
+	for (unsigned i = 0; i < nr; i++)
+		sorted[i] = (struct inode_find_batch_ent) {
+			.subvol	= inums[i].subvol,
+			.inum	= inums[i].inum,
+			.idx	= i,
+		};
+
+	sort(sorted, nr, sizeof(sorted[0]), inode_find_batch_cmp, NULL);
+
+	CLASS(btree_trans, trans)(c);
+	CLASS(btree_iter, iter)(trans, BTREE_ID_inodes, POS_MIN,
+				nr > 1 ? BTREE_ITER_prefetch : 0);
+	u32 snapshot = 0;
+	int snapshot_ret = 0;
+
+	for (unsigned i = 0; i < nr; i++) {
+		struct inode_find_batch_ent *e = sorted + i;
+
+		if (!i || e->subvol != e[-1].subvol) {
+			snapshot_ret = lockrestart_do(trans,
+				bch2_subvolume_get_snapshot(trans, e->subvol, &snapshot));
+			if (!snapshot_ret)
+				bch2_btree_iter_set_snapshot(&iter, snapshot);
+		}
+
+		ret[e->idx] = snapshot_ret ?:
+			lockrestart_do(trans,
+				inode_find_batch_one(&iter, e->inum, inodes + e->idx));
+	}
+
+	return 0;
+}
+
 int bch2_inode_find_oldest_snapshot(struct btree_trans *trans, u64 inum, u32 snapshot,
 				    struct bch_inode_unpacked *root)
 {
@@ -940,14 +1015,128 @@ bch2_inode_alloc_cursor_get(struct btree_trans *trans, u64 cpu, u64 *min, u64 *m
 	return cursor;
 }
 
+/*
+ * Advance *pos to the first inode number below @max that's free in @snapshot;
+ * *pos == @max if there wasn't one:
+ */
+static int inode_find_empty_slot(struct btree_trans *trans, struct btree_iter *iter,
+				 u32 snapshot, u64 *pos, u64 max, u64 *gen)
+{
+	struct bkey_s_c k;
+
+	bch2_btree_iter_set_pos(iter, POS(0, *pos));
+
+	while ((k = bkey_try(bch2_btree_iter_peek(iter))).k &&
+	       bkey_lt(k.k->p, POS(0, max))) {
+
+		if (*pos < iter->pos.offset)
+			return 0;
+
+		if (bch2_snapshot_is_ancestor(trans, snapshot, k.k->p.snapshot) &&
+		    k.k->type == KEY_TYPE_inode_generation) {
+			*pos = k.k->p.offset;
+			*gen = le32_to_cpu(bkey_s_c_to_inode_generation(k).v->bi_generation);
+			return 0;
+		}
+
+		/*
+		 * We don't need to iterate over keys in every snapshot once
+		 * we've found just one:
+		 */
+		*pos = iter->pos.offset + 1;
+		bch2_btree_iter_set_pos(iter, POS(0, *pos));
+	}
+
+	*pos = min(*pos, max);
+	return 0;
+}
+
+static int inode_create_at(struct btree_trans *trans, struct btree_iter *iter,
+			   struct bch_inode_unpacked *inode_u,
+			   u32 snapshot, u64 pos, u64 gen)
+{
+	bch2_btree_iter_set_pos(iter, SPOS(0, pos, snapshot));
+	struct bkey_s_c k = bkey_try(bch2_btree_iter_peek_slot(iter));
+
+	inode_u->bi_inum	= k.k->p.offset;
+	inode_u->bi_generation	= max(inode_u->bi_generation, gen);
+	return 0;
+}
+
+static struct inode_dir_reservation *
+inode_dir_reservation(struct bch_fs *c, u64 dir)
+{
+	return &c->inode_alloc.dir[hash_64(dir, BCH_INODE_DIR_RESERVE_BITS)];
+}
+
+/*
+ * inode_alloc_policy=dir: allocate from the range last reserved for @dir, so
+ * that inodes created in the same directory are adjacent in the inodes btree
+ * (and their extents and dirents are clustered by inode number, too).
+ *
+ * A reservation is carved out of whichever CPU's range the directory's first
+ * new inode came from, and used from any CPU after that. Reservations only
+ * live in memory, and numbers in a reservation that's lost or evicted are just
+ * skipped: we always check that the slot is actually free, since a CPU cursor
+ * can wrap around into a reserved range.
+ */
+static int inode_create_dir_reserved(struct btree_trans *trans, struct btree_iter *iter,
+				     struct bch_inode_unpacked *inode_u,
+				     u32 snapshot, u64 dir, bool *found)
+{
+	struct bch_fs *c = trans->c;
+	struct inode_dir_reservation *r = inode_dir_reservation(c, dir);
+	u64 pos, end, gen = 0;
+
+	scoped_guard(spinlock, &c->inode_alloc.lock) {
+		if (r->dir != dir)
+			return 0;
+		pos	= r->next;
+		end	= r->end;
+	}
+
+	if (pos >= end)
+		return 0;
+
+	try(inode_find_empty_slot(trans, iter, snapshot, &pos, end, &gen));
+
+	scoped_guard(spinlock, &c->inode_alloc.lock)
+		if (r->dir == dir) {
+			r->next = pos + 1;
+			/* Exhausted, take a new range from the cursor: */
+			if (pos == end)
+				r->dir = 0;
+		}
+
+	if (pos == end)
+		return 0;
+
+	*found = true;
+	return inode_create_at(trans, iter, inode_u, snapshot, pos, gen);
+}
+
+static void inode_dir_reserve(struct bch_fs *c, u64 dir, u64 start, u64 end)
+{
+	struct inode_dir_reservation *r = inode_dir_reservation(c, dir);
+
+	guard(spinlock)(&c->inode_alloc.lock);
+	r->dir	= dir;
+	r->next	= start;
+	r->end	= end;
+}
+
 /*
  * This just finds an empty slot:
+ *
+ * @dir is the directory the new inode is being created in, or 0 if it
+ * shouldn't be placed near its siblings.
  */
 int bch2_inode_create(struct btree_trans *trans,
 		      struct btree_iter *iter,
 		      struct bch_inode_unpacked *inode_u,
-		      u32 snapshot, u64 cpu, bool is_32bit)
+		      u32 snapshot, u64 cpu, u64 dir, bool is_32bit)
 {
+	struct bch_fs *c = trans->c;
 	u64 min, max;
 	struct bkey_i_inode_alloc_cursor *cursor =
 		errptr_try(bch2_inode_alloc_cursor_get(trans, cpu, &min, &max, is_32bit));
@@ -956,49 +1145,50 @@ int bch2_inode_create(struct btree_trans *trans,
 	u64 pos = start;
 	u64 gen = 0;
 
+	/* 32 bit inode numbers are too scarce to reserve ranges of: */
+	bool dir_affine = dir && !is_32bit &&
+		c->opts.inode_alloc_policy == BCH_INODE_ALLOC_dir;
+
+	inode_u->bi_generation = le32_to_cpu(cursor->v.gen);
+
 	bch2_trans_iter_init(trans, iter, BTREE_ID_inodes, POS(0, pos),
 			     BTREE_ITER_all_snapshots|
 			     BTREE_ITER_intent);
-	while (1) {
-		struct bkey_s_c k;
-		while ((k = bkey_try(bch2_btree_iter_peek(iter))).k &&
-		       bkey_lt(k.k->p, POS(0, max))) {
 
-			if (pos < iter->pos.offset)
-				break;
+	if (dir_affine) {
+		bool found = false;
 
-			if (bch2_snapshot_is_ancestor(trans, snapshot, k.k->p.snapshot) &&
-			    k.k->type == KEY_TYPE_inode_generation) {
-				pos = k.k->p.offset;
-				gen = le32_to_cpu(bkey_s_c_to_inode_generation(k).v->bi_generation);
-				break;
-			}
+		try(inode_create_dir_reserved(trans, iter, inode_u, snapshot, dir, &found));
+		if (found)
+			return 0;
+	}
 
-			/*
-			 * We don't need to iterate over keys in every snapshot once
-			 * we've found just one:
-			 */
-			pos = iter->pos.offset + 1;
-			bch2_btree_iter_set_pos(iter, POS(0, pos));
-		}
+	while (1) {
+		try(inode_find_empty_slot(trans, iter, snapshot, &pos, max, &gen));
 
 		if (likely(pos < max)) {
-			bch2_btree_iter_set_pos(iter, SPOS(0, pos, snapshot));
-			k = bkey_try(bch2_btree_iter_peek_slot(iter));
+			try(inode_create_at(trans, iter, inode_u, snapshot, pos, gen));
+
+			u64 next = inode_u->bi_inum + 1;
+
+			if (dir_affine) {
+				u64 end = min(next + BCH_INODE_DIR_RESERVE_NR, max);
+
+				inode_dir_reserve(c, dir, next, end);
+				next = end;
+			}
 
-			inode_u->bi_inum	= k.k->p.offset;
-			inode_u->bi_generation	= max(gen, le64_to_cpu(cursor->v.gen));
-			cursor->v.idx		= cpu_to_le64(k.k->p.offset + 1);
+			cursor->v.idx = cpu_to_le64(next);
 			return 0;
 		}
 
 		if (start == min)
-			return bch_err_throw(trans->c, ENOSPC_inode_create);
+			return bch_err_throw(c, ENOSPC_inode_create);
 
 		/* Retry from start */
 		pos = start = min;
-		bch2_btree_iter_set_pos(iter, POS(0, pos));
 		le32_add_cpu(&cursor->v.gen, 1);
+		inode_u->bi_generation = le32_to_cpu(cursor->v.gen);
 	}
 }
 
@@ -148,6 +148,8 @@ static inline int bch2_inode_find_by_inum_nowarn_trans(struct btree_trans *trans
 
 int bch2_inode_find_by_inum(struct bch_fs *, subvol_inum,
 			    struct bch_inode_unpacked *);
+int bch2_inode_find_by_inums(struct bch_fs *, const subvol_inum *, unsigned,
+			     struct bch_inode_unpacked *, int *);
 
 int bch2_inode_find_oldest_snapshot(struct btree_trans *trans, u64 inum, u32 snapshot,
 				    struct bch_inode_unpacked *root);
@@ -175,7 +177,7 @@ void bch2_inode_init(struct bch_fs *, struct bch_inode_unpacked *,
 		     struct bch_inode_unpacked *);
 
 int bch2_inode_create(struct btree_trans *, struct btree_iter *,
-		      struct bch_inode_unpacked *, u32, u64, bool);
+		      struct bch_inode_unpacked *, u32, u64, u64, bool);
 
 int bch2_inode_rm(struct bch_fs *, subvol_inum);
 
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_FS_INODE_TYPES_H
+#define _BCACHEFS_FS_INODE_TYPES_H
+
+#define BCH_INODE_DIR_RESERVE_BITS	6
+#define BCH_INODE_DIR_RESERVE_NR	64
+
+/*
+ * Inode number ranges set aside for new inodes in a given directory, for
+ * inode_alloc_policy=dir; hashed by directory inode number, and a collision
+ * just evicts the old reservation:
+ */
+struct inode_dir_reservation {
+	u64			dir;
+	u64			next;
+	u64			end;
+};
+
+struct bch_fs_inode_alloc {
+	spinlock_t		lock;
+	struct inode_dir_reservation
+				dir[1U << BCH_INODE_DIR_RESERVE_BITS];
+};
+
+#endif /* _BCACHEFS_FS_INODE_TYPES_H */
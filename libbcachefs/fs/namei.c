@@ -62,6 +62,7 @@ int bch2_create_trans(struct btree_trans *trans,
 			new_inode->bi_flags |= BCH_INODE_unlinked;
 
 		try(bch2_inode_create(trans, &inode_iter, new_inode, snapshot, cpu,
+				      dir_u->bi_inum,
 				      inode_opt_get(c, dir_u, inodes_32bit)));
 
 		snapshot_src = (subvol_inum) { 0 };
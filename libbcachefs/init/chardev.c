@@ -8,6 +8,7 @@
 #include "alloc/buckets.h"
 #include "alloc/replicas.h"
 
+#include "data/compress_dict.h"
 #include "data/move.h"
 
 #include "fs/check.h"
@@ -670,6 +671,27 @@ static long bch2_ioctl_disk_resize_journal_v2(struct bch_fs *c,
 	return bch2_copy_ioctl_err_msg(&arg.err, &err, ret);
 }
 
+static long bch2_ioctl_compression_dict_add(struct bch_fs *c,
+				struct bch_ioctl_compression_dict arg)
+{
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (arg.flags)
+		return bch_err_throw(c, EINVAL_ioctl_compression_dict_bad_flags);
+
+	if (arg.len < 8 || arg.len > BCH_COMPRESS_DICT_MAX_BYTES)
+		return bch_err_throw(c, EINVAL_compression_dict_bad);
+
+	void *dict __free(kvfree) = kvmalloc(arg.len, GFP_KERNEL);
+	if (!dict)
+		return -ENOMEM;
+
+	try(copy_from_user_errcode(dict, (void __user *)(unsigned long) arg.dict, arg.len));
+
+	return bch2_compress_dict_add(c, dict, arg.len);
+}
+
 #define BCH_IOCTL(_name, _argtype)					\
 do {									\
 	_argtype i;							\
@@ -734,6 +756,8 @@ long bch2_fs_ioctl(struct bch_fs *c, unsigned cmd, void __user *arg)
 		BCH_IOCTL(disk_resize_journal_v2, struct bch_ioctl_disk_resize_journal_v2);
 	case BCH_IOCTL_FSCK_ONLINE:
 		BCH_IOCTL(fsck_online, struct bch_ioctl_fsck_online);
+	case BCH_IOCTL_COMPRESSION_DICT_ADD:
+		BCH_IOCTL(compression_dict_add, struct bch_ioctl_compression_dict);
 	case BCH_IOCTL_QUERY_ACCOUNTING:
 		return bch2_ioctl_query_accounting(c, arg);
 	case BCH_IOCTL_QUERY_COUNTERS:
@@ -42,6 +42,7 @@
 #include "debug/sysfs.h"
 
 #include "fs/check.h"
+#include "fs/dirent.h"
 #include "fs/inode.h"
 #include "fs/quota.h"
 
@@ -651,6 +652,7 @@ static void __bch2_fs_free(struct bch_fs *c)
 	bch2_free_pending_node_rewrites(c);
 	bch2_free_fsck_errs(c);
 	bch2_fs_vfs_exit(c);
+	bch2_fs_readdir_cache_exit(c);
 	bch2_fs_snapshots_exit(c);
 	bch2_fs_replicas_exit(c);
 	bch2_fs_reconcile_exit(c);
@@ -732,8 +734,10 @@ int bch2_fs_stop(struct bch_fs *c)
 		kobject_put(&c->time_stats_json);
 		kobject_put(&c->time_stats);
 		kobject_put(&c->opts_dir);
-		if (c->internal.state_in_sysfs)
+		if (c->internal.state_in_sysfs) {
 			sysfs_remove_bin_file(&c->internal, &bin_attr_btree_trans_stats_json);
+			sysfs_remove_bin_file(&c->internal, &bin_attr_trans_restart_profile_json);
+		}
 		kobject_put(&c->internal);
 
 		/* btree prefetch might have kicked off reads in the background: */
@@ -810,7 +814,8 @@ static int bch2_fs_online(struct bch_fs *c)
 #endif
 	    kobject_add(&c->counters_kobj, &c->kobj, "counters") ?:
 	    bch2_opts_create_sysfs_files(&c->opts_dir, OPT_FS) ?:
-	    sysfs_create_bin_file(&c->internal, &bin_attr_btree_trans_stats_json))
+	    sysfs_create_bin_file(&c->internal, &bin_attr_btree_trans_stats_json) ?:
+	    sysfs_create_bin_file(&c->internal, &bin_attr_trans_restart_profile_json))
 		return bch_err_throw(c, sysfs_init_error);
 
 	guard(rwsem_write)(&c->state_lock);
@@ -1168,6 +1173,8 @@ static int bch2_fs_init(struct bch_fs *c, struct bch_sb *sb,
 	mutex_init(&c->bio_bounce_pages_lock);
 
 	spin_lock_init(&c->write_error_lock);
+	spin_lock_init(&c->inode_alloc.lock);
+	mutex_init(&c->readdir_cache.lock);
 
 	INIT_LIST_HEAD(&c->journal_iters);
 
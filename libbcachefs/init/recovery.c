@@ -381,6 +381,171 @@ static int journal_sort_seq_cmp(const void *_l, const void *_r)
 
 DEFINE_DARRAY_NAMED(darray_journal_keys, struct journal_key *)
 
+/*
+ * The first, sorted replay pass commits keys that go in the same leaf
+ * together, and replays each btree on its own transaction in parallel: triggers
+ * don't run here, so updates to different btrees don't depend on each other.
+ * Levels are still replayed from the root down.
+ */
+#define JOURNAL_REPLAY_BATCH_MAX	64
+
+static bool journal_replay_key_batchable(struct journal_key *k)
+{
+	/* alloc keys go through the key cache, allocated keys need a journal res: */
+	return !k->level && !k->allocated && k->btree_id != BTREE_ID_alloc;
+}
+
+/* Replay @k and the keys after it that go in the same leaf: */
+static int bch2_journal_replay_batch(struct btree_trans *trans,
+				     struct journal_key *k, struct journal_key *end,
+				     size_t *nr)
+{
+	struct bch_fs *c = trans->c;
+
+	*nr = 1;
+	if (!journal_replay_key_batchable(k))
+		return bch2_journal_replay_key(trans, k);
+
+	CLASS(btree_node_iter, iter)(trans, k->btree_id, journal_key_k(c, k)->k.p,
+				     BTREE_MAX_DEPTH, 0,
+				     BTREE_ITER_intent|BTREE_ITER_not_extents);
+	try(bch2_btree_iter_traverse(&iter));
+
+	struct btree *b = btree_path_node(btree_iter_path(trans, &iter), 0);
+	if (!b)
+		return bch2_journal_replay_key(trans, k);
+
+	struct bpos node_end = b->key.k.p;
+	u64 seq = U64_MAX;
+	struct journal_key *i;
+
+	for (i = k;
+	     i < end &&
+	     i - k < JOURNAL_REPLAY_BATCH_MAX &&
+	     i->btree_id == k->btree_id &&
+	     journal_replay_key_batchable(i) &&
+	     bpos_le(journal_key_k(c, i)->k.p, node_end);
+	     i++) {
+		try(bch2_journal_replay_key(trans, i));
+		seq = min(seq, c->journal_entries_base_seq + i->journal_seq_offset);
+	}
+
+	/* The leaf gets pinned by the oldest entry it now has keys from: */
+	trans->journal_res.seq = seq;
+	*nr = i - k;
+	return 0;
+}
+
+struct journal_replay_job {
+	struct closure		cl;
+	struct bch_fs		*c;
+	struct journal_key	*start;
+	struct journal_key	*end;
+	darray_journal_keys	failed;
+	bool			immediate_flush;
+	int			ret;
+};
+
+static int journal_replay_sorted(struct journal_replay_job *job)
+{
+	struct bch_fs *c = job->c;
+	struct journal_key *k = job->start;
+	CLASS(btree_trans, trans)(c);
+
+	while (k < job->end) {
+		cond_resched();
+
+		/*
+		 * k->allocated means the key wasn't read in from the journal,
+		 * rather it was from early repair code
+		 */
+		if (k->allocated)
+			job->immediate_flush = true;
+
+		size_t nr = 1;
+
+		/* Skip fastpath if we're low on space in the journal */
+		int ret = c->journal.watermark ? -1 :
+			commit_do(trans, NULL, NULL,
+				  BCH_TRANS_COMMIT_journal_replay|
+				  BCH_TRANS_COMMIT_no_enospc|
+				  BCH_TRANS_COMMIT_no_skip_noops|
+				  BCH_TRANS_COMMIT_journal_reclaim|
+				  BCH_TRANS_COMMIT_skip_accounting_apply|
+				  (!k->allocated ? BCH_TRANS_COMMIT_no_journal_res : 0),
+			     bch2_journal_replay_batch(trans, k, job->end, &nr));
+		if (ret)
+			for (size_t i = 0; i < nr; i++)
+				try(darray_push(&job->failed, k + i));
+		k += nr;
+	}
+
+	return 0;
+}
+
+static CLOSURE_CALLBACK(journal_replay_sorted_work)
+{
+	closure_type(job, struct journal_replay_job, cl);
+
+	job->ret = journal_replay_sorted(job);
+	closure_return(cl);
+}
+
+/*
+ * Replay keys in sorted order, one level at a time: keys that can't be
+ * replayed here (because that would cause a journal deadlock) are returned in
+ * @failed, for replaying in journal order
+ */
+static int bch2_journal_replay_sorted(struct bch_fs *c, darray_journal_keys *failed,
+				      bool *immediate_flush)
+{
+	struct journal_keys *keys = &c->journal_keys;
+	struct journal_key *k = keys->data, *end = keys->data + keys->nr;
+
+	while (k < end) {
+		struct journal_key *level_end = k;
+		unsigned nr_jobs = 0;
+
+		for (; level_end < end && level_end->level == k->level; level_end++)
+			if (level_end == k || level_end->btree_id != level_end[-1].btree_id)
+				nr_jobs++;
+
+		struct journal_replay_job *jobs __free(kfree) =
+			kcalloc(nr_jobs, sizeof(*jobs), GFP_KERNEL);
+		if (!jobs)
+			return bch_err_throw(c, ENOMEM_journal_replay);
+
+		CLASS(closure_stack, cl)();
+
+		struct journal_replay_job *job = jobs;
+		for (struct journal_key *i = k; i < level_end; i++)
+			if (i + 1 == level_end || i[1].btree_id != i->btree_id) {
+				job->c		= c;
+				job->start	= k;
+				job->end	= i + 1;
+				k = i + 1;
+				job++;
+			}
+
+		for (job = jobs; job < jobs + nr_jobs; job++)
+			closure_call(&job->cl, journal_replay_sorted_work, system_unbound_wq, &cl);
+		closure_sync_unbounded(&cl);
+
+		int ret = 0;
+		for (job = jobs; job < jobs + nr_jobs; job++) {
+			*immediate_flush |= job->immediate_flush;
+			ret = ret ?: job->ret;
+			darray_for_each(job->failed, i)
+				ret = ret ?: darray_push(failed, *i);
+			darray_exit(&job->failed);
+		}
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 int bch2_journal_replay(struct bch_fs *c)
 {
 	struct journal_keys *keys = &c->journal_keys;
@@ -389,6 +554,8 @@ int bch2_journal_replay(struct bch_fs *c)
 	u64 start_seq	= c->journal_replay_seq_start;
 	u64 end_seq	= c->journal_replay_seq_start;
 	bool immediate_flush = false;
+	size_t nr_keys = keys->nr;
+	u64 start_time = local_clock();
 	int ret = 0;
 
 	BUG_ON(!atomic_read(&keys->ref));
@@ -434,31 +601,9 @@ int bch2_journal_replay(struct bch_fs *c)
 	 * efficient - better locality of btree access -  but some might fail if
 	 * that would cause a journal deadlock.
 	 */
-	darray_for_each(*keys, k) {
-		cond_resched();
-
-		/*
-		 * k->allocated means the key wasn't read in from the journal,
-		 * rather it was from early repair code
-		 */
-		if (k->allocated)
-			immediate_flush = true;
-
-		/* Skip fastpath if we're low on space in the journal */
-		ret = c->journal.watermark ? -1 :
-			commit_do(trans, NULL, NULL,
-				  BCH_TRANS_COMMIT_journal_replay|
-				  BCH_TRANS_COMMIT_no_enospc|
-				  BCH_TRANS_COMMIT_no_skip_noops|
-				  BCH_TRANS_COMMIT_journal_reclaim|
-				  BCH_TRANS_COMMIT_skip_accounting_apply|
-				  (!k->allocated ? BCH_TRANS_COMMIT_no_journal_res : 0),
-			     bch2_journal_replay_key(trans, k));
-		if (ret)
-			try(darray_push(&keys_sorted, k));
-	}
-
 	bch2_trans_unlock_long(trans);
+	try(bch2_journal_replay_sorted(c, &keys_sorted, &immediate_flush));
+
 	/*
 	 * Now, replay any remaining keys in the order in which they appear in
 	 * the journal, unpinning those journal entries as we go:
@@ -512,8 +657,13 @@ int bch2_journal_replay(struct bch_fs *c)
 		ret = bch2_journal_meta(&c->journal);
 	}
 
-	if (keys->nr)
-		bch2_journal_log_msg(c, "journal replay finished");
+	if (nr_keys) {
+		u64 ns = max(local_clock() - start_time, 1ULL);
+
+		bch2_journal_log_msg(c, "journal replay finished: %zu keys in %llu ms, %llu keys/sec",
+				     nr_keys, div_u64(ns, NSEC_PER_MSEC),
+				     div64_u64((u64) nr_keys * NSEC_PER_SEC, ns));
+	}
 	return 0;
 }
 
@@ -337,6 +337,12 @@ static void journal_entry_err_msg(struct printbuf *out,
 ({									\
 	CLASS(printbuf, _buf)();					\
 									\
+	/* Parallel validation: let the serial pass report and repair: */\
+	if (from.flags & BCH_VALIDATE_silent) {				\
+		ret = bch_err_throw(c, fsck_deferred);			\
+		goto fsck_err;						\
+	}								\
+									\
 	journal_entry_err_msg(&_buf, version, jset, entry);		\
 	prt_printf(&_buf, msg, ##__VA_ARGS__);				\
 									\
@@ -1121,22 +1127,86 @@ static int journal_read_buf_realloc(struct bch_fs *c, struct journal_read_buf *b
 	return 0;
 }
 
+typedef struct {
+	unsigned	bucket;
+	u64		seq;
+} journal_bucket_entry;
+
+DEFINE_DARRAY(journal_bucket_entry);
+
+/*
+ * Buckets are read ahead asynchronously, a whole bucket at a time, so that
+ * checksumming, decrypting and adding the entries we've read overlaps with
+ * reading the next buckets:
+ */
+#define JOURNAL_READ_AHEAD_BYTES	(16U << 20)
+#define JOURNAL_READ_AHEAD_MAX		16
+
+struct journal_bucket_read {
+	struct completion	done;
+	struct bio		*bio;
+	unsigned		nr_bvecs;
+	void			*data;
+	u64			submit_time;
+	int			ret;
+};
+
+struct journal_read_ahead {
+	struct bch_dev			*ca;
+	/* NULL: read buckets in order */
+	const journal_bucket_entry	*order;
+	unsigned			nr_buckets;
+	unsigned			nr_issued;
+	unsigned			nr_consumed;
+	unsigned			nr;
+	struct journal_bucket_read	r[JOURNAL_READ_AHEAD_MAX];
+};
+
+static int journal_read_io_done(struct bch_dev *ca, u64 offset, u64 submit_time, int ret)
+{
+	struct bch_fs *c = ca->fs;
+
+	if (!ret && bch2_meta_read_fault("journal"))
+		ret = bch_err_throw(c, EIO_fault_injected);
+
+	bch2_account_io_completion(ca, BCH_MEMBER_ERROR_read, submit_time, !ret);
+
+	if (ret)
+		bch_err_dev_ratelimited(ca,
+			"journal read error: sector %llu", offset);
+	return ret;
+}
+
 static int journal_read_bucket(struct bch_dev *ca,
 			       struct journal_read_buf *buf,
+			       struct journal_bucket_read *r,
 			       struct journal_list *jlist,
 			       unsigned bucket)
 {
 	struct bch_fs *c = ca->fs;
 	struct journal_device *ja = &ca->journal;
 	struct jset *j = NULL;
-	unsigned sectors, sectors_read = 0;
+	unsigned sectors, sectors_read = 0, want = 0;
 	u64 offset = bucket_to_sector(ca, ja->buckets[bucket]),
-	    end = offset + ca->mi.bucket_size;
+	    end = offset + ca->mi.bucket_size, bad_end = 0;
 	bool saw_bad = false, csum_good;
 	int ret = 0;
 
 	pr_debug("reading %u", bucket);
 
+	if (r) {
+		wait_for_completion(&r->done);
+
+		/*
+		 * On a read error, fall back to reading synchronously below, so
+		 * that we only lose the sectors that are actually unreadable:
+		 */
+		if (!journal_read_io_done(ca, offset, r->submit_time, r->ret)) {
+			j		= r->data;
+			sectors_read	= ca->mi.bucket_size;
+		}
+	}
+
 	while (offset < end) {
 		if (!sectors_read) {
 			struct bio *bio;
@@ -1144,6 +1214,13 @@ static int journal_read_bucket(struct bch_dev *ca,
 reread:
 			sectors_read = min_t(unsigned,
 				end - offset, buf->size >> 9);
+			/*
+			 * After a read error, read one entry at a time until
+			 * we're past the failed range:
+			 */
+			if (offset < bad_end)
+				sectors_read = min(sectors_read,
+						   max(want, block_sectors(c)));
 			nr_bvecs = buf_nr_bvecs(buf->data, sectors_read << 9);
 
 			bio = kmalloc(sizeof(struct bio) + sizeof(struct bio_vec) * nr_bvecs, GFP_KERNEL);
@@ -1158,22 +1235,26 @@ reread:
 			ret = submit_bio_wait(bio);
 			kfree(bio);
 
-			if (!ret && bch2_meta_read_fault("journal"))
-				ret = bch_err_throw(c, EIO_fault_injected);
-
-			bch2_account_io_completion(ca, BCH_MEMBER_ERROR_read,
-						   submit_time, !ret);
-
+			ret = journal_read_io_done(ca, offset, submit_time, ret);
 			if (ret) {
-				bch_err_dev_ratelimited(ca,
-					"journal read error: sector %llu", offset);
+				if (offset >= bad_end && sectors_read > block_sectors(c)) {
+					bad_end = offset + sectors_read;
+					goto reread;
+				}
+
 				/*
 				 * We don't error out of the recovery process
 				 * here, since the relevant journal entry may be
 				 * found on a different device, and missing or
-				 * no journal entries will be handled later
+				 * no journal entries will be handled later:
+				 * skip this block and keep reading the rest of
+				 * the bucket
 				 */
-				return 0;
+				ret = 0;
+				saw_bad = true;
+				want = 0;
+				sectors = sectors_read = block_sectors(c);
+				goto next_block;
 			}
 
 			j = buf->data;
@@ -1184,8 +1265,10 @@ reread:
 		switch (ret) {
 		case 0:
 			sectors = vstruct_sectors(j, c->block_bits);
+			want = 0;
 			break;
 		case JOURNAL_ENTRY_REREAD:
+			want = vstruct_sectors(j, c->block_bits);
 			if (vstruct_bytes(j) > buf->size)
 				try(journal_read_buf_realloc(c, buf, vstruct_bytes(j)));
 			goto reread;
@@ -1268,13 +1351,6 @@ next_block:
 	return 0;
 }
 
-typedef struct {
-	unsigned	bucket;
-	u64		seq;
-} journal_bucket_entry;
-
-DEFINE_DARRAY(journal_bucket_entry);
-
 /* Sort by seq descending */
 static int journal_bucket_entry_cmp(const void *_a, const void *_b)
 {
@@ -1327,6 +1403,154 @@ static int journal_peek_bucket(struct bch_dev *ca,
 	return 0;
 }
 
+static void journal_bucket_read_endio(struct bio *bio)
+{
+	struct journal_bucket_read *r = bio->bi_private;
+
+	r->ret = blk_status_to_errno(bio->bi_status);
+	complete(&r->done);
+}
+
+static unsigned journal_read_ahead_bucket(struct journal_read_ahead *ra, unsigned idx)
+{
+	return ra->order ? ra->order[idx].bucket : idx;
+}
+
+static void journal_read_ahead_exit(struct journal_read_ahead *ra)
+{
+	for (unsigned i = ra->nr_consumed; i < ra->nr_issued; i++)
+		wait_for_completion(&ra->r[i % ra->nr].done);
+
+	for (unsigned i = 0; i < ra->nr; i++) {
+		kfree(ra->r[i].bio);
+		kvfree(ra->r[i].data);
+	}
+}
+
+/*
+ * Read-ahead is best effort: if we can't allocate any buffers,
+ * journal_read_bucket() reads synchronously:
+ */
+static void journal_read_ahead_init(struct journal_read_ahead *ra, struct bch_dev *ca,
+				    const journal_bucket_entry *order, unsigned nr_buckets)
+{
+	unsigned bytes = ca->mi.bucket_size << 9;
+	unsigned want = min(clamp(JOURNAL_READ_AHEAD_BYTES / bytes, 1U, JOURNAL_READ_AHEAD_MAX),
+			    nr_buckets);
+
+	memset(ra, 0, sizeof(*ra));
+	ra->ca		= ca;
+	ra->order	= order;
+	ra->nr_buckets	= nr_buckets;
+
+	for (; ra->nr < want; ra->nr++) {
+		struct journal_bucket_read *r = &ra->r[ra->nr];
+
+		r->data = kvmalloc(bytes, GFP_KERNEL);
+		if (!r->data)
+			break;
+
+		r->nr_bvecs = buf_nr_bvecs(r->data, bytes);
+		r->bio = kmalloc(sizeof(struct bio) + sizeof(struct bio_vec) * r->nr_bvecs, GFP_KERNEL);
+		if (!r->bio) {
+			kvfree(r->data);
+			r->data = NULL;
+			break;
+		}
+
+		init_completion(&r->done);
+	}
+}
+
+static struct journal_bucket_read *journal_read_ahead_get(struct journal_read_ahead *ra,
+							  unsigned idx)
+{
+	struct bch_dev *ca = ra->ca;
+	struct journal_device *ja = &ca->journal;
+
+	if (!ra->nr)
+		return NULL;
+
+	/* Bucket @idx - ra->nr has been consumed, so its slot is free: */
+	while (ra->nr_issued < ra->nr_buckets &&
+	       ra->nr_issued < idx + ra->nr) {
+		struct journal_bucket_read *r = &ra->r[ra->nr_issued % ra->nr];
+		unsigned bucket = journal_read_ahead_bucket(ra, ra->nr_issued++);
+
+		reinit_completion(&r->done);
+
+		bio_init(r->bio, ca->disk_sb.bdev, bio_inline_vecs(r->bio), r->nr_bvecs, REQ_OP_READ);
+		r->bio->bi_iter.bi_sector	= bucket_to_sector(ca, ja->buckets[bucket]);
+		r->bio->bi_end_io		= journal_bucket_read_endio;
+		r->bio->bi_private		= r;
+		bch2_bio_map(r->bio, r->data, ca->mi.bucket_size << 9);
+
+		r->submit_time = local_clock();
+		submit_bio(r->bio);
+	}
+
+	ra->nr_consumed = idx + 1;
+	return &ra->r[idx % ra->nr];
+}
+
+/*
+ * Read the buckets in @order, or all buckets in order if NULL. When reading in
+ * @order (newest first), stop once we're past last_seq:
+ */
+static int journal_read_buckets(struct bch_dev *ca,
+				struct journal_read_buf *buf,
+				struct journal_list *jlist,
+				const journal_bucket_entry *order,
+				unsigned nr,
+				unsigned *nr_read,
+				unsigned *last_seq_bucket)
+{
+	struct bch_fs *c = ca->fs;
+	struct journal_device *ja = &ca->journal;
+	struct journal_read_ahead ra;
+	unsigned long next_print = jiffies + HZ * 10;
+	int ret = 0;
+
+	journal_read_ahead_init(&ra, ca, order, nr);
+
+	for (unsigned i = 0; i < nr; i++) {
+		unsigned bucket = journal_read_ahead_bucket(&ra, i);
+		u64 start_time = local_clock();
+
+		ret = journal_read_bucket(ca, buf, journal_read_ahead_get(&ra, i),
+					  jlist, bucket);
+		if (ret)
+			break;
+
+		bch2_time_stats_update(&c->times[BCH_TIME_journal_read_bucket], start_time);
+		(*nr_read)++;
+
+		if (time_after_eq(jiffies, next_print)) {
+			bch_info_dev(ca, "journal read: %u/%u buckets", i + 1, nr);
+			next_print = jiffies + HZ * 10;
+		}
+
+		if (order) {
+			u64 last_seq;
+			scoped_guard(mutex, &jlist->lock)
+				last_seq = jlist->last_seq;
+
+			/*
+			 * Once we've established last_seq and this bucket's
+			 * max seq (now in bucket_seq from the full read) is
+			 * below it, we're done:
+			 */
+			if (last_seq && ja->bucket_seq[bucket] < last_seq)
+				break;
+
+			*last_seq_bucket = bucket;
+		}
+	}
+
+	journal_read_ahead_exit(&ra);
+	return ret;
+}
+
 static CLOSURE_CALLBACK(bch2_journal_read_device)
 {
 	closure_type(ja, struct journal_device, read);
@@ -1386,26 +1610,10 @@ static CLOSURE_CALLBACK(bch2_journal_read_device)
 
 		unsigned last_seq_idx = 0;
 		unsigned nr_read = 0;
-		darray_for_each(order, e) {
-			ret = journal_read_bucket(ca, &buf, jlist, e->bucket);
-			if (ret)
-				goto err;
-			nr_read++;
-
-			u64 last_seq;
-			scoped_guard(mutex, &jlist->lock)
-				last_seq = jlist->last_seq;
-
-			/*
-			 * Once we've established last_seq and this bucket's
-			 * max seq (now in bucket_seq from the full read) is
-			 * below it, we're done:
-			 */
-			if (last_seq && ja->bucket_seq[e->bucket] < last_seq)
-				break;
-
-			last_seq_idx = e->bucket;
-		}
+		ret = journal_read_buckets(ca, &buf, jlist, order.data, order.nr,
+					   &nr_read, &last_seq_idx);
+		if (ret)
+			goto err;
 
 		/*
 		 * Check monotonicity: walk all journal buckets backwards
@@ -1464,9 +1672,11 @@ static CLOSURE_CALLBACK(bch2_journal_read_device)
 
 		goto done;
 	}
-full_read:
-	for (i = 0; i < ja->nr; i++) {
-		ret = journal_read_bucket(ca, &buf, jlist, i);
+full_read: {
+		unsigned nr_read = 0, last_seq_idx = 0;
+
+		ret = journal_read_buckets(ca, &buf, jlist, NULL, ja->nr,
+					   &nr_read, &last_seq_idx);
 		if (ret)
 			goto err;
 	}
@@ -1495,6 +1705,116 @@ err:
 	goto out;
 }
 
+/*
+ * Validating journal entries is CPU bound and each entry is independent, so
+ * for large journals split it up across CPUs.
+ *
+ * Workers validate silently and stop at the first entry that has errors,
+ * without repairing it; entries that weren't validated cleanly are then
+ * validated serially, in order, so fsck errors are reported and repaired
+ * exactly as they would be without the parallel pass. Entries that need bkey
+ * compat conversion are left to the serial pass, since conversion isn't
+ * idempotent.
+ */
+#define JOURNAL_VALIDATE_BATCH		64
+
+struct journal_validate_job {
+	struct closure		cl;
+	struct bch_fs		*c;
+	struct journal_replay	**entries;
+	unsigned		idx;
+	unsigned		nr;
+	/* entries[0..nr_good) validated without errors */
+	unsigned		nr_good;
+	atomic_t		*first_bad;
+};
+
+DEFINE_DARRAY_NAMED(darray_journal_replay_ptr, struct journal_replay *);
+
+static int journal_validate_one(struct bch_fs *c, struct journal_replay *i,
+				enum bch_validate_flags flags)
+{
+	return bch2_jset_validate(c,
+				  bch2_dev_have_ref(c, i->ptrs.data[0].dev),
+				  &i->j,
+				  i->ptrs.data[0].sector,
+				  flags);
+}
+
+static bool journal_validate_silent_ok(struct jset *j)
+{
+	return le32_to_cpu(j->version) >= bcachefs_metadata_version_current &&
+		JSET_BIG_ENDIAN(j) == CPU_BIG_ENDIAN;
+}
+
+static CLOSURE_CALLBACK(journal_validate_work)
+{
+	closure_type(job, struct journal_validate_job, cl);
+
+	for (; job->nr_good < job->nr; job->nr_good++) {
+		struct journal_replay *i = job->entries[job->nr_good];
+
+		/* An earlier job found errors; the serial pass takes over from there: */
+		if (atomic_read(job->first_bad) < job->idx)
+			break;
+
+		if (!journal_validate_silent_ok(&i->j) ||
+		    journal_validate_one(job->c, i, BCH_VALIDATE_silent)) {
+			int old = atomic_read(job->first_bad);
+
+			while (job->idx < old &&
+			       !atomic_try_cmpxchg(job->first_bad, &old, job->idx))
+				;
+			break;
+		}
+	}
+
+	closure_return(cl);
+}
+
+/* Returns the error from the oldest entry that failed, as validating serially would: */
+static int journal_validate_entries(struct bch_fs *c, struct journal_replay **entries, size_t nr)
+{
+	unsigned nr_jobs = min_t(size_t, num_online_cpus(),
+				 DIV_ROUND_UP(nr, JOURNAL_VALIDATE_BATCH));
+	u64 start_time = local_clock();
+	int ret = 0;
+
+	struct journal_validate_job *jobs __free(kfree) = nr_jobs > 1
+		? kcalloc(nr_jobs, sizeof(*jobs), GFP_KERNEL)
+		: NULL;
+
+	if (!jobs) {
+		for (size_t i = 0; i < nr && !ret; i++)
+			ret = journal_validate_one(c, entries[i], READ);
+	} else {
+		CLASS(closure_stack, cl)();
+		size_t per_job = DIV_ROUND_UP(nr, nr_jobs);
+		atomic_t first_bad;
+
+		atomic_set(&first_bad, nr_jobs);
+
+		for (unsigned i = 0; i < nr_jobs; i++) {
+			size_t start = i * per_job;
+
+			jobs[i].c		= c;
+			jobs[i].entries		= entries + start;
+			jobs[i].idx		= i;
+			jobs[i].nr		= start < nr ? min(per_job, nr - start) : 0;
+			jobs[i].first_bad	= &first_bad;
+			closure_call(&jobs[i].cl, journal_validate_work, system_unbound_wq, &cl);
+		}
+		closure_sync_unbounded(&cl);
+
+		for (unsigned i = 0; i < nr_jobs && !ret; i++)
+			for (unsigned j = jobs[i].nr_good; j < jobs[i].nr && !ret; j++)
+				ret = journal_validate_one(c, jobs[i].entries[j], READ);
+	}
+
+	bch2_time_stats_update(&c->times[BCH_TIME_journal_read_validate], start_time);
+	return ret;
+}
+
 noinline_for_stack
 static void bch2_journal_print_checksum_error(struct bch_fs *c, struct journal_replay *j)
 {
@@ -1659,7 +1979,7 @@ int bch2_journal_reread_for_rewind(struct bch_fs *c)
 			if (ja->bucket_seq[i] < need_from)
 				continue;
 
-			ret = journal_read_bucket(ca, &buf, &jlist, i);
+			ret = journal_read_bucket(ca, &buf, NULL, &jlist, i);
 			if (ret)
 				break;
 		}
@@ -1696,6 +2016,7 @@ int bch2_journal_read(struct bch_fs *c, struct journal_start_info *info)
 	struct journal_list jlist;
 	struct journal_replay *i, **_i;
 	struct genradix_iter radix_iter;
+	CLASS(darray_journal_replay_ptr, entries)();
 	bool last_write_torn = false;
 	u64 seq;
 	int ret = 0;
@@ -1849,12 +2170,6 @@ int bch2_journal_read(struct bch_fs *c, struct journal_start_info *info)
 	try(bch2_journal_check_for_missing(c, drop_before, info->replay_end));
 
 	genradix_for_each(&c->journal_entries, radix_iter, _i) {
-		union bch_replicas_padded replicas = {
-			.e.data_type = BCH_DATA_journal,
-			.e.nr_devs = 0,
-			.e.nr_required = 1,
-		};
-
 		i = *_i;
 		if (journal_replay_ignore(i))
 			continue;
@@ -1869,11 +2184,19 @@ int bch2_journal_read(struct bch_fs *c, struct journal_start_info *info)
 				break;
 			}
 
-		try(bch2_jset_validate(c,
-				       bch2_dev_have_ref(c, i->ptrs.data[0].dev),
-				       &i->j,
-				       i->ptrs.data[0].sector,
-				       READ));
+		try(darray_push(&entries, i));
+	}
+
+	try(journal_validate_entries(c, entries.data, entries.nr));
+
+	darray_for_each(entries, _e) {
+		union bch_replicas_padded replicas = {
+			.e.data_type = BCH_DATA_journal,
+			.e.nr_devs = 0,
+			.e.nr_required = 1,
+		};
+
+		i = *_e;
 
 		darray_for_each(i->ptrs, ptr)
 			replicas_entry_add_dev(&replicas.e, ptr->dev);
@@ -163,6 +163,13 @@ union journal_res_state {
 #define JOURNAL_ENTRY_CLOSED_VAL	(JOURNAL_ENTRY_OFFSET_MAX - 1)
 #define JOURNAL_ENTRY_ERROR_VAL		(JOURNAL_ENTRY_OFFSET_MAX)
 
+/*
+ * Journal entries only carry btree roots that changed in that entry; a full
+ * set of roots is written at least this often (in sequence numbers), and
+ * whenever the previous full set is about to fall out of the replay window:
+ */
+#define JOURNAL_BTREE_ROOTS_FULL_INTERVAL	256
+
 struct journal_space {
 	/* Units of 512 bytes sectors: */
 	unsigned	next_entry; /* How big the next journal entry can be */
@@ -293,6 +300,9 @@ struct journal {
 	u64			last_empty_seq;
 	u64			oldest_seq_found_ondisk;
 
+	/* Most recent journal entry that contained every btree root */
+	u64			btree_roots_full_seq;
+
 	/* Oldest journal seq that is safe to rewind to — discards of buckets
 	 * freed at >= this seq have not yet been issued */
 	u64			rewind_seq;
@@ -359,6 +369,7 @@ struct journal {
 
 	u64			nr_flush_writes;
 	u64			nr_noflush_writes;
+	u64			nr_btree_roots_full_writes;
 	u64			entry_bytes_written;
 
 	struct bch2_time_stats	*flush_write_time;
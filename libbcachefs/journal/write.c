@@ -569,6 +569,30 @@ static CLOSURE_CALLBACK(journal_write_preflush)
 	}
 }
 
+/*
+ * Btree roots are delta encoded in the journal: an entry carries the roots
+ * that were updated by transactions in that entry, and only periodically a
+ * full set.
+ *
+ * Recovery applies btree_root entries from every journal entry in the replay
+ * window in order, so the root set can be reconstructed as long as every flush
+ * entry has a full set somewhere in [last_seq, seq] - and empty entries (clean
+ * shutdown) always have seq == last_seq, so they always get a full set.
+ *
+ * Noflush entries are only replayed if a later flush entry makes it, so they
+ * never need a full set.
+ */
+static bool journal_write_needs_all_btree_roots(struct journal *j, struct journal_buf *w)
+{
+	u64 seq = le64_to_cpu(w->data->seq);
+
+	if (JSET_NO_FLUSH(w->data))
+		return false;
+
+	return j->btree_roots_full_seq < w->last_seq ||
+		seq - j->btree_roots_full_seq >= JOURNAL_BTREE_ROOTS_FULL_INTERVAL;
+}
+
 static int bch2_journal_write_prep(struct journal *j, struct journal_buf *w)
 {
 	struct bch_fs *c = container_of(j, struct bch_fs, journal);
@@ -605,10 +629,8 @@ static int bch2_journal_write_prep(struct journal *j, struct journal_buf *w)
 		 * entry gets written we have to propagate them to
 		 * c->btree_roots
 		 *
-		 * But, every journal entry we write has to contain all the
-		 * btree roots (at least for now); so after we copy btree roots
-		 * to c->btree_roots we have to get any missing btree roots and
-		 * add them to this journal entry:
+		 * Btree roots that didn't change aren't rewritten in every
+		 * entry - see journal_write_needs_all_btree_roots():
 		 */
 		switch (i->type) {
 		case BCH_JSET_ENTRY_btree_root:
@@ -651,7 +673,11 @@ static int bch2_journal_write_prep(struct journal *j, struct journal_buf *w)
 
 	start = end = vstruct_last(jset);
 
-	end	= bch2_btree_roots_to_journal_entries(c, end, btree_roots_have);
+	if (journal_write_needs_all_btree_roots(j, w)) {
+		end = bch2_btree_roots_to_journal_entries(c, end, btree_roots_have);
+		j->btree_roots_full_seq = seq;
+		j->nr_btree_roots_full_writes++;
+	}
 
 	struct jset_entry_datetime *d =
 		container_of(jset_entry_init(&end, sizeof(*d)), struct jset_entry_datetime, entry);
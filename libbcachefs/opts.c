@@ -123,6 +123,11 @@ const char * const bch2_scrub_journal_opts[] = {
 	NULL
 };
 
+const char * const bch2_inode_alloc_policies[] = {
+	BCH_INODE_ALLOC_POLICIES()
+	NULL
+};
+
 #undef x
 
 static void prt_str_opt_boundscheck(struct printbuf *out, const char * const opts[],
@@ -610,6 +615,11 @@ int bch2_opt_hook_pre_set(struct bch_fs *c, struct bch_dev *ca, u64 inum, enum b
 	case Opt_background_compression:
 		try(bch2_check_set_has_compressed_data(c, v));
 		break;
+	case Opt_metadata_compression:
+		try(bch2_check_set_has_compressed_data(c, v));
+		if (v)
+			bch2_check_set_feature(c, BCH_FEATURE_btree_node_compression);
+		break;
 	case Opt_erasure_code:
 		if (v)
 			bch2_check_set_feature(c, BCH_FEATURE_ec);
@@ -29,6 +29,7 @@ extern const char * const bch2_member_states[];
 extern const char * const __bch2_reconcile_accounting_types[];
 extern const char * const bch2_d_types[];
 extern const char * const bch2_scrub_journal_opts[];
+extern const char * const bch2_inode_alloc_policies[];
 
 void bch2_prt_jset_entry_type(struct printbuf *,	enum bch_jset_entry_type);
 void bch2_prt_fs_usage_type(struct printbuf *,		enum bch_fs_usage_type);
@@ -132,6 +133,16 @@ enum fsck_err_opts {
 #undef x
 };
 
+#define BCH_INODE_ALLOC_POLICIES()	\
+	x(cpu,	0)			\
+	x(dir,	1)
+
+enum bch_inode_alloc_policy {
+#define x(t, n)	BCH_INODE_ALLOC_##t,
+	BCH_INODE_ALLOC_POLICIES()
+#undef x
+};
+
 #define BCH_OPTS()							\
 	x(block_size,			u16,				\
 	  OPT_FS|OPT_FORMAT|						\
@@ -171,6 +182,13 @@ enum fsck_err_opts {
 	  OPT_UINT(4096, 2U << 20),					\
 	  BCH_SB_ENCODED_EXTENT_MAX_BITS, 256 << 10,			\
 	  "size",	"Maximum size of checksummed/compressed extents")\
+	x(write_encode_depth,		u8,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME,					\
+	  OPT_UINT(0, 64),						\
+	  BCH2_NO_SB_OPT,		8,				\
+	  NULL,		"Max number of extents of a single write that are\n"\
+	  " compressed, checksummed and encrypted in parallel\n"	\
+	  " (0 or 1 = encode on the submitting thread)")		\
 	x(metadata_checksum,		u8,				\
 	  OPT_FS|OPT_FORMAT|OPT_MOUNT_OLD|OPT_RUNTIME,			\
 	  OPT_STR(__bch2_csum_opts),					\
@@ -196,6 +214,24 @@ enum fsck_err_opts {
 	  OPT_FN(bch2_opt_compression),					\
 	  BCH_SB_BACKGROUND_COMPRESSION_TYPE,BCH_COMPRESSION_OPT_none,	\
 	  NULL,		"Compression type for background moves")	\
+	x(metadata_compression,		u8,				\
+	  OPT_FS|OPT_FORMAT|OPT_MOUNT_OLD|OPT_RUNTIME,			\
+	  OPT_FN(bch2_opt_compression),					\
+	  BCH_SB_METADATA_COMPRESSION_TYPE,BCH_COMPRESSION_OPT_none,	\
+	  NULL,		"Compression type for btree node writes")	\
+	x(compression_adaptive,		u8,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME,					\
+	  OPT_BOOL(),							\
+	  BCH2_NO_SB_OPT,		false,				\
+	  NULL,		"Adjust the compression level of each write point\n"\
+	  " to the speed of the devices it writes to, between\n"	\
+	  " compression_level_min and the configured level\n"		\
+	  " (the algorithm's default if none is given)")		\
+	x(compression_level_min,	u8,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME,					\
+	  OPT_UINT(1, 15),						\
+	  BCH2_NO_SB_OPT,		1,				\
+	  NULL,		"Lowest level compression_adaptive will use")	\
 	x(str_hash,			u8,				\
 	  OPT_FS|OPT_FORMAT|OPT_MOUNT|OPT_RUNTIME,			\
 	  OPT_STR(bch2_str_hash_opts),					\
@@ -246,11 +282,32 @@ enum fsck_err_opts {
 	  OPT_UINT(0, 8),						\
 	  BCH_SB_SHARD_INUMS_NBITS,	0,				\
 	  NULL,		"Shard new inode numbers by CPU id")		\
+	x(inode_alloc_policy,		u8,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME,					\
+	  OPT_STR(bch2_inode_alloc_policies),				\
+	  BCH2_NO_SB_OPT,		BCH_INODE_ALLOC_cpu,		\
+	  NULL,		"How new inode numbers are picked:\n"		\
+	  " cpu: from per-CPU ranges\n"					\
+	  " dir: from ranges reserved per parent directory, for locality")\
+	x(readdir_inode_order,		u8,				\
+	  OPT_FS|OPT_MOUNT,						\
+	  OPT_BOOL(),							\
+	  BCH2_NO_SB_OPT,		false,				\
+	  NULL,		"Return directory entries in batches sorted by\n"\
+	  " inode number, for faster readdir + stat; only helps\n"\
+	  " directories with more than ~50k entries")			\
 	x(btree_node_mem_ptr_optimization, u8,				\
 	  OPT_FS|OPT_MOUNT|OPT_RUNTIME|OPT_NODOC,			\
 	  OPT_BOOL(),							\
 	  BCH2_NO_SB_OPT,		true,				\
 	  NULL,		"Stash pointer to in memory btree node in btree ptr")\
+	x(key_cache_admission,		u8,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME,					\
+	  OPT_UINT(0, 15),						\
+	  BCH2_NO_SB_OPT,		2,				\
+	  NULL,		"Recent lookups of an inode or alloc key needed\n"\
+	  " before it is added to the key cache, while the key cache\n"\
+	  " is being shrunk (0 = always add)")				\
 	x(gc_reserve_percent,		u8,				\
 	  OPT_FS|OPT_FORMAT|OPT_MOUNT|OPT_RUNTIME,			\
 	  OPT_UINT(5, 21),						\
@@ -447,6 +504,12 @@ enum fsck_err_opts {
 	  OPT_BOOL(),							\
 	  BCH_SB_JOURNAL_TRANSACTION_NAMES, true,			\
 	  NULL,		"Log transaction function names in journal")	\
+	x(trans_restart_profile,	u32,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME|OPT_NODOC,			\
+	  OPT_UINT(0, U32_MAX),						\
+	  BCH2_NO_SB_OPT,		0,				\
+	  NULL,		"Record one in N transaction restarts in the\n"\
+	  " restart profile (0 = disabled)")				\
 	x(allocator_stuck_timeout,	u16,				\
 	  OPT_FS|OPT_FORMAT|OPT_MOUNT|OPT_RUNTIME|OPT_NODOC,		\
 	  OPT_UINT(0, U16_MAX),						\
@@ -566,6 +629,18 @@ enum fsck_err_opts {
 	  OPT_BOOL(),							\
 	  BCH_MEMBER_DISCARD,		true,				\
 	  NULL,		"Enable discard/TRIM support")			\
+	x(discard_max_size,		u32,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME|OPT_HUMAN_READABLE,		\
+	  OPT_UINT(0, U32_MAX),						\
+	  BCH2_NO_SB_OPT,		64U << 20,			\
+	  "size",	"Maximum size of a discard when merging adjacent"\
+	  " buckets, 0 to discard a bucket at a time")			\
+	x(discard_rate_limit,		u32,				\
+	  OPT_FS|OPT_MOUNT|OPT_RUNTIME|OPT_HUMAN_READABLE,		\
+	  OPT_UINT(0, U32_MAX),						\
+	  BCH2_NO_SB_OPT,		0,				\
+	  "size",	"Maximum discard rate in bytes per second, 0 for"\
+	  " unlimited")							\
 	x(rotational,			u8,				\
 	  OPT_DEVICE|OPT_RUNTIME,					\
 	  OPT_BOOL(),							\
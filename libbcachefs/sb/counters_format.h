@@ -46,6 +46,21 @@ enum bch_counters_flags {
 	  "CRC narrowing failures on read")				\
 	x(data_write,				1,   TYPE_SECTORS,	\
 	  "Sectors written to disk")					\
+	x(data_compress,			133, TYPE_SECTORS,	\
+	  "Sectors passed to the compressor")				\
+	x(data_compress_fail,			134, TYPE_SECTORS,	\
+	  "Sectors the compressor could not shrink")			\
+	x(data_compress_skip_entropy,		135, TYPE_SECTORS,	\
+	  "Sectors not compressed: sampled data looked incompressible")	\
+	x(data_compress_skip_history,		136, TYPE_SECTORS,	\
+	  "Sectors not compressed: recent writes to the inode were "	\
+	  "incompressible")						\
+	x(data_compress_level_up,		137, TYPE_COUNTER,	\
+	  "Adaptive compression: level raised, devices slower than "	\
+	  "the compressor")						\
+	x(data_compress_level_down,		138, TYPE_COUNTER,	\
+	  "Adaptive compression: level lowered, compressor slower "	\
+	  "than the devices")						\
 	x(data_update_pred,			96,  TYPE_SECTORS,	\
 	  "Sectors predicted for data update")				\
 	x(data_update,				2,   TYPE_SECTORS,	\
@@ -129,6 +144,10 @@ enum bch_counters_flags {
 	  "Bucket discards issued")					\
 	x(bucket_discard_fast,			79,  TYPE_COUNTER,	\
 	  "Fast bucket discards issued")				\
+	x(discard_issued,			139, TYPE_COUNTER,	\
+	  "Discards submitted, after merging adjacent buckets")		\
+	x(bucket_discard_merged,		140, TYPE_COUNTER,	\
+	  "Bucket discards merged into the preceding bucket's discard")	\
 	x(bucket_alloc,				5,   TYPE_COUNTER,	\
 	  "Bucket allocations")						\
 	x(bucket_alloc_fail,			6,   TYPE_COUNTER,	\
@@ -6,6 +6,7 @@
 #include "alloc/replicas.h"
 
 #include "data/checksum.h"
+#include "data/compress_dict.h"
 #include "data/extents_sb.h"
 
 #include "journal/journal.h"
@@ -2,6 +2,7 @@
 
 #include <linux/jiffies.h>
 #include <linux/module.h>
+#include <linux/slab.h>
 #include <linux/percpu.h>
 #include <linux/preempt.h>
 #include <linux/time.h>
@@ -88,6 +89,11 @@ static inline void time_stats_update_one(struct bch2_time_stats *stats,
 
 		if (quantiles)
 			quantiles_update(quantiles, duration);
+
+		if (unlikely(!stats->hist))
+			stats->hist = kzalloc(sizeof(*stats->hist), GFP_ATOMIC|__GFP_NOWARN);
+		if (stats->hist)
+			stats->hist->buckets[time_stats_hist_idx(duration)]++;
 	}
 
 	if (stats->last_event && time_after64(end, stats->last_event)) {
@@ -158,6 +164,9 @@ void bch2_time_stats_reset(struct bch2_time_stats *stats)
 	unsigned offset = offsetof(struct bch2_time_stats, min_duration);
 	memset((void *) stats + offset, 0, sizeof(*stats) - offset);
 
+	if (stats->hist)
+		memset(stats->hist, 0, sizeof(*stats->hist));
+
 	if ((unsigned long) stats->buffer > TIME_STATS_NONPCPU) {
 		int cpu;
 		for_each_possible_cpu(cpu)
@@ -166,6 +175,44 @@ void bch2_time_stats_reset(struct bch2_time_stats *stats)
 	spin_unlock_irq(&stats->lock);
 }
 
+/**
+ * bch2_time_stats_percentile - duration at a given percentile
+ *
+ * @stats	- bch2_time_stats to read; percpu buffers must already be flushed
+ * @per_mille	- percentile, in tenths of a percent (e.g. 999 for p99.9)
+ *
+ * Returns the midpoint of the histogram bucket the percentile falls in, clamped
+ * to the min and max durations seen - so accurate to within half a bucket.
+ */
+u64 bch2_time_stats_percentile(struct bch2_time_stats *stats, unsigned per_mille)
+{
+	struct time_stats_hist *hist = stats->hist;
+	u64 nr = 0, seen = 0;
+
+	if (!hist)
+		return 0;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(hist->buckets); i++)
+		nr += hist->buckets[i];
+	if (!nr)
+		return 0;
+
+	u64 want = max_t(u64, div_u64(nr * per_mille + 999, 1000), 1);
+
+	for (unsigned i = 0; i < ARRAY_SIZE(hist->buckets); i++) {
+		seen += hist->buckets[i];
+		if (seen >= want) {
+			u64 start	= time_stats_hist_bucket_start(i);
+			u64 end		= time_stats_hist_bucket_end(i);
+
+			return clamp(start + (end - start) / 2,
+				     stats->min_duration, stats->max_duration);
+		}
+	}
+
+	return stats->max_duration;
+}
+
 #include <linux/seq_buf.h>
 
 static void seq_buf_time_units_aligned(struct seq_buf *out, u64 ns)
@@ -239,6 +286,15 @@ void bch2_time_stats_to_seq_buf(struct seq_buf *out, struct bch2_time_stats *sta
 	seq_buf_time_units_aligned(out, mean_and_variance_weighted_get_stddev(stats->duration_stats_weighted, TIME_STATS_MV_WEIGHT));
 	seq_buf_printf(out, "\n");
 
+	if (stats->hist) {
+#define x(_name, _per_mille)						\
+		seq_buf_printf(out, "  %-25s", #_name ":");		\
+		seq_buf_time_units_aligned(out, bch2_time_stats_percentile(stats, _per_mille));\
+		seq_buf_printf(out, "\n");
+		TIME_STATS_PERCENTILES()
+#undef x
+	}
+
 	seq_buf_printf(out, "time between events\n");
 
 	seq_buf_printf(out, "  min:                     ");
@@ -278,6 +334,29 @@ void bch2_time_stats_to_seq_buf(struct seq_buf *out, struct bch2_time_stats *sta
 	}
 }
 
+/*
+ * Most histogram buckets the JSON output will have: with the rest of the stats
+ * this keeps it well under a page
+ */
+#define TIME_STATS_JSON_HIST_MAX	64
+
+/*
+ * Index of histogram bucket @idx in a histogram with only 2^@bits sub buckets
+ * per power of two - @bits <= TIME_STATS_HIST_SUB_BITS, so every bucket lies
+ * entirely within one coarse bucket:
+ */
+static unsigned time_stats_hist_coarse_idx(unsigned idx, unsigned bits)
+{
+	u64 v = time_stats_hist_bucket_start(idx);
+
+	if (v < (1U << bits))
+		return v;
+
+	unsigned shift = fls64(v) - 1 - bits;
+
+	return ((shift + 1) << bits) + ((v >> shift) & ((1U << bits) - 1));
+}
+
 void bch2_time_stats_to_json(struct seq_buf *out, struct bch2_time_stats *stats,
 		const char *epoch_name, unsigned int flags)
 {
@@ -340,10 +419,67 @@ void bch2_time_stats_to_json(struct seq_buf *out, struct bch2_time_stats *stats,
 	seq_buf_printf(out, "    \"mean\":      %llu,\n", f_mean);
 	seq_buf_printf(out, "    \"stddev\":    %llu\n", f_stddev);
 
+	if (stats->hist) {
+		struct time_stats_hist *hist = stats->hist;
+		unsigned first = 0, last = ARRAY_SIZE(hist->buckets);
+
+		/* close between_ewma_ns but signal more items */
+		seq_buf_printf(out, "  },\n");
+
+		const char *sep = "";
+
+		seq_buf_printf(out, "  \"percentiles_ns\": {\n");
+#define x(_name, _per_mille)						\
+		seq_buf_printf(out, "%s    \"%s\": %llu", sep, #_name,	\
+			       bch2_time_stats_percentile(stats, _per_mille));\
+		sep = ",\n";
+		TIME_STATS_PERCENTILES()
+#undef x
+		seq_buf_printf(out, "\n  },\n");
+
+		/*
+		 * Only the populated range of buckets, and with fewer sub
+		 * buckets per power of two if that's still too wide to fit in
+		 * a sysfs buffer: counts[i] is bucket first + i
+		 */
+		while (first < last && !hist->buckets[first])
+			first++;
+		while (last > first && !hist->buckets[last - 1])
+			--last;
+
+		unsigned bits = TIME_STATS_HIST_SUB_BITS;
+		while (bits &&
+		       last > first &&
+		       time_stats_hist_coarse_idx(last - 1, bits) -
+		       time_stats_hist_coarse_idx(first, bits) >= TIME_STATS_JSON_HIST_MAX)
+			--bits;
+
+		unsigned cur = time_stats_hist_coarse_idx(first, bits);
+		u64 count = 0;
+
+		seq_buf_printf(out, "  \"histogram_ns\": {\n");
+		seq_buf_printf(out, "    \"sub_bucket_bits\": %u,\n", bits);
+		seq_buf_printf(out, "    \"first\":     %u,\n", last > first ? cur : 0);
+		seq_buf_printf(out, "    \"counts\":    [");
+		for (unsigned i = first; i < last; i++) {
+			unsigned idx = time_stats_hist_coarse_idx(i, bits);
+
+			if (idx != cur) {
+				seq_buf_printf(out, "%llu,", count);
+				cur = idx;
+				count = 0;
+			}
+			count += hist->buckets[i];
+		}
+		if (last > first)
+			seq_buf_printf(out, "%llu", count);
+		seq_buf_printf(out, "]\n");
+	}
+
 	if (quantiles) {
 		u64 last_q = 0;
 
-		/* close between_ewma_ns but signal more items */
+		/* close between_ewma_ns or histogram_ns but signal more items */
 		seq_buf_printf(out, "  },\n");
 
 		seq_buf_printf(out, "  \"quantiles_ns\": [\n");
@@ -358,7 +494,7 @@ void bch2_time_stats_to_json(struct seq_buf *out, struct bch2_time_stats *stats,
 		}
 		seq_buf_printf(out, "  ]\n");
 	} else {
-		/* close between_ewma_ns without dumping further */
+		/* close between_ewma_ns or histogram_ns without dumping further */
 		seq_buf_printf(out, "  }\n");
 	}
 
@@ -370,6 +506,9 @@ void bch2_time_stats_exit(struct bch2_time_stats *stats)
 	if ((unsigned long) stats->buffer > TIME_STATS_NONPCPU)
 		free_percpu(stats->buffer);
 	stats->buffer = NULL;
+
+	kfree(stats->hist);
+	stats->hist = NULL;
 }
 
 void bch2_time_stats_init(struct bch2_time_stats *stats)
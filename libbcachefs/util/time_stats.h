@@ -12,6 +12,7 @@
  *  - sum of all event durations
  *  - average event duration, standard and weighted
  *  - standard deviation of event durations, standard and weighted
+ *  - a log-linear histogram of event durations, for percentiles
  * and analagous statistics for the frequency of events
  *
  * We provide both mean and weighted mean (exponentially weighted), and standard
@@ -24,6 +25,7 @@
 #ifndef _BCACHEFS_TIME_STATS_H
 #define _BCACHEFS_TIME_STATS_H
 
+#include <linux/bitops.h>
 #include <linux/sched/clock.h>
 #include <linux/spinlock_types.h>
 #include <linux/string.h>
@@ -59,6 +61,56 @@ struct quantiles {
 	}		entries[NR_QUANTILES];
 };
 
+/*
+ * Log-linear duration histogram: below TIME_STATS_HIST_SUB buckets are one
+ * nanosecond wide, above that each power of two is split into
+ * TIME_STATS_HIST_SUB linear buckets - so a bucket is never wider than 1/8th of
+ * the values it holds. Durations past 2^TIME_STATS_HIST_MAX_BITS ns (~3 days)
+ * land in the last bucket.
+ *
+ * Allocated on the first event, since most time_stats are never hit.
+ */
+#define TIME_STATS_HIST_SUB_BITS	3
+#define TIME_STATS_HIST_SUB		(1U << TIME_STATS_HIST_SUB_BITS)
+#define TIME_STATS_HIST_MAX_BITS	48
+#define TIME_STATS_HIST_NR		((TIME_STATS_HIST_MAX_BITS - TIME_STATS_HIST_SUB_BITS + 1) \
+					 << TIME_STATS_HIST_SUB_BITS)
+
+struct time_stats_hist {
+	u64		buckets[TIME_STATS_HIST_NR];
+};
+
+static inline unsigned time_stats_hist_idx(u64 v)
+{
+	if (v < TIME_STATS_HIST_SUB)
+		return v;
+
+	unsigned shift = fls64(v) - 1 - TIME_STATS_HIST_SUB_BITS;
+	unsigned idx = ((shift + 1) << TIME_STATS_HIST_SUB_BITS) +
+		((v >> shift) & (TIME_STATS_HIST_SUB - 1));
+
+	return min_t(unsigned, idx, TIME_STATS_HIST_NR - 1);
+}
+
+/* smallest duration that maps to bucket @idx: */
+static inline u64 time_stats_hist_bucket_start(unsigned idx)
+{
+	if (idx < TIME_STATS_HIST_SUB)
+		return idx;
+
+	unsigned shift = (idx >> TIME_STATS_HIST_SUB_BITS) - 1;
+
+	return (u64) (TIME_STATS_HIST_SUB + (idx & (TIME_STATS_HIST_SUB - 1))) << shift;
+}
+
+static inline u64 time_stats_hist_bucket_end(unsigned idx)
+{
+	return idx < TIME_STATS_HIST_SUB
+		? idx + 1
+		: time_stats_hist_bucket_start(idx) +
+		  (1ULL << ((idx >> TIME_STATS_HIST_SUB_BITS) - 1));
+}
+
 struct time_stat_buffer {
 	unsigned	nr;
 	struct time_stat_buffer_entry {
@@ -71,6 +123,7 @@ struct bch2_time_stats {
 	spinlock_t	lock;
 	bool		have_quantiles;
 	struct time_stat_buffer __percpu *buffer;
+	struct time_stats_hist	*hist;
 	/* all fields are in nanoseconds */
 	u64             min_duration;
 	u64		max_duration;
@@ -145,6 +198,17 @@ static inline bool track_event_change(struct bch2_time_stats *stats, bool v)
 
 void bch2_time_stats_reset(struct bch2_time_stats *);
 
+/*
+ * Percentiles reported by the text and json output, in tenths of a percent:
+ */
+#define TIME_STATS_PERCENTILES()	\
+	x(p50,		500)		\
+	x(p90,		900)		\
+	x(p99,		990)		\
+	x(p999,		999)
+
+u64 bch2_time_stats_percentile(struct bch2_time_stats *, unsigned);
+
 #define TIME_STATS_PRINT_NO_ZEROES	(1U << 0)	/* print nothing if zero count */
 struct seq_buf;
 void bch2_time_stats_to_seq_buf(struct seq_buf *, struct bch2_time_stats *,
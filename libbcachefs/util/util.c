@@ -423,6 +423,14 @@ void bch2_time_stats_to_text(struct printbuf *out, struct bch2_time_stats *stats
 		prt_tab(out);
 		bch2_pr_time_units_aligned(out, mean_and_variance_weighted_get_stddev(stats->duration_stats_weighted, TIME_STATS_MV_WEIGHT));
 		prt_newline(out);
+
+		if (stats->hist) {
+#define x(_name, _per_mille)						\
+			pr_name_and_units(out, #_name ":",			\
+				bch2_time_stats_percentile(stats, _per_mille));
+			TIME_STATS_PERCENTILES()
+#undef x
+		}
 	}
 
 	prt_printf(out, "time between events\n");
@@ -467,12 +475,28 @@ void bch2_time_stats_to_text(struct printbuf *out, struct bch2_time_stats *stats
 void bch2_time_stats_json_to_text(struct printbuf *out, struct bch2_time_stats *stats,
 				  const char *epoch_name, unsigned int flags)
 {
-	char buf[1024];
-	struct seq_buf seq;
+	/*
+	 * The histogram makes the output size hard to predict: retry with a
+	 * bigger buffer rather than emit truncated (invalid) JSON:
+	 */
+	for (unsigned size = PAGE_SIZE;; size *= 2) {
+		struct seq_buf seq;
+
+		bch2_printbuf_make_room(out, size);
+		if (printbuf_remaining(out) < size) {
+			prt_str(out, "{ \"error\": \"out of memory\" }\n");
+			return;
+		}
+
+		seq_buf_init(&seq, out->buf + out->pos, printbuf_remaining(out));
+		bch2_time_stats_to_json(&seq, stats, epoch_name, flags);
 
-	seq_buf_init(&seq, buf, sizeof(buf));
-	bch2_time_stats_to_json(&seq, stats, epoch_name, flags);
-	prt_bytes(out, buf, seq_buf_used(&seq));
+		if (!seq_buf_has_overflowed(&seq)) {
+			out->pos += seq_buf_used(&seq);
+			printbuf_nul_terminate_reserved(out);
+			return;
+		}
+	}
 }
 
 /* ratelimit: */
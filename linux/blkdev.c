@@ -20,9 +20,20 @@
 #include <linux/completion.h>
 #include <linux/fs.h>
 #include <linux/kthread.h>
+#include <linux/sort.h>
 
 #include "tools-util.h"
 
+#ifndef BLKDISCARD
+#define BLKDISCARD	_IO(0x12, 119)
+#endif
+#ifndef BLKSECDISCARD
+#define BLKSECDISCARD	_IO(0x12, 125)
+#endif
+#ifndef BLKZEROOUT
+#define BLKZEROOUT	_IO(0x12, 127)
+#endif
+
 struct fops {
 	void (*init)(void);
 	void (*cleanup)(void);
@@ -92,6 +103,137 @@ static struct fops *fops = &fops_list[1];
 static io_context_t aio_ctx;
 static atomic_t running_requests;
 
+/*
+ * Discards: BLKDISCARD on block devices, hole punching on files.
+ *
+ * The allocator discards a bucket at a time, and BLKDISCARD is a synchronous
+ * ioctl - so discards are queued to a thread that sorts them and merges
+ * adjacent ranges before issuing them.
+ */
+static int blkdev_discard_range(struct block_device *bdev, enum req_op op,
+				u64 sector, u64 nr_sectors)
+{
+	struct stat statbuf = xfstat(bdev->bd_fd);
+	u64 range[2] = { sector << 9, nr_sectors << 9 };
+	int ret;
+
+	if (S_ISBLK(statbuf.st_mode))
+		ret = ioctl(bdev->bd_fd,
+			    op == REQ_OP_SECURE_ERASE	? BLKSECDISCARD :
+			    op == REQ_OP_WRITE_ZEROES	? BLKZEROOUT : BLKDISCARD,
+			    range);
+	else
+		ret = fallocate(bdev->bd_fd,
+				op == REQ_OP_WRITE_ZEROES
+				? FALLOC_FL_ZERO_RANGE
+				: FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+				range[0], range[1]);
+
+	return ret ? -errno : 0;
+}
+
+static blk_status_t discard_status(enum req_op op, int ret)
+{
+	if (!ret)
+		return BLK_STS_OK;
+
+	if (ret == -EOPNOTSUPP || ret == -ENOTTY)
+		/* Discards are only a hint: */
+		return op == REQ_OP_WRITE_ZEROES ? BLK_STS_NOTSUPP : BLK_STS_OK;
+
+	return BLK_STS_IOERR;
+}
+
+static DEFINE_SPINLOCK(discard_lock);
+static DECLARE_WAIT_QUEUE_HEAD(discard_wait);
+static struct bio_list discard_list;
+static struct task_struct *discard_task;
+
+static int discard_bio_cmp(const void *_l, const void *_r)
+{
+	const struct bio *l = *((const struct bio **) _l);
+	const struct bio *r = *((const struct bio **) _r);
+
+	return  cmp_int(l->bi_bdev,		r->bi_bdev) ?:
+		cmp_int(bio_op(l),		bio_op(r)) ?:
+		cmp_int(l->bi_iter.bi_sector,	r->bi_iter.bi_sector);
+}
+
+static bool discard_bios_contiguous(struct bio *l, struct bio *r)
+{
+	return l->bi_bdev == r->bi_bdev &&
+		bio_op(l) == bio_op(r) &&
+		bio_end_sector(l) == r->bi_iter.bi_sector;
+}
+
+static void discard_bios(struct bio **bios, unsigned nr)
+{
+	sort(bios, nr, sizeof(bios[0]), discard_bio_cmp, NULL);
+
+	for (unsigned i = 0, j; i < nr; i = j) {
+		struct bio *bio = bios[i];
+		u64 end = bio_end_sector(bio);
+
+		for (j = i + 1; j < nr && discard_bios_contiguous(bios[j - 1], bios[j]); j++)
+			end = bio_end_sector(bios[j]);
+
+		int ret = blkdev_discard_range(bio->bi_bdev, bio_op(bio),
+					       bio->bi_iter.bi_sector,
+					       end - bio->bi_iter.bi_sector);
+
+		for (unsigned k = i; k < j; k++) {
+			bios[k]->bi_status = discard_status(bio_op(bio), ret);
+			bio_endio(bios[k]);
+		}
+	}
+}
+
+static int discard_thread(void *arg)
+{
+	while (1) {
+		struct bio_list list;
+		struct bio *bio;
+
+		wait_event(discard_wait, ({
+			guard(spinlock)(&discard_lock);
+			list = discard_list;
+			bio_list_init(&discard_list);
+			!bio_list_empty(&list);
+		}));
+
+		unsigned nr = bio_list_size(&list);
+		struct bio **bios = kmalloc_array(nr, sizeof(*bios), GFP_KERNEL);
+		if (!bios) {
+			/* Unmerged, in submission order: */
+			while ((bio = bio_list_pop(&list)))
+				discard_bios(&bio, 1);
+			continue;
+		}
+
+		nr = 0;
+		while ((bio = bio_list_pop(&list)))
+			bios[nr++] = bio;
+
+		discard_bios(bios, nr);
+		kfree(bios);
+	}
+
+	return 0;
+}
+
+static void discard_submit(struct bio *bio)
+{
+	/* Before blkdev_init(), discards are synchronous: */
+	if (!discard_task) {
+		discard_bios(&bio, 1);
+		return;
+	}
+
+	scoped_guard(spinlock, &discard_lock)
+		bio_list_add(&discard_list, bio);
+	wake_up(&discard_wait);
+}
+
 void generic_make_request(struct bio *bio)
 {
 	struct iovec *iov;
@@ -147,9 +289,9 @@ void generic_make_request(struct bio *bio)
 		bio_endio(bio);
 		break;
 	case REQ_OP_DISCARD:
-		fallocate(bio->bi_bdev->bd_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
-			  bio->bi_iter.bi_sector << 9, bio->bi_iter.bi_size);
-		bio_endio(bio);
+	case REQ_OP_SECURE_ERASE:
+	case REQ_OP_WRITE_ZEROES:
+		discard_submit(bio);
 		break;
 	default:
 		BUG();
@@ -179,15 +321,16 @@ int blkdev_issue_discard(struct block_device *bdev,
 			 sector_t sector, sector_t nr_sects,
 			 gfp_t gfp_mask)
 {
-	return 0;
+	int ret = blkdev_discard_range(bdev, REQ_OP_DISCARD, sector, nr_sects);
+
+	return blk_status_to_errno(discard_status(REQ_OP_DISCARD, ret));
 }
 
 int blkdev_issue_zeroout(struct block_device *bdev,
 			 sector_t sector, sector_t nr_sects,
 			 gfp_t gfp_mask, unsigned flags)
 {
-	/* Not yet implemented: */
-	BUG();
+	return blkdev_discard_range(bdev, REQ_OP_WRITE_ZEROES, sector, nr_sects);
 }
 
 unsigned bdev_logical_block_size(struct block_device *bdev)
@@ -202,6 +345,24 @@ unsigned bdev_logical_block_size(struct block_device *bdev)
 	return blksize;
 }
 
+unsigned bdev_max_discard_sectors(struct block_device *bdev)
+{
+	struct stat statbuf = xfstat(bdev->bd_fd);
+
+	/* Files: hole punching, if the filesystem doesn't support it we ignore the error */
+	if (!S_ISBLK(statbuf.st_mode))
+		return UINT_MAX;
+
+	char *path = mprintf("/sys/dev/block/%u:%u/queue/discard_max_bytes",
+			     major(statbuf.st_rdev),
+			     minor(statbuf.st_rdev));
+	u64 v = !access(path, R_OK)
+		? read_file_u64(AT_FDCWD, path)
+		: 0;
+	free(path);
+	return min_t(u64, v >> 9, UINT_MAX);
+}
+
 bool bdev_nonrot(struct block_device *bdev)
 {
 	struct stat statbuf = xfstat(bdev->bd_fd);
@@ -446,4 +607,8 @@ void blkdev_init(void)
 {
 	fops = fops_list;
 	fops->init();
+
+	struct task_struct *p = kthread_run(discard_thread, NULL, "discard");
+	BUG_ON(IS_ERR(p));
+	discard_task = p;
 }
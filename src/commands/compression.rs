@@ -0,0 +1,204 @@
+use std::ffi::CStr;
+use std::fs::{self, File};
+use std::io::{Read, Seek, SeekFrom};
+use std::os::raw::{c_char, c_uint, c_void};
+use std::path::{Path, PathBuf};
+
+use anyhow::{anyhow, bail, Context, Result};
+use clap::Parser;
+
+use crate::util::fmt_bytes_human;
+use crate::wrappers::handle::BcachefsHandle;
+
+// Must match BCH_ZSTD_DICT_MAGIC/BCH_COMPRESS_DICT_MAX_BYTES in data/compress_dict.h
+const ZSTD_DICT_MAGIC: u32 = 0xEC30A437;
+const DICT_MAX_BYTES: usize = 64 << 10;
+
+// Samples taken from any one file, so that a few large files don't crowd out
+// everything else:
+const SAMPLES_PER_FILE: u64 = 8;
+
+extern "C" {
+    fn ZDICT_trainFromBuffer(
+        dict_buffer: *mut c_void,
+        dict_buffer_capacity: usize,
+        samples_buffer: *const c_void,
+        samples_sizes: *const usize,
+        nb_samples: c_uint,
+    ) -> usize;
+    fn ZDICT_isError(code: usize) -> c_uint;
+    fn ZDICT_getErrorName(code: usize) -> *const c_char;
+}
+
+#[derive(Parser, Debug)]
+#[command(about = "Train a zstd dictionary from existing files",
+          long_about = "Train a zstd dictionary from samples of existing files.\n\n\
+Files are sampled in chunks the size of the extents the dictionary will be used\n\
+for. The dictionary is used by files with compression=zstd_dict (or\n\
+background_compression=zstd_dict) once it's been installed with --install;\n\
+dictionaries can't be removed once installed, and a filesystem can have at\n\
+most 8.")]
+pub struct TrainCli {
+    /// Sample size - the typical extent size of the data to be compressed
+    #[arg(short = 'c', long, default_value = "16384")]
+    chunk_size: usize,
+
+    /// Total amount of data to sample
+    #[arg(short = 's', long, default_value = "16777216")]
+    sample_size: u64,
+
+    /// Dictionary size (max 65536)
+    #[arg(short = 'd', long, default_value = "65536")]
+    dict_size: usize,
+
+    /// Write the dictionary to this file
+    #[arg(short, long)]
+    output: Option<PathBuf>,
+
+    /// Install the dictionary into this filesystem (mount point)
+    #[arg(short, long)]
+    install: Option<PathBuf>,
+
+    /// Files or directories to sample
+    #[arg(required = true)]
+    paths: Vec<PathBuf>,
+}
+
+#[derive(Default)]
+struct Samples {
+    buf:    Vec<u8>,
+    sizes:  Vec<usize>,
+}
+
+impl Samples {
+    fn full(&self, limit: u64) -> bool {
+        self.buf.len() as u64 >= limit
+    }
+
+    fn add_file(&mut self, path: &Path, chunk_size: usize, limit: u64) -> Result<()> {
+        let mut f = File::open(path).with_context(|| format!("opening {}", path.display()))?;
+        let len = f.metadata()?.len();
+        let nr_chunks = len.div_ceil(chunk_size as u64);
+        let nr = nr_chunks.min(SAMPLES_PER_FILE);
+        let mut chunk = vec![0u8; chunk_size];
+
+        for i in 0..nr {
+            if self.full(limit) {
+                break;
+            }
+
+            let offset = (i * nr_chunks / nr) * chunk_size as u64;
+            f.seek(SeekFrom::Start(offset))?;
+
+            let mut n = 0;
+            while n < chunk_size {
+                match f.read(&mut chunk[n..])? {
+                    0 => break,
+                    r => n += r,
+                }
+            }
+
+            if n >= 512 {
+                self.buf.extend_from_slice(&chunk[..n]);
+                self.sizes.push(n);
+            }
+        }
+        Ok(())
+    }
+
+    fn add_path(&mut self, path: &Path, chunk_size: usize, limit: u64) -> Result<()> {
+        if self.full(limit) {
+            return Ok(());
+        }
+
+        let md = fs::symlink_metadata(path)
+            .with_context(|| format!("reading {}", path.display()))?;
+
+        if md.is_file() {
+            if let Err(e) = self.add_file(path, chunk_size, limit) {
+                eprintln!("{:#}", e);
+            }
+        } else if md.is_dir() {
+            let mut entries: Vec<PathBuf> = fs::read_dir(path)
+                .with_context(|| format!("reading {}", path.display()))?
+                .filter_map(|e| e.ok().map(|e| e.path()))
+                .collect();
+            entries.sort();
+
+            for e in entries {
+                self.add_path(&e, chunk_size, limit)?;
+            }
+        }
+        Ok(())
+    }
+}
+
+fn train(samples: &Samples, dict_size: usize) -> Result<Vec<u8>> {
+    let mut dict = vec![0u8; dict_size];
+
+    let ret = unsafe {
+        ZDICT_trainFromBuffer(dict.as_mut_ptr() as *mut c_void, dict.len(),
+                              samples.buf.as_ptr() as *const c_void,
+                              samples.sizes.as_ptr(),
+                              samples.sizes.len() as c_uint)
+    };
+    if unsafe { ZDICT_isError(ret) } != 0 {
+        let err = unsafe { CStr::from_ptr(ZDICT_getErrorName(ret)) };
+        bail!("error training dictionary: {}", err.to_string_lossy());
+    }
+
+    dict.truncate(ret);
+    Ok(dict)
+}
+
+fn cmd_train(cli: TrainCli) -> Result<()> {
+    if cli.output.is_none() && cli.install.is_none() {
+        bail!("nothing to do: specify --output and/or --install");
+    }
+    if cli.dict_size > DICT_MAX_BYTES {
+        bail!("dictionary size {} too big (max {})", cli.dict_size, DICT_MAX_BYTES);
+    }
+    if cli.chunk_size < 512 {
+        bail!("chunk size {} too small", cli.chunk_size);
+    }
+
+    let mut samples = Samples::default();
+    for path in &cli.paths {
+        samples.add_path(path, cli.chunk_size, cli.sample_size)?;
+    }
+
+    if samples.sizes.is_empty() {
+        bail!("no data found to sample");
+    }
+
+    let dict = train(&samples, cli.dict_size)?;
+
+    if dict.len() < 8 || u32::from_le_bytes(dict[0..4].try_into()?) != ZSTD_DICT_MAGIC {
+        bail!("zstd returned a dictionary without a header");
+    }
+    let id = u32::from_le_bytes(dict[4..8].try_into()?);
+
+    println!("trained dictionary {}: {} from {} samples ({})",
+             id, fmt_bytes_human(dict.len() as u64),
+             samples.sizes.len(), fmt_bytes_human(samples.buf.len() as u64));
+
+    if let Some(ref output) = cli.output {
+        fs::write(output, &dict).with_context(|| format!("writing {}", output.display()))?;
+    }
+
+    if let Some(ref fs_path) = cli.install {
+        let handle = BcachefsHandle::open(fs_path)
+            .map_err(|e| anyhow!("opening filesystem '{}': {}", fs_path.display(), e))?;
+        handle.compression_dict_add(&dict)
+            .map_err(|e| anyhow!("installing dictionary: {}", e))?;
+        println!("installed dictionary {} in {}", id, fs_path.display());
+    }
+
+    Ok(())
+}
+
+pub const CMD_TRAIN: super::CmdDef = typed_cmd!("train", "Train a zstd dictionary from existing files", TrainCli, cmd_train);
+pub const CMD: super::CmdDef = super::CmdDef {
+    name: "compression", about: "Manage compression", aliases: &[],
+    kind: super::CmdKind::Group { children: &[&CMD_TRAIN] },
+};
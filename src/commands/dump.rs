@@ -22,6 +22,7 @@ use crate::wrappers::super_io::vstruct_bytes_sb;
 extern "C" {
     fn rust_jset_decrypt(c: *mut c::bch_fs, j: *mut u8) -> i32;
     fn rust_bset_decrypt(c: *mut c::bch_fs, i: *mut u8, offset: u32) -> i32;
+    fn rust_bset_decompress(c: *mut c::bch_fs, i: *mut u8) -> i32;
 }
 
 /// First 8 bytes of the superblock UUID interpreted as a little-endian u64.
@@ -61,6 +62,10 @@ pub struct DumpCli {
     #[arg(long)]
     nojournal: bool,
 
+    /// Store qcow2 clusters deflate compressed
+    #[arg(short = 'z', long)]
+    compress: bool,
+
     /// Open devices without O_EXCL
     #[arg(long)]
     noexcl: bool,
@@ -143,6 +148,7 @@ const BSET_HDR: usize = 24;            // offsetof(bset, _data)
 const BTREE_NODE_KEYS: usize = 136;    // offsetof(btree_node, keys)
 const BNE_KEYS: usize = 16;            // offsetof(btree_node_entry, keys)
 const BKEY_U64S: usize = 5;            // sizeof(bkey) / 8
+const BSET_COMPRESSED: u32 = 1 << 6;   // bset.flags
 
 fn read_le64(buf: &[u8], off: usize) -> u64 {
     u64::from_le_bytes(buf[off..off + 8].try_into().unwrap())
@@ -317,7 +323,7 @@ fn sanitize_btree(fs_raw: *mut c::bch_fs, buf: &mut [u8], sanitize_filenames: bo
     let mut bset_byte_offset: usize = 0;
 
     while pos < buf.len() {
-        let (bset_off, data_off, vstruct_bytes);
+        let (bset_off, data_off, mut vstruct_bytes);
 
         if first {
             if pos + BTREE_NODE_KEYS + BSET_HDR > buf.len() {
@@ -371,6 +377,31 @@ fn sanitize_btree(fs_raw: *mut c::bch_fs, buf: &mut [u8], sanitize_filenames: bo
             modified = true;
         }
 
+        // A compressed bset owns the space its uncompressed keys need:
+        // decompress in place, so the keys can be sanitized
+        if read_le32(buf, bset_off + 16) & BSET_COMPRESSED != 0 {
+            let u64s = read_le16(buf, bset_off + 22) as usize;
+            if u64s == 0 {
+                break;
+            }
+
+            // bset_compressed.u64s
+            let uncompressed_bytes = data_off - pos + read_le16(buf, data_off + 2) as usize * 8;
+            if pos + uncompressed_bytes > buf.len() {
+                break;
+            }
+
+            let ret = unsafe {
+                rust_bset_decompress(fs_raw, buf.as_mut_ptr().add(bset_off))
+            };
+            if ret != 0 {
+                eprintln!("error decompressing btree node: {}", ret);
+                return;
+            }
+            vstruct_bytes = uncompressed_bytes;
+            modified = true;
+        }
+
         // Walk packed keys in bset data region
         let u64s = read_le16(buf, bset_off + 22) as usize;
         let key_end = (data_off + u64s * 8).min(buf.len());
@@ -473,38 +504,56 @@ fn get_sb_journal(fs: &Fs, ca: &c::bch_dev, entire_journal: bool, d: &mut DumpDe
     }
 }
 
+/// The filesystem, shared with the threads that sanitize: decrypting and
+/// decompressing only use its keys and compression workspaces, which are
+/// safe to use concurrently.
+struct SanitizeFs(*mut c::bch_fs);
+
+unsafe impl Sync for SanitizeFs {}
+
+impl SanitizeFs {
+    fn get(&self) -> *mut c::bch_fs {
+        self.0
+    }
+}
+
 fn write_sanitized_ranges(
     img: &mut Qcow2Image,
-    fs_raw: *mut c::bch_fs,
+    fs: &SanitizeFs,
     ranges: &mut Ranges,
     bucket_bytes: u64,
     sanitize_filenames: bool,
     sanitize_fn: fn(*mut c::bch_fs, &mut [u8], bool),
 ) -> Result<()> {
     ranges_sort(ranges);
-    let mut buf = vec![0u8; bucket_bytes as usize];
 
     for r in ranges.iter() {
-        let len = (r.end - r.start) as usize;
-        assert!(len <= bucket_bytes as usize);
-
-        qcow2::pread_exact(img.infd(), &mut buf[..len], r.start)?;
-        sanitize_fn(fs_raw, &mut buf[..len], sanitize_filenames);
-        img.write_buf(&buf[..len], r.start)?;
+        assert!(r.end - r.start <= bucket_bytes);
     }
 
-    Ok(())
+    img.write_ranges_filtered(ranges, &|buf: &mut [u8]| {
+        sanitize_fn(fs.get(), buf, sanitize_filenames)
+    })
+}
+
+/// An online device, to be dumped on its own thread
+struct DumpDevJob {
+    dev_idx:        u32,
+    fd:             i32,
+    bucket_bytes:   u64,
 }
 
 #[allow(clippy::too_many_arguments)]
 fn write_dev_image(
-    fs: &Fs,
-    ca: &c::bch_dev,
+    fs: &SanitizeFs,
+    job: &DumpDevJob,
     path: &str,
     force: bool,
     sanitize: bool,
     sanitize_filenames: bool,
     block_size: u32,
+    compress: bool,
+    threads: usize,
     d: &mut DumpDev,
 ) -> Result<()> {
     let mut open_opts = std::fs::OpenOptions::new();
@@ -518,8 +567,10 @@ fn write_dev_image(
     let outfile = open_opts.open(path)
         .map_err(|e| anyhow!("{}: {}", path, e))?;
 
-    let infd = unsafe { BorrowedFd::borrow_raw((*ca.disk_sb.bdev).bd_fd) };
+    let infd = unsafe { BorrowedFd::borrow_raw(job.fd) };
     let mut img = Qcow2Image::new(infd, outfile.as_fd(), block_size)?;
+    img.set_compress(compress);
+    img.set_threads(threads);
 
     img.write_ranges(&mut d.sb)?;
 
@@ -527,13 +578,12 @@ fn write_dev_image(
         img.write_ranges(&mut d.journal)?;
         img.write_ranges(&mut d.btree)?;
     } else {
-        let bucket_bytes = (ca.mi.bucket_size as u64) << 9;
         write_sanitized_ranges(
-            &mut img, fs.raw, &mut d.journal, bucket_bytes,
+            &mut img, fs, &mut d.journal, job.bucket_bytes,
             sanitize_filenames, sanitize_journal,
         )?;
         write_sanitized_ranges(
-            &mut img, fs.raw, &mut d.btree, bucket_bytes,
+            &mut img, fs, &mut d.btree, job.bucket_bytes,
             sanitize_filenames, sanitize_btree,
         )?;
     }
@@ -555,7 +605,7 @@ fn dump_fs(fs: &Fs, cli: &DumpCli, sanitize: bool, sanitize_filenames: bool) ->
     let btree_node_size = unsafe { (*fs.raw).opts.btree_node_size as u64 };
     let block_size = unsafe { (*fs.raw).opts.block_size as u32 };
 
-    let mut nr_online = 0u32;
+    let mut jobs: Vec<DumpDevJob> = Vec::new();
     let mut bucket_err: Option<String> = None;
     let _ = fs.for_each_online_member(|ca| {
         if sanitize && (ca.mi.bucket_size as u32) % (block_size >> 9) != 0 {
@@ -572,7 +622,11 @@ fn dump_fs(fs: &Fs, cli: &DumpCli, sanitize: bool, sanitize_filenames: bool) ->
         }
 
         get_sb_journal(fs, ca, entire_journal, &mut devs[ca.dev_idx as usize]);
-        nr_online += 1;
+        jobs.push(DumpDevJob {
+            dev_idx:        ca.dev_idx as u32,
+            fd:             unsafe { (*ca.disk_sb.bdev).bd_fd },
+            bucket_bytes:   (ca.mi.bucket_size as u64) << 9,
+        });
         ControlFlow::Continue(())
     });
     if let Some(err) = bucket_err {
@@ -609,30 +663,38 @@ fn dump_fs(fs: &Fs, cli: &DumpCli, sanitize: bool, sanitize_filenames: bool) ->
         }
     }
 
-    // Write qcow2 image(s)
-    let mut write_err: Option<anyhow::Error> = None;
-    let _ = fs.for_each_online_member(|ca| {
-        let dev_idx = ca.dev_idx;
-        let path = if nr_online > 1 {
-            format!("{}.{}.qcow2", cli.output, dev_idx)
-        } else {
-            format!("{}.qcow2", cli.output)
-        };
-
-        match write_dev_image(fs, ca, &path, cli.force, sanitize, sanitize_filenames,
-                              block_size, &mut devs[dev_idx as usize]) {
-            Ok(()) => ControlFlow::Continue(()),
-            Err(e) => {
-                write_err = Some(e);
-                ControlFlow::Break(())
+    // Write qcow2 image(s): devices are read in parallel, and each device's
+    // ranges are read, sanitized and compressed on its share of the threads
+    let nr_online = jobs.len();
+    let threads = (qcow2::default_threads() / nr_online.max(1)).max(1);
+    let sanitize_fs = SanitizeFs(fs.raw);
+    let sanitize_fs = &sanitize_fs;
+
+    std::thread::scope(|scope| {
+        let threads: Vec<_> = devs.iter_mut().enumerate()
+            .filter_map(|(i, d)| jobs.iter().find(|j| j.dev_idx as usize == i).map(|j| (j, d)))
+            .map(|(job, d)| {
+                let path = if nr_online > 1 {
+                    format!("{}.{}.qcow2", cli.output, job.dev_idx)
+                } else {
+                    format!("{}.qcow2", cli.output)
+                };
+
+                scope.spawn(move || write_dev_image(sanitize_fs, job, &path, cli.force,
+                                                    sanitize, sanitize_filenames,
+                                                    block_size, cli.compress, threads, d))
+            })
+            .collect();
+
+        let mut ret = Ok(());
+        for t in threads {
+            let r = t.join().unwrap_or_else(|_| Err(anyhow!("dump thread panicked")));
+            if ret.is_ok() {
+                ret = r;
             }
         }
-    });
-    if let Some(e) = write_err {
-        return Err(e);
-    }
-
-    Ok(())
+        ret
+    })
 }
 
 fn cmd_dump(cli: DumpCli) -> Result<()> {
@@ -62,7 +62,7 @@ fn ensure_thread_init() {
 
 use fuser::{
     Config, FileAttr, FileType, Filesystem, MountOption,
-    ReplyAttr, ReplyCreate, ReplyData, ReplyDirectory, ReplyEmpty,
+    ReplyAttr, ReplyCreate, ReplyData, ReplyDirectory, ReplyDirectoryPlus, ReplyEmpty,
     ReplyEntry, ReplyOpen, ReplyStatfs, ReplyWrite,
     Request, TimeOrNow,
     Errno, FileHandle, FopenFlags, Generation,
@@ -164,8 +164,14 @@ fn ts_to_systime(ts: c::timespec) -> SystemTime {
 }
 
 impl Filesystem for BcachefsFs {
-    fn init(&mut self, _req: &Request, _config: &mut fuser::KernelConfig) -> std::io::Result<()> {
+    fn init(&mut self, _req: &Request, config: &mut fuser::KernelConfig) -> std::io::Result<()> {
         eprintln!("bcachefs fuse: init callback fired");
+
+        // Inodes for a whole readdir batch are looked up in one pass:
+        if config.add_capabilities(fuser::InitFlags::FUSE_DO_READDIRPLUS).is_err() {
+            eprintln!("bcachefs fuse: kernel doesn't support readdirplus");
+        }
+
         // Signal parent that mount is established
         if let Some(fd) = self.signal_fd.take() {
             eprintln!("bcachefs fuse: signaling parent (fd={})", fd);
@@ -740,6 +746,91 @@ impl Filesystem for BcachefsFs {
         }
     }
 
+    fn readdirplus(
+        &self,
+        _req: &Request,
+        ino: INodeNo,
+        _fh: FileHandle,
+        offset: u64,
+        mut reply: ReplyDirectoryPlus,
+    ) {
+        ensure_thread_init();
+        let dir = map_root_ino(ino);
+        eprintln!("fuse_readdirplus(dir={}, offset={})", dir.inum, offset);
+
+        let mut pos = offset;
+
+        // Handle . and .. - the kernel doesn't use their attributes
+        if pos < 2 {
+            let bi = match self.fs().inode_find_by_inum(dir) {
+                Ok(bi) => bi,
+                Err(e) => {
+                    reply.error(bch_err(&e));
+                    return;
+                }
+            };
+            let attr = self.inode_to_attr(&bi);
+            let generation = Generation(bi.bi_generation as u64);
+
+            if pos == 0 {
+                if reply.add(INodeNo(unmap_root_ino(dir.inum)), 1, ".", &TTL, &attr, generation) {
+                    reply.ok();
+                    return;
+                }
+                pos = 1;
+            }
+            if pos == 1 {
+                if reply.add(INodeNo(1), 2, "..", &TTL, &attr, generation) {
+                    reply.ok();
+                    return;
+                }
+                pos = 2;
+            }
+        }
+
+        struct FillCtx<'a> {
+            fs:     &'a BcachefsFs,
+            reply:  &'a mut ReplyDirectoryPlus,
+        }
+
+        // The C shim looks up a batch of entries' inodes at a time, sorted
+        unsafe extern "C" fn filldir(
+            ctx: *mut std::ffi::c_void,
+            name: *const std::ffi::c_char,
+            name_len: std::ffi::c_uint,
+            ino: u64,
+            _dtype: std::ffi::c_uint,
+            pos: u64,
+            bi: *const c::bch_inode_unpacked,
+        ) -> std::ffi::c_int {
+            let ctx = unsafe { &mut *(ctx as *mut FillCtx) };
+            let bi = unsafe { &*bi };
+            let name_bytes = unsafe {
+                std::slice::from_raw_parts(name as *const u8, name_len as usize)
+            };
+            let attr = ctx.fs.inode_to_attr(bi);
+            let full = ctx.reply.add(INodeNo(unmap_root_ino(ino)), pos,
+                                     OsStr::from_bytes(name_bytes), &TTL, &attr,
+                                     Generation(bi.bi_generation as u64));
+            if full { -1 } else { 0 }
+        }
+
+        let mut ctx = FillCtx { fs: self, reply: &mut reply };
+        let ret = unsafe {
+            c::rust_fuse_readdirplus(
+                self.c, dir, pos,
+                &mut ctx as *mut FillCtx as *mut _,
+                Some(filldir),
+            )
+        };
+
+        if ret != 0 {
+            reply.error(err(ret));
+        } else {
+            reply.ok();
+        }
+    }
+
     fn statfs(&self, _req: &Request, _ino: INodeNo, reply: ReplyStatfs) {
         ensure_thread_init();
         eprintln!("fuse_statfs");
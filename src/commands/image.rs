@@ -433,6 +433,7 @@ fn image_create_inner(
     dev_opts: DevOpts,
     src_path: &str,
     keep_alloc: bool,
+    dedup: bool,
     verbosity: u32,
 ) -> Result<()> {
     let src_dir = std::fs::File::open(src_path)?;
@@ -530,6 +531,7 @@ fn image_create_inner(
     let src_cstr = CString::new(src_path)?;
     let mut state = CopyFsState::new_copy();
     state.verbosity = verbosity;
+    state.dedup = dedup;
 
     let src_file = std::fs::File::open(src_path)
         .map_err(|e| anyhow!("error opening {}: {}", src_path, e))?;
@@ -718,6 +720,7 @@ Options:
       --source=path            Source directory (required)
   -a, --keep-alloc             Include allocation info in the filesystem
                                6.16+ regenerates alloc info on first rw mount
+      --dedup                  Store identical file data once, using reflink
 {fs_opts}\
       --replicas=#             Sets both data and metadata replicas
       --encrypted              Enable whole filesystem encryption (chacha20/poly1305)
@@ -749,6 +752,7 @@ fn cmd_image_create(argv: Vec<String>) -> Result<()> {
 
     let mut source: Option<String> = None;
     let mut keep_alloc = false;
+    let mut dedup = false;
     let mut encrypted = false;
     let mut no_passphrase = false;
     let mut passphrase_file: Option<String> = None;
@@ -820,6 +824,7 @@ fn cmd_image_create(argv: Vec<String>) -> Result<()> {
                     source = Some(take_opt_value(inline_val, &argv, &mut i, raw_name)?);
                 }
                 "keep_alloc" => keep_alloc = true,
+                "dedup" => dedup = true,
                 "replicas" => {
                     let val = take_opt_value(inline_val, &argv, &mut i, raw_name)?;
                     let v: u32 = val.parse().map_err(|_| anyhow!("invalid replicas"))?;
@@ -993,6 +998,7 @@ fn cmd_image_create(argv: Vec<String>) -> Result<()> {
         d,
         &source,
         keep_alloc,
+        dedup,
         verbosity,
     );
 
@@ -73,6 +73,7 @@ macro_rules! raw_cmd {
 
 pub mod attr;
 pub mod completions;
+pub mod compression;
 pub mod counters;
 pub mod device;
 pub mod dump;
@@ -100,6 +101,7 @@ pub mod subvolume;
 pub mod super_cmd;
 pub mod timestats;
 pub mod top;
+pub mod trans_profile;
 pub mod fusemount;
 
 // ── Dispatch and help ────────────────────────────────────────────────
@@ -180,7 +182,7 @@ pub fn defers_shrinkers(name: &str) -> bool {
 
 static FS_CMD: CmdDef = CmdDef {
     name: "fs", about: "Manage a running filesystem", aliases: &[],
-    kind: CmdKind::Group { children: &[&fs_usage::CMD, &top::CMD, &timestats::CMD] },
+    kind: CmdKind::Group { children: &[&fs_usage::CMD, &top::CMD, &timestats::CMD, &trans_profile::CMD] },
 };
 
 // ── Version (no module, trivial) ─────────────────────────────────────
@@ -208,7 +210,7 @@ pub const COMMAND_GROUPS: &[GroupDef] = &[
     GroupDef { heading: "Running filesystem",       commands: &[&FS_CMD] },
     GroupDef { heading: "Devices",                  commands: &[&device::CMD] },
     GroupDef { heading: "Subvolumes and snapshots", commands: &[&subvolume::CMD] },
-    GroupDef { heading: "Filesystem data",          commands: &[&reconcile::CMD, &scrub::CMD] },
+    GroupDef { heading: "Filesystem data",          commands: &[&reconcile::CMD, &scrub::CMD, &compression::CMD] },
     GroupDef { heading: "Encryption",               commands: &[&key::CMD_UNLOCK, &key::CMD_SET_PASSPHRASE, &key::CMD_REMOVE_PASSPHRASE] },
     GroupDef { heading: "Migrate",                  commands: &[&migrate::CMD_MIGRATE, &migrate::CMD_MIGRATE_SUPERBLOCK] },
     GroupDef { heading: "File options",             commands: &[&attr::CMD_SETATTR, &attr::CMD_REFLINK_PROPAGATE] },
@@ -15,11 +15,9 @@ use crossterm::{
 use owo_colors::OwoColorize;
 use serde::{Deserialize, Serialize};
 
-use crate::util::run_tui;
+use crate::util::{fmt_duration, run_tui};
 use crate::wrappers::handle::BcachefsHandle;
-use crate::wrappers::sysfs::{dev_name_from_sysfs, sysfs_path_from_fd};
-
-const SYSFS_BASE: &str = "/sys/fs/bcachefs";
+use crate::wrappers::sysfs::{dev_name_from_sysfs, find_all_sysfs_dirs, sysfs_path_from_fd};
 
 // JSON structs matching kernel output from bch2_time_stats_to_json()
 
@@ -39,6 +37,108 @@ struct EwmaStats {
     stddev: u64,
 }
 
+#[derive(Deserialize, Serialize, Debug, Clone)]
+struct Percentiles {
+    p50:    u64,
+    p90:    u64,
+    p99:    u64,
+    p999:   u64,
+}
+
+/// Log-linear duration histogram, as exported by the kernel: below
+/// 2^sub_bucket_bits buckets are 1ns wide, above that each power of two is
+/// split into 2^sub_bucket_bits linear buckets. counts[i] is bucket first + i.
+#[derive(Deserialize, Serialize, Debug, Clone, Default)]
+struct Histogram {
+    sub_bucket_bits:    u32,
+    first:              usize,
+    counts:             Vec<u64>,
+}
+
+impl Histogram {
+    fn bucket_start(&self, idx: usize) -> u64 {
+        let sub = 1usize << self.sub_bucket_bits;
+        if idx < sub { return idx as u64 }
+
+        let shift = (idx >> self.sub_bucket_bits) - 1;
+        ((sub + (idx & (sub - 1))) as u64) << shift
+    }
+
+    fn bucket_end(&self, idx: usize) -> u64 {
+        let sub = 1usize << self.sub_bucket_bits;
+        if idx < sub { return idx as u64 + 1 }
+
+        self.bucket_start(idx) + (1u64 << ((idx >> self.sub_bucket_bits) - 1))
+    }
+
+    fn total(&self) -> u64 {
+        self.counts.iter().sum()
+    }
+
+    /// Midpoint of the bucket containing the given percentile, in tenths of a
+    /// percent
+    fn percentile(&self, per_mille: u64) -> u64 {
+        let nr = self.total();
+        if nr == 0 { return 0 }
+
+        let want = ((nr * per_mille).div_ceil(1000)).max(1);
+        let mut seen = 0;
+        for (i, &c) in self.counts.iter().enumerate() {
+            seen += c;
+            if seen >= want {
+                let (start, end) = (self.bucket_start(self.first + i), self.bucket_end(self.first + i));
+                return start + (end - start) / 2;
+            }
+        }
+        0
+    }
+
+    /// The same histogram with only 2^bits sub buckets per power of two - the
+    /// kernel drops sub buckets as the populated range widens
+    fn coarsen(&self, bits: u32) -> Histogram {
+        if bits >= self.sub_bucket_bits || self.counts.is_empty() {
+            return self.clone();
+        }
+
+        let idx = |i: usize| -> usize {
+            let v = self.bucket_start(i);
+            if v < (1u64 << bits) { return v as usize }
+
+            let shift = 63 - v.leading_zeros() - bits;
+            (((shift + 1) as usize) << bits) + ((v >> shift) as usize & ((1 << bits) - 1))
+        };
+
+        let first = idx(self.first);
+        let mut counts = vec![0; idx(self.first + self.counts.len() - 1) - first + 1];
+        for (i, &c) in self.counts.iter().enumerate() {
+            counts[idx(self.first + i) - first] += c;
+        }
+
+        Histogram { sub_bucket_bits: bits, first, counts }
+    }
+
+    /// Events recorded since @prev was sampled
+    fn delta(&self, prev: &Histogram) -> Histogram {
+        if prev.sub_bucket_bits != self.sub_bucket_bits {
+            let bits = prev.sub_bucket_bits.min(self.sub_bucket_bits);
+            return self.coarsen(bits).delta(&prev.coarsen(bits));
+        }
+
+        let counts = self.counts.iter().enumerate()
+            .map(|(i, &c)| {
+                let idx = self.first + i;
+                let p = idx.checked_sub(prev.first)
+                    .and_then(|j| prev.counts.get(j))
+                    .copied()
+                    .unwrap_or(0);
+                c.saturating_sub(p)
+            })
+            .collect();
+
+        Histogram { sub_bucket_bits: self.sub_bucket_bits, first: self.first, counts }
+    }
+}
+
 #[derive(Deserialize, Serialize, Debug, Clone)]
 #[allow(dead_code)]
 struct TimeStats {
@@ -47,8 +147,40 @@ struct TimeStats {
     duration_ewma_ns:   EwmaStats,
     between_ns:         DurationStats,
     between_ewma_ns:    EwmaStats,
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    percentiles_ns:     Option<Percentiles>,
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    histogram_ns:       Option<Histogram>,
 }
 
+impl TimeStats {
+    fn percentile(&self, per_mille: u64) -> u64 {
+        if let Some(h) = &self.histogram_ns {
+            return h.percentile(per_mille);
+        }
+        match (&self.percentiles_ns, per_mille) {
+            (Some(p), 500) => p.p50,
+            (Some(p), 900) => p.p90,
+            (Some(p), 990) => p.p99,
+            (Some(p), 999) => p.p999,
+            _ => 0,
+        }
+    }
+
+    /// Turn lifetime totals into totals since @prev was sampled: min/max and
+    /// the weighted stats can't be diffed and are left as is
+    fn delta(&mut self, prev: &TimeStats) {
+        self.count = self.count.saturating_sub(prev.count);
+        self.duration_ns.total = self.duration_ns.total.saturating_sub(prev.duration_ns.total);
+        self.duration_ns.mean = if self.count > 0 { self.duration_ns.total / self.count } else { 0 };
+
+        if let (Some(h), Some(p)) = (&self.histogram_ns, &prev.histogram_ns) {
+            self.histogram_ns = Some(h.delta(p));
+        }
+    }
+}
+
+#[derive(Clone)]
 struct StatEntry {
     name:   String,
     stats:  TimeStats,
@@ -66,26 +198,14 @@ struct BtreeTransFnStats {
 const NAME_WIDTH: usize = 40;
 const COL_WIDTH: usize = 13;
 
-const TIME_UNITS: &[(&str, u64)] = &[
-    ("ns", 1), ("us", 1_000), ("ms", 1_000_000), ("s", 1_000_000_000),
-];
-
-fn fmt_duration(ns: u64) -> String {
-    if ns == 0 { return "0".to_string() }
-    let (name, scale) = TIME_UNITS.iter()
-        .rev()
-        .find(|(_, s)| ns >= s * 10)
-        .unwrap_or(&TIME_UNITS[0]);
-    format!("{}{}", ns / scale, name)
-}
-
-const NUM_COLS: usize = 9;
+const NUM_COLS: usize = 12;
 
 const COLUMNS: &[&str; NUM_COLS] = &[
     "NAME", "COUNT",
     "DUR_MIN", "DUR_MAX", "DUR_TOTAL",
     "MEAN", "MEAN_RECENT",
     "STDDEV", "STDDEV_RECENT",
+    "P50", "P99", "P99.9",
 ];
 
 fn sort_val(e: &StatEntry, col: usize) -> u64 {
@@ -99,6 +219,9 @@ fn sort_val(e: &StatEntry, col: usize) -> u64 {
         6 => s.duration_ewma_ns.mean,
         7 => s.duration_ns.stddev,
         8 => s.duration_ewma_ns.stddev,
+        9 => s.percentile(500),
+        10 => s.percentile(990),
+        11 => s.percentile(999),
         _ => 0,
     }
 }
@@ -123,45 +246,51 @@ fn format_header() -> String {
 
 fn format_row(e: &StatEntry) -> String {
     let s = &e.stats;
-    format!("{:<NAME_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$}",
+    format!("{:<NAME_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$} {:>COL_WIDTH$}",
         e.name, s.count,
         fmt_duration(s.duration_ns.min), fmt_duration(s.duration_ns.max), fmt_duration(s.duration_ns.total),
         fmt_duration(s.duration_ns.mean), fmt_duration(s.duration_ewma_ns.mean),
-        fmt_duration(s.duration_ns.stddev), fmt_duration(s.duration_ewma_ns.stddev))
+        fmt_duration(s.duration_ns.stddev), fmt_duration(s.duration_ewma_ns.stddev),
+        fmt_duration(s.percentile(500)), fmt_duration(s.percentile(990)), fmt_duration(s.percentile(999)))
 }
 
 // Structured data: sections within a filesystem snapshot
 
+#[derive(Clone)]
 struct Section {
     label:   &'static str,
     entries: Vec<StatEntry>,
 }
 
+#[derive(Clone)]
 struct FsSnapshot {
     label:    String,
     sections: Vec<Section>,
 }
 
-// Sysfs reading
-
-fn find_all_sysfs_dirs() -> Result<Vec<PathBuf>> {
-    let base = Path::new(SYSFS_BASE);
-    if !base.exists() {
-        return Err(anyhow!("No bcachefs filesystems found ({}/ does not exist)", SYSFS_BASE));
-    }
-
-    let mut results: Vec<PathBuf> = fs::read_dir(base)
-        .context("reading sysfs bcachefs directory")?
-        .filter_map(|e| e.ok().map(|e| e.path()))
-        .collect();
+/// Convert @snaps from lifetime totals to totals since @prev was sampled
+fn apply_deltas(snaps: &mut [FsSnapshot], prev: &[FsSnapshot]) {
+    for snap in snaps {
+        let Some(prev_snap) = prev.iter().find(|p| p.label == snap.label) else { continue };
 
-    if results.is_empty() {
-        return Err(anyhow!("No mounted bcachefs filesystems found"));
+        for section in &mut snap.sections {
+            let Some(prev_section) = prev_snap.sections.iter()
+                .find(|p| p.label == section.label) else { continue };
+            let prev_entries: BTreeMap<&str, &TimeStats> = prev_section.entries.iter()
+                .map(|e| (e.name.as_str(), &e.stats))
+                .collect();
+
+            for e in &mut section.entries {
+                if let Some(p) = prev_entries.get(e.name.as_str()) {
+                    e.stats.delta(p);
+                }
+            }
+        }
     }
-    results.sort();
-    Ok(results)
 }
 
+// Sysfs reading
+
 fn read_time_stats(sysfs_path: &Path) -> Result<Vec<StatEntry>> {
     let json_dir = sysfs_path.join("time_stats_json");
     if !json_dir.exists() {
@@ -296,6 +425,9 @@ enum SortBy {
     MeanRecent,
     StddevSince,
     StddevRecent,
+    P50,
+    P99,
+    P999,
 }
 
 impl SortBy {
@@ -305,6 +437,7 @@ impl SortBy {
             SortBy::DurMin => 2, SortBy::DurMax => 3, SortBy::DurTotal => 4,
             SortBy::MeanSince => 5, SortBy::MeanRecent => 6,
             SortBy::StddevSince => 7, SortBy::StddevRecent => 8,
+            SortBy::P50 => 9, SortBy::P99 => 10, SortBy::P999 => 11,
         }
     }
 }
@@ -332,6 +465,11 @@ pub struct Cli {
     #[arg(long)]
     once: bool,
 
+    /// Show counts, totals and percentiles for the last interval instead of
+    /// since mount (one-shot mode samples twice, one interval apart)
+    #[arg(short = 'd', long)]
+    delta: bool,
+
     /// Refresh interval in seconds (interactive mode)
     #[arg(short = 'i', long, default_value = "1")]
     interval: f64,
@@ -375,6 +513,7 @@ struct TuiState {
     reverse:        bool,
     show_all:       bool,
     show_devices:   bool,
+    delta:          bool,
     paused:         bool,
     interval:       Duration,
     cursor:         usize,
@@ -403,9 +542,10 @@ fn build_frame(snaps: &[FsSnapshot], state: &TuiState, multi: bool) -> (Vec<Stri
     let mut row = 0usize;
 
     let pause = if state.paused { " PAUSED" } else { "" };
+    let delta = if state.delta { " DELTA" } else { "" };
     lines.push(format!(
-        "bcachefs timestats ({}s{})  q:quit  \u{2190}\u{2192}:sort column  r:reverse  a:show all  d:devices  p:pause  1-9:interval",
-        state.interval.as_secs(), pause,
+        "bcachefs timestats ({}s{}{})  q:quit  \u{2190}\u{2192}:sort column  r:reverse  a:show all  d:devices  i:interval deltas  p:pause  1-9:interval",
+        state.interval.as_secs(), delta, pause,
     ));
     lines.push(String::new());
 
@@ -476,6 +616,7 @@ fn handle_key(state: &mut TuiState, key: KeyCode, modifiers: KeyModifiers, total
         KeyCode::Char('r') => state.reverse = !state.reverse,
         KeyCode::Char('a') => state.show_all = !state.show_all,
         KeyCode::Char('d') => state.show_devices = !state.show_devices,
+        KeyCode::Char('i') => state.delta = !state.delta,
         KeyCode::Char('p') => state.paused = !state.paused,
         KeyCode::Char(c @ '1'..='9') => state.interval = Duration::from_secs((c as u64) - ('0' as u64)),
         _ => {}
@@ -489,15 +630,24 @@ fn run_interactive(cli: Cli, sysfs_paths: Vec<PathBuf>) -> Result<()> {
         reverse:       false,
         show_all:      cli.all,
         show_devices:  !cli.no_device_stats,
+        delta:         cli.delta,
         paused:        false,
         interval:      Duration::from_secs_f64(cli.interval),
         cursor:        0,
         scroll_offset: 0,
     };
 
+    let mut prev: Option<Vec<FsSnapshot>> = None;
+
     run_tui(|stdout| loop {
         let mut snaps = collect_stats(&sysfs_paths, state.show_devices)
             .unwrap_or_default();
+        let raw = snaps.clone();
+        if state.delta {
+            if let Some(prev) = &prev { apply_deltas(&mut snaps, prev) }
+        }
+        prev = Some(raw);
+
         for snap in &mut snaps {
             for section in &mut snap.sections {
                 if !state.show_all {
@@ -542,10 +692,20 @@ fn timestats(cli: Cli) -> Result<()> {
         find_all_sysfs_dirs()?
     };
 
+    let collect_once = || -> Result<Vec<FsSnapshot>> {
+        let mut snaps = collect_stats(&sysfs_paths, !cli.no_device_stats)?;
+        if cli.delta {
+            std::thread::sleep(Duration::from_secs_f64(cli.interval));
+            let prev = std::mem::replace(&mut snaps, collect_stats(&sysfs_paths, !cli.no_device_stats)?);
+            apply_deltas(&mut snaps, &prev);
+        }
+        Ok(snaps)
+    };
+
     if cli.json {
-        print_json(&collect_stats(&sysfs_paths, !cli.no_device_stats)?)
+        print_json(&collect_once()?)
     } else if cli.once || !io::stdout().is_terminal() {
-        display_stats(collect_stats(&sysfs_paths, !cli.no_device_stats)?, &cli)
+        display_stats(collect_once()?, &cli)
     } else {
         run_interactive(cli, sysfs_paths)
     }
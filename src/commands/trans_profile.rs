@@ -0,0 +1,279 @@
+use std::collections::HashMap;
+use std::fs;
+use std::io::{self, Read};
+use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+use anyhow::{Context, Result};
+use clap::{Parser, ValueEnum};
+use serde::{Deserialize, Serialize};
+
+use crate::util::fmt_duration;
+use crate::wrappers::handle::BcachefsHandle;
+use crate::wrappers::sysfs::{find_all_sysfs_dirs, sysfs_path_from_fd};
+
+// JSON structs matching kernel output from bch2_trans_restart_profile_json_to_text()
+
+#[derive(Deserialize, Debug)]
+struct Profile {
+    sample_rate:    u64,
+    samples:        Vec<Sample>,
+}
+
+#[derive(Deserialize, Debug)]
+#[allow(dead_code)]
+struct Sample {
+    #[serde(rename = "fn")]
+    func:           String,
+    reason:         String,
+    btree:          String,
+    pos:            String,
+    ip:             String,
+    lost_ns:        u64,
+    time_ns:        u64,
+}
+
+#[derive(ValueEnum, Clone, Copy, Debug, PartialEq, Eq, Hash)]
+enum GroupBy {
+    /// Transaction function
+    Fn,
+    /// Restart reason
+    Reason,
+    /// Btree the restart happened in
+    Btree,
+    /// Btree position the restart happened at
+    Pos,
+    /// Code location that triggered the restart
+    Ip,
+}
+
+impl GroupBy {
+    fn header(self) -> &'static str {
+        match self {
+            GroupBy::Fn     => "fn",
+            GroupBy::Reason => "reason",
+            GroupBy::Btree  => "btree",
+            GroupBy::Pos    => "pos",
+            GroupBy::Ip     => "ip",
+        }
+    }
+
+    fn key(self, s: &Sample) -> &str {
+        match self {
+            GroupBy::Fn     => &s.func,
+            GroupBy::Reason => s.reason.strip_prefix("transaction_restart_").unwrap_or(&s.reason),
+            GroupBy::Btree  => &s.btree,
+            GroupBy::Pos    => &s.pos,
+            GroupBy::Ip     => &s.ip,
+        }
+    }
+}
+
+#[derive(Serialize, Debug, Default)]
+struct Offender {
+    key:            Vec<String>,
+    samples:        u64,
+    /// Estimated restarts: samples scaled by the sample rate
+    restarts:       u64,
+    lost_ns:        u64,
+    max_lost_ns:    u64,
+}
+
+fn aggregate(profile: &Profile, by: &[GroupBy]) -> Vec<Offender> {
+    let mut map: HashMap<Vec<&str>, Offender> = HashMap::new();
+
+    for s in &profile.samples {
+        let key: Vec<&str> = by.iter().map(|g| g.key(s)).collect();
+        let o = map.entry(key).or_default();
+        o.samples       += 1;
+        o.lost_ns       += s.lost_ns;
+        o.max_lost_ns    = o.max_lost_ns.max(s.lost_ns);
+    }
+
+    let rate = profile.sample_rate.max(1);
+    let mut ret: Vec<Offender> = map.into_iter()
+        .map(|(k, mut o)| {
+            o.key       = k.into_iter().map(String::from).collect();
+            o.restarts  = o.samples * rate;
+            o.lost_ns  *= rate;
+            o
+        })
+        .collect();
+    ret.sort_by(|a, b| b.lost_ns.cmp(&a.lost_ns).then(b.samples.cmp(&a.samples)));
+    ret
+}
+
+fn print_table(name: &str, profile: &Profile, offenders: &[Offender], cli: &Cli) {
+    let total_lost: u64 = offenders.iter().map(|o| o.lost_ns).sum();
+
+    println!("{}: {} samples, sample rate 1/{}, ~{} lost",
+             name, profile.samples.len(), profile.sample_rate.max(1),
+             fmt_duration(total_lost));
+
+    if offenders.is_empty() {
+        if profile.sample_rate == 0 {
+            println!("restart profiling disabled, enable with --sample-rate N");
+        }
+        return;
+    }
+
+    let widths: Vec<usize> = cli.by.iter().enumerate()
+        .map(|(i, g)| offenders.iter().take(cli.top)
+             .map(|o| o.key[i].len())
+             .chain(std::iter::once(g.header().len()))
+             .max().unwrap_or(0))
+        .collect();
+
+    let mut header = String::new();
+    for (g, w) in cli.by.iter().zip(&widths) {
+        header += &format!("{:<w$}  ", g.header(), w = w);
+    }
+    println!("{}{:>10} {:>10} {:>10} {:>6}", header, "restarts", "lost", "max", "%");
+
+    for o in offenders.iter().take(cli.top) {
+        let mut line = String::new();
+        for (k, w) in o.key.iter().zip(&widths) {
+            line += &format!("{:<w$}  ", k, w = w);
+        }
+        let pct = if total_lost > 0 { o.lost_ns as f64 * 100.0 / total_lost as f64 } else { 0.0 };
+        println!("{}{:>10} {:>10} {:>10} {:>5.1}%", line,
+                 o.restarts, fmt_duration(o.lost_ns), fmt_duration(o.max_lost_ns), pct);
+    }
+}
+
+// Sysfs
+
+fn profile_path(sysfs_path: &Path) -> PathBuf {
+    sysfs_path.join("internal/trans_restart_profile_json")
+}
+
+fn read_profile(sysfs_path: &Path) -> Result<Profile> {
+    let path = profile_path(sysfs_path);
+    let json = fs::read_to_string(&path)
+        .with_context(|| format!("reading {} (kernel too old?)", path.display()))?;
+    serde_json::from_str(&json).with_context(|| format!("parsing {}", path.display()))
+}
+
+fn reset_profile(sysfs_path: &Path) -> Result<()> {
+    let path = profile_path(sysfs_path);
+    fs::write(&path, "1").with_context(|| format!("writing {}", path.display()))
+}
+
+fn set_sample_rate(sysfs_path: &Path, rate: u32) -> Result<()> {
+    let path = sysfs_path.join("options/trans_restart_profile");
+    fs::write(&path, rate.to_string()).with_context(|| format!("writing {}", path.display()))
+}
+
+fn read_input(input: &str) -> Result<Profile> {
+    let mut json = String::new();
+    if input == "-" {
+        io::stdin().read_to_string(&mut json).context("reading stdin")?;
+    } else {
+        json = fs::read_to_string(input).with_context(|| format!("reading {}", input))?;
+    }
+    serde_json::from_str(&json).with_context(|| format!("parsing {}", input))
+}
+
+#[derive(Parser, Debug)]
+#[command(about = "Show which transactions lose the most time to transaction restarts",
+          long_about = "Aggregate samples from the transaction restart profiler.\n\n\
+Restarts are only sampled while the trans_restart_profile option is nonzero\n\
+(record one in N restarts); use --sample-rate to set it. Filesystems opened\n\
+by userspace tools (fsck, fusemount, ...) with -o trans_restart_profile=N\n\
+print a summary on shutdown; --input reads a saved trans_restart_profile_json.")]
+pub struct Cli {
+    /// Group samples by these fields
+    #[arg(short, long, value_delimiter = ',', default_value = "fn,reason,btree")]
+    by: Vec<GroupBy>,
+
+    /// Number of entries to show
+    #[arg(short = 'n', long, default_value = "20")]
+    top: usize,
+
+    /// Set the trans_restart_profile option before reading (0 disables)
+    #[arg(short = 'r', long)]
+    sample_rate: Option<u32>,
+
+    /// Clear existing samples, then collect for this many seconds
+    #[arg(short = 'd', long)]
+    duration: Option<f64>,
+
+    /// Clear samples after reading
+    #[arg(long)]
+    reset: bool,
+
+    /// Read profile JSON from a file ("-" for stdin) instead of sysfs
+    #[arg(short, long, conflicts_with_all = ["filesystem", "sample_rate", "duration", "reset"])]
+    input: Option<String>,
+
+    /// Output aggregated results as JSON
+    #[arg(long)]
+    json: bool,
+
+    /// Filesystem UUID, device, or mount point (default: all)
+    filesystem: Option<String>,
+}
+
+fn report(name: &str, profile: &Profile, cli: &Cli) -> Result<()> {
+    let offenders = aggregate(profile, &cli.by);
+
+    if cli.json {
+        let top: Vec<_> = offenders.iter().take(cli.top).collect();
+        println!("{}", serde_json::to_string_pretty(&serde_json::json!({
+            "name":         name,
+            "sample_rate":  profile.sample_rate,
+            "samples":      profile.samples.len(),
+            "group_by":     cli.by.iter().map(|g| g.header()).collect::<Vec<_>>(),
+            "top":          top,
+        }))?);
+    } else {
+        print_table(name, profile, &offenders, cli);
+    }
+    Ok(())
+}
+
+fn trans_profile(cli: Cli) -> Result<()> {
+    if let Some(ref input) = cli.input {
+        return report(input, &read_input(input)?, &cli);
+    }
+
+    let sysfs_paths: Vec<PathBuf> = if let Some(ref fs_arg) = cli.filesystem {
+        let handle = BcachefsHandle::open(fs_arg)
+            .with_context(|| format!("opening filesystem '{}'", fs_arg))?;
+        vec![sysfs_path_from_fd(handle.sysfs_fd())?]
+    } else {
+        find_all_sysfs_dirs()?
+    };
+
+    for path in &sysfs_paths {
+        if let Some(rate) = cli.sample_rate {
+            set_sample_rate(path, rate)?;
+        }
+        if cli.duration.is_some() {
+            reset_profile(path)?;
+        }
+    }
+
+    if let Some(secs) = cli.duration {
+        std::thread::sleep(Duration::from_secs_f64(secs));
+    }
+
+    for (i, path) in sysfs_paths.iter().enumerate() {
+        let name = path.file_name()
+            .map(|n| n.to_string_lossy().into_owned())
+            .unwrap_or_default();
+
+        if i > 0 && !cli.json {
+            println!();
+        }
+        report(&name, &read_profile(path)?, &cli)?;
+
+        if cli.reset {
+            reset_profile(path)?;
+        }
+    }
+
+    Ok(())
+}
+
+pub const CMD: super::CmdDef = typed_cmd!("trans-profile", "Show transaction restart profile", Cli, trans_profile);
@@ -95,9 +95,20 @@ pub struct CopyFsState {
     pub total_input:    u64,
     pub total_wrote:    u64,
     pub total_linked:   u64,
+    pub total_deduped:  u64,
+
+    /// Reflink chunks with identical content to chunks already copied
+    pub dedup:          bool,
 
     /// Hardlink tracking: source inode -> destination inode
     hardlinks: HashMap<u64, u64>,
+
+    /// Dedup candidates: (length, content hash) -> (inode, offset) of the
+    /// first chunk copied with that content
+    dedup_chunks: HashMap<(usize, u64), (u64, u64)>,
+
+    /// Read buffers, reused across files
+    bufs: Vec<AlignedBuf>,
 }
 
 impl CopyFsState {
@@ -113,7 +124,11 @@ impl CopyFsState {
             total_input:    0,
             total_wrote:    0,
             total_linked:   0,
+            total_deduped:  0,
+            dedup:          false,
             hardlinks:      HashMap::new(),
+            dedup_chunks:   HashMap::new(),
+            bufs:           Vec::new(),
         }
     }
 
@@ -129,7 +144,11 @@ impl CopyFsState {
             total_input:    0,
             total_wrote:    0,
             total_linked:   0,
+            total_deduped:  0,
+            dedup:          false,
             hardlinks:      HashMap::new(),
+            dedup_chunks:   HashMap::new(),
+            bufs:           Vec::new(),
         }
     }
 }
@@ -439,29 +458,114 @@ fn write_data(
     Ok(())
 }
 
-fn copy_data(
-    fs: &Fs,
-    dst_inode: &mut c::bch_inode_unpacked,
+/// Read [pos, pos + buf.len()) of the source, zero filling past src_size
+fn read_chunk(src_fd: BorrowedFd, buf: &mut [u8], pos: u64, src_size: u64) -> Result<(), BchError> {
+    let read_len = std::cmp::min(buf.len() as u64, src_size.saturating_sub(pos)) as usize;
+    let mut done = 0;
+
+    while done < read_len {
+        match rustix::io::pread(src_fd, &mut buf[done..read_len], pos + done as u64)
+            .map_err(rustix_err)? {
+            0 => break,
+            n => done += n,
+        }
+    }
+
+    buf[done..].fill(0);
+    Ok(())
+}
+
+/// Chunks read ahead of the one being written
+const COPY_READAHEAD: usize = 3;
+
+/// Call @f on each MAX_IO_SIZE chunk of [start, end) of the source.
+///
+/// Writes are synchronous, so to keep the source busy while we write, reads
+/// are done by a separate thread that runs up to COPY_READAHEAD chunks
+/// ahead; buffers go back and forth over channels, and are kept in @bufs for
+/// the next file.
+fn for_each_src_chunk(
+    bufs: &mut Vec<AlignedBuf>,
     src_fd: BorrowedFd,
     start: u64,
     end: u64,
+    src_size: u64,
+    mut f: impl FnMut(u64, &[u8]) -> Result<(), BchError>,
 ) -> Result<(), BchError> {
-    let block_size = fs.block_bytes();
-    let mut pos = start;
+    use std::sync::mpsc;
 
-    while pos < end {
-        let len = std::cmp::min(end - pos, MAX_IO_SIZE as u64) as usize;
-        let padded = ((len as u64).div_ceil(block_size) * block_size) as usize;
+    let nr = (end - start).div_ceil(MAX_IO_SIZE as u64) as usize;
+    if nr == 0 {
+        return Ok(());
+    }
 
-        let mut buf = AlignedBuf::new(padded);
-        rustix::io::pread(src_fd, &mut buf[..len], pos)
-            .map_err(rustix_err)?;
+    while bufs.len() < std::cmp::min(nr, COPY_READAHEAD) {
+        bufs.push(AlignedBuf::new(MAX_IO_SIZE));
+    }
 
-        write_data(fs, dst_inode, pos, &buf)?;
-        pos += len as u64;
+    if nr == 1 {
+        let buf = &mut bufs[0][..(end - start) as usize];
+        read_chunk(src_fd, buf, start, src_size)?;
+        return f(start, buf);
     }
 
-    Ok(())
+    let _ = rustix::fs::fadvise(src_fd, start, end - start, rustix::fs::Advice::Sequential);
+
+    let (free_tx, free_rx) = mpsc::channel::<AlignedBuf>();
+    let (full_tx, full_rx) = mpsc::sync_channel(COPY_READAHEAD);
+
+    for buf in bufs.drain(..) {
+        let _ = free_tx.send(buf);
+    }
+
+    std::thread::scope(|scope| {
+        let reader = scope.spawn(move || {
+            let mut pos = start;
+
+            while pos < end {
+                let Ok(mut buf) = free_rx.recv() else { break };
+                let len = std::cmp::min(end - pos, MAX_IO_SIZE as u64) as usize;
+                let ret = read_chunk(src_fd, &mut buf[..len], pos, src_size);
+                let err = ret.is_err();
+
+                if full_tx.send(ret.map(|_| (pos, len, buf))).is_err() || err {
+                    break;
+                }
+                pos += len as u64;
+            }
+
+            drop(full_tx);
+            free_rx.iter().collect::<Vec<_>>()
+        });
+
+        // Dropping our ends of the channels on error stops the reader:
+        let ret = (move || -> Result<(), BchError> {
+            for chunk in full_rx {
+                let (pos, len, buf) = chunk?;
+                f(pos, &buf[..len])?;
+                let _ = free_tx.send(buf);
+            }
+            Ok(())
+        })();
+
+        *bufs = reader.join().unwrap_or_default();
+        ret
+    })
+}
+
+fn copy_data(
+    fs: &Fs,
+    bufs: &mut Vec<AlignedBuf>,
+    dst_inode: &mut c::bch_inode_unpacked,
+    src_fd: BorrowedFd,
+    start: u64,
+    end: u64,
+) -> Result<(), BchError> {
+    let block_size = fs.block_bytes();
+    let padded_end = end.div_ceil(block_size) * block_size;
+
+    for_each_src_chunk(bufs, src_fd, start, padded_end, end,
+                       |pos, buf| write_data(fs, dst_inode, pos, buf))
 }
 
 fn link_data(
@@ -551,14 +655,14 @@ fn link_file_data(
             );
 
         if needs_copy {
-            copy_data(fs, dst, src_fd, extent.fe_logical, extent.fe_logical + visible_len)?;
+            copy_data(fs, &mut s.bufs, dst, src_fd, extent.fe_logical, extent.fe_logical + visible_len)?;
             s.total_wrote += visible_len;
             continue;
         }
 
         // If the data is in bcachefs's superblock region, copy it
         if extent.fe_physical < s.reserve_start {
-            copy_data(fs, dst, src_fd, extent.fe_logical, extent.fe_logical + visible_len)?;
+            copy_data(fs, &mut s.bufs, dst, src_fd, extent.fe_logical, extent.fe_logical + visible_len)?;
             s.total_wrote += visible_len;
             continue;
         }
@@ -681,6 +785,69 @@ fn seek_mismatch_aligned(buf1: &[u8], buf2: &[u8], offset: usize, len: usize, bs
     r
 }
 
+fn chunk_hash(buf: &[u8]) -> u64 {
+    use std::hash::{Hash, Hasher};
+
+    let mut h = std::collections::hash_map::DefaultHasher::new();
+    buf.hash(&mut h);
+    h.finish()
+}
+
+/// Try to reflink a chunk we've already copied with the same content, instead
+/// of writing it again. The hash only picks the candidate: contents are
+/// compared after reading it back, so a collision costs a read, not data.
+fn dedup_remap(
+    fs: &Fs,
+    s: &mut CopyFsState,
+    dst_inum: c::subvol_inum,
+    dst: &mut c::bch_inode_unpacked,
+    offset: u64,
+    src_buf: &[u8],
+    key: (usize, u64),
+) -> Result<bool, BchError> {
+    let Some(&(inum, src_offset)) = s.dedup_chunks.get(&key) else {
+        return Ok(false);
+    };
+    if inum == dst.bi_inum && src_offset == offset {
+        return Ok(false);
+    }
+
+    // The read path takes io options from the inode, so it has to be the
+    // source's, not the one we're writing:
+    let mut src_u: c::bch_inode_unpacked = Default::default();
+    let src = if inum == dst.bi_inum {
+        &*dst
+    } else {
+        if unsafe { c::bch2_inode_find_by_inum(fs.raw, subvol_inum(inum), &mut src_u) } != 0 {
+            s.dedup_chunks.remove(&key);
+            return Ok(false);
+        }
+        &src_u
+    };
+
+    let len = src_buf.len();
+    let mut buf = AlignedBuf::new(len);
+    if block_on(fs.read(subvol_inum(inum), src_offset, src, &mut buf)).is_err() ||
+       buf[..] != src_buf[..] {
+        s.dedup_chunks.remove(&key);
+        return Ok(false);
+    }
+
+    let mut i_sectors_delta: i64 = 0;
+    let ret = unsafe {
+        c::bch2_remap_range(fs.raw, dst_inum, offset >> 9,
+                            subvol_inum(inum), src_offset >> 9,
+                            len as u64 >> 9, dst.bi_size,
+                            &mut i_sectors_delta, false)
+    };
+    if ret < 0 {
+        ret_to_result(ret as i32)?;
+    }
+
+    dst.bi_sectors = (dst.bi_sectors as i64 + i_sectors_delta) as u64;
+    Ok(true)
+}
+
 fn copy_sync_file_range(
     fs: &Fs,
     s: &mut CopyFsState,
@@ -691,33 +858,39 @@ fn copy_sync_file_range(
     range: &Range,
 ) -> Result<(), BchError> {
     let block_size = fs.block_bytes();
-    let mut start = range.start;
+    let mut bufs = std::mem::take(&mut s.bufs);
+    let mut dst_buf = AlignedBuf::new(MAX_IO_SIZE);
+
+    let ret = for_each_src_chunk(&mut bufs, src_fd, range.start, range.end, src_size, |start, src_buf| {
+        let b = src_buf.len();
+        let dst_buf = &mut dst_buf[..b];
+        block_on(fs.read(dst_inum, start, dst, dst_buf))?;
 
-    while start != range.end {
-        let b = std::cmp::min(range.end - start, MAX_IO_SIZE as u64) as usize;
+        if s.dedup && src_buf != &dst_buf[..] {
+            let key = (b, chunk_hash(src_buf));
 
-        let mut src_buf = AlignedBuf::new(b);
-        let read_len = std::cmp::min(b, (src_size - start) as usize);
-        rustix::io::pread(src_fd, &mut src_buf[..read_len], start)
-            .map_err(rustix_err)?;
+            if dedup_remap(fs, s, dst_inum, dst, start, src_buf, key)? {
+                s.total_deduped += b as u64;
+                return Ok(());
+            }
 
-        let mut dst_buf = AlignedBuf::new(b);
-        block_on(fs.read(dst_inum, start, dst, &mut dst_buf))?;
+            s.dedup_chunks.entry(key).or_insert((dst.bi_inum, start));
+        }
 
         let mut m = Range { start: 0, end: 0 };
         loop {
-            m = seek_mismatch_aligned(&src_buf, &dst_buf, m.end as usize, b, block_size);
+            m = seek_mismatch_aligned(src_buf, dst_buf, m.end as usize, b, block_size);
             if m.end == 0 {
                 break;
             }
             write_data(fs, dst, start + m.start, &src_buf[m.start as usize..m.end as usize])?;
             s.total_wrote += m.end - m.start;
         }
+        Ok(())
+    });
 
-        start += b as u64;
-    }
-
-    Ok(())
+    s.bufs = bufs;
+    ret
 }
 
 fn copy_sync_file_data(
@@ -1123,6 +1296,12 @@ pub fn copy_fs(
         println!();
     }
 
+    if s.total_deduped > 0 {
+        print!("Deduplicated:\t");
+        print_human_readable(s.total_deduped);
+        println!();
+    }
+
     Ok(())
 }
 
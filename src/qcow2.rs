@@ -4,9 +4,14 @@
 //!
 //! Used by `bcachefs dump` to create sparse metadata images and
 //! `bcachefs undump` to convert them back to raw device images.
+//!
+//! Clusters may be stored deflate compressed, as qcow2 (v2) allows; both
+//! directions read and (de)compress clusters on multiple threads.
 
+use std::ffi::c_void;
 use std::ops::Range;
 use std::os::fd::BorrowedFd;
+use std::os::raw::{c_char, c_int, c_uint, c_ulong};
 
 use anyhow::{anyhow, Result};
 use rustix::io::Errno;
@@ -48,7 +53,7 @@ pub fn ranges_sort(ranges: &mut Ranges) {
 
 // ---- I/O helpers ----
 
-pub fn pread_exact(fd: BorrowedFd<'_>, buf: &mut [u8], mut offset: u64) -> Result<()> {
+fn pread_exact(fd: BorrowedFd<'_>, buf: &mut [u8], mut offset: u64) -> Result<()> {
     let mut pos = 0;
     while pos < buf.len() {
         match rustix::io::pread(fd, &mut buf[pos..], offset) {
@@ -85,6 +90,7 @@ fn pwrite_all(fd: BorrowedFd<'_>, buf: &[u8], mut offset: u64) -> Result<()> {
 const QCOW_MAGIC: u32 = (b'Q' as u32) << 24 | (b'F' as u32) << 16 | (b'I' as u32) << 8 | 0xfb;
 const QCOW_VERSION: u32 = 2;
 const QCOW_OFLAG_COPIED: u64 = 1 << 63;
+const QCOW_OFLAG_COMPRESSED: u64 = 1 << 62;
 
 // Header field offsets and sizes (all big-endian on disk):
 //   magic:                  u32   @ 0
@@ -127,6 +133,242 @@ fn read_be_u64(buf: &[u8], off: usize) -> u64 {
     u64::from_be_bytes(buf[off..off + 8].try_into().unwrap())
 }
 
+/*
+ * Compressed cluster L2 entries: the low x bits are the byte offset of the
+ * compressed data, then the number of 512 byte sectors it spans beyond the
+ * first, where x = 62 - (cluster_bits - 8).
+ */
+fn compressed_offset_bits(block_size: u32) -> u32 {
+    62 - (block_size.trailing_zeros() - 8)
+}
+
+fn compressed_l2_entry(block_size: u32, offset: u64, len: usize) -> u64 {
+    let extra_sectors = ((offset + len as u64 - 1) >> 9) - (offset >> 9);
+
+    QCOW_OFLAG_COMPRESSED | extra_sectors << compressed_offset_bits(block_size) | offset
+}
+
+/// Returns the offset and the number of bytes that may hold the compressed data
+fn compressed_l2_entry_decode(block_size: u32, entry: u64) -> (u64, u64) {
+    let x = compressed_offset_bits(block_size);
+    let offset = entry & ((1u64 << x) - 1);
+    let sectors = ((entry & !(QCOW_OFLAG_COPIED|QCOW_OFLAG_COMPRESSED)) >> x) + 1;
+
+    (offset, sectors * 512 - (offset & 511))
+}
+
+// ---- zlib: compressed clusters are raw deflate streams, with a 4k window ----
+
+#[repr(C)]
+struct ZStream {
+    next_in:    *const u8,
+    avail_in:   c_uint,
+    total_in:   c_ulong,
+    next_out:   *mut u8,
+    avail_out:  c_uint,
+    total_out:  c_ulong,
+    msg:        *const c_char,
+    state:      *mut c_void,
+    zalloc:     *const c_void,
+    zfree:      *const c_void,
+    opaque:     *mut c_void,
+    data_type:  c_int,
+    adler:      c_ulong,
+    reserved:   c_ulong,
+}
+
+extern "C" {
+    fn zlibVersion() -> *const c_char;
+    fn deflateInit2_(strm: *mut ZStream, level: c_int, method: c_int, window_bits: c_int,
+                     mem_level: c_int, strategy: c_int,
+                     version: *const c_char, stream_size: c_int) -> c_int;
+    fn deflateReset(strm: *mut ZStream) -> c_int;
+    fn deflate(strm: *mut ZStream, flush: c_int) -> c_int;
+    fn deflateEnd(strm: *mut ZStream) -> c_int;
+    fn inflateInit2_(strm: *mut ZStream, window_bits: c_int,
+                     version: *const c_char, stream_size: c_int) -> c_int;
+    fn inflateReset(strm: *mut ZStream) -> c_int;
+    fn inflate(strm: *mut ZStream, flush: c_int) -> c_int;
+    fn inflateEnd(strm: *mut ZStream) -> c_int;
+}
+
+const Z_OK: c_int           = 0;
+const Z_STREAM_END: c_int   = 1;
+const Z_BUF_ERROR: c_int    = -5;
+const Z_FINISH: c_int       = 4;
+const Z_DEFLATED: c_int     = 8;
+const Z_DEFAULT_COMPRESSION: c_int = -1;
+const QCOW2_ZLIB_WBITS: c_int = -12;
+
+// zlib keeps a pointer back to the stream, so it lives in a Box
+struct Deflate(Box<ZStream>);
+
+impl Deflate {
+    fn new() -> Result<Self> {
+        let mut strm: Box<ZStream> = Box::new(unsafe { std::mem::zeroed() });
+        let ret = unsafe {
+            deflateInit2_(&mut *strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, QCOW2_ZLIB_WBITS,
+                          9, 0, zlibVersion(), std::mem::size_of::<ZStream>() as c_int)
+        };
+        if ret != Z_OK {
+            return Err(anyhow!("error initializing zlib: {ret}"));
+        }
+        Ok(Deflate(strm))
+    }
+
+    /// Returns the compressed size, or None if it didn't fit in @dst
+    fn compress(&mut self, src: &[u8], dst: &mut [u8]) -> Option<usize> {
+        let strm = &mut *self.0;
+        unsafe { deflateReset(strm) };
+
+        strm.next_in    = src.as_ptr();
+        strm.avail_in   = src.len() as c_uint;
+        strm.next_out   = dst.as_mut_ptr();
+        strm.avail_out  = dst.len() as c_uint;
+
+        let ret = unsafe { deflate(strm, Z_FINISH) };
+        (ret == Z_STREAM_END).then(|| dst.len() - strm.avail_out as usize)
+    }
+}
+
+impl Drop for Deflate {
+    fn drop(&mut self) {
+        unsafe { deflateEnd(&mut *self.0) };
+    }
+}
+
+struct Inflate(Box<ZStream>);
+
+impl Inflate {
+    fn new() -> Result<Self> {
+        let mut strm: Box<ZStream> = Box::new(unsafe { std::mem::zeroed() });
+        let ret = unsafe {
+            inflateInit2_(&mut *strm, QCOW2_ZLIB_WBITS,
+                          zlibVersion(), std::mem::size_of::<ZStream>() as c_int)
+        };
+        if ret != Z_OK {
+            return Err(anyhow!("error initializing zlib: {ret}"));
+        }
+        Ok(Inflate(strm))
+    }
+
+    /// @src may have trailing garbage (it's sector granularity): @dst must be
+    /// filled exactly.
+    fn decompress(&mut self, src: &[u8], dst: &mut [u8]) -> Result<()> {
+        let strm = &mut *self.0;
+        unsafe { inflateReset(strm) };
+
+        strm.next_in    = src.as_ptr();
+        strm.avail_in   = src.len() as c_uint;
+        strm.next_out   = dst.as_mut_ptr();
+        strm.avail_out  = dst.len() as c_uint;
+
+        let ret = unsafe { inflate(strm, Z_FINISH) };
+        if (ret != Z_STREAM_END && ret != Z_BUF_ERROR) || strm.avail_out != 0 {
+            return Err(anyhow!("error decompressing cluster: {ret}"));
+        }
+        Ok(())
+    }
+}
+
+impl Drop for Inflate {
+    fn drop(&mut self) {
+        unsafe { inflateEnd(&mut *self.0) };
+    }
+}
+
+// ---- Parallel cluster encoding ----
+
+/// Input is read and compressed in chunks of this size, one per thread
+const QCOW2_CHUNK_BYTES: u64 = 1 << 20;
+
+fn nr_threads(nr_chunks: usize) -> usize {
+    default_threads().clamp(1, nr_chunks.max(1))
+}
+
+pub fn default_threads() -> usize {
+    std::thread::available_parallelism().map_or(1, |n| n.get())
+}
+
+/// Called on each range's data after it's read, before it's written out
+pub type RangeFilter<'a> = &'a (dyn Fn(&mut [u8]) + Sync);
+
+/// A cluster ready to be written out: either raw, or deflate compressed
+struct EncodedCluster {
+    src_blk:    u64,
+    data:       Vec<u8>,
+    compressed: bool,
+}
+
+struct ClusterEncoder {
+    block_size: usize,
+    deflate:    Option<Deflate>,
+    cbuf:       Vec<u8>,
+}
+
+impl ClusterEncoder {
+    fn new(block_size: u32, compress: bool) -> Result<Self> {
+        Ok(ClusterEncoder {
+            block_size: block_size as usize,
+            deflate:    if compress { Some(Deflate::new()?) } else { None },
+            // Only worth compressing if it saves at least a sector:
+            cbuf:       vec![0u8; (block_size as usize).saturating_sub(512)],
+        })
+    }
+
+    fn encode(&mut self, buf: &[u8], src_offset: u64, out: &mut Vec<EncodedCluster>) {
+        let bs = self.block_size;
+
+        for (i, cluster) in buf.chunks(bs).enumerate() {
+            let src_blk = src_offset / bs as u64 + i as u64;
+            let compressed = self.deflate.as_mut()
+                .and_then(|d| d.compress(cluster, &mut self.cbuf));
+
+            out.push(match compressed {
+                Some(len) => EncodedCluster { src_blk, data: self.cbuf[..len].to_vec(), compressed: true },
+                None      => EncodedCluster { src_blk, data: cluster.to_vec(), compressed: false },
+            });
+        }
+    }
+
+    fn read_encode(&mut self, infd: BorrowedFd<'_>, r: &Range<u64>,
+                   filter: Option<RangeFilter>) -> Result<Vec<EncodedCluster>> {
+        let mut buf = vec![0u8; (r.end - r.start) as usize];
+        pread_exact(infd, &mut buf, r.start)?;
+
+        if let Some(filter) = filter {
+            filter(&mut buf);
+        }
+
+        let mut out = Vec::with_capacity(buf.len() / self.block_size);
+        self.encode(&buf, r.start, &mut out);
+        Ok(out)
+    }
+}
+
+/// Read and encode @chunks on @nr_threads threads; results are in input order
+fn read_encode_chunks(infd: BorrowedFd<'_>, block_size: u32, compress: bool,
+                      chunks: &[Range<u64>], filter: Option<RangeFilter>,
+                      nr_threads: usize)
+    -> Result<Vec<Vec<EncodedCluster>>> {
+    let per_thread = chunks.len().div_ceil(nr_threads).max(1);
+
+    std::thread::scope(|scope| {
+        let threads: Vec<_> = chunks.chunks(per_thread)
+            .map(|chunks| scope.spawn(move || -> Result<Vec<_>> {
+                let mut enc = ClusterEncoder::new(block_size, compress)?;
+                chunks.iter().map(|r| enc.read_encode(infd, r, filter)).collect()
+            }))
+            .collect();
+
+        let mut out = Vec::with_capacity(chunks.len());
+        for t in threads {
+            out.extend(t.join().map_err(|_| anyhow!("qcow2 worker thread panicked"))??);
+        }
+        Ok(out)
+    })
+}
+
 // ---- Qcow2Image ----
 
 pub struct Qcow2Image<'fd> {
@@ -138,6 +380,9 @@ pub struct Qcow2Image<'fd> {
     l1_index:   Option<u32>,
     l2_table:   Vec<u64>,
     offset:     u64,
+    compress:   bool,
+    threads:    usize,
+    encoder:    Option<ClusterEncoder>,
 }
 
 impl<'fd> Qcow2Image<'fd> {
@@ -157,17 +402,29 @@ impl<'fd> Qcow2Image<'fd> {
             l1_index:   None,
             l2_table:   vec![0u64; l2_size as usize],
             offset:     round_up(QCOW2_HDR_BYTES as u64, block_size as u64),
+            compress:   false,
+            threads:    default_threads(),
+            encoder:    None,
         })
     }
 
-    /// Borrowed fd of the input device, for callers that need to read
-    /// directly (e.g. sanitize path).
-    pub fn infd(&self) -> BorrowedFd<'_> {
-        self.infd
+    /// Threads used to read and compress ranges, when writing several
+    /// images at once
+    pub fn set_threads(&mut self, threads: usize) {
+        self.threads = threads.max(1);
     }
 
+    /// Store clusters deflate compressed, when that makes them smaller
+    pub fn set_compress(&mut self, compress: bool) {
+        self.compress = compress;
+        self.encoder = None;
+    }
+
+    /// Uncompressed clusters and tables must be cluster aligned; compressed
+    /// clusters are packed, so this may have to skip ahead.
     fn write_raw(&mut self, buf: &[u8]) -> Result<()> {
         assert!(buf.len() as u64 % self.block_size as u64 == 0);
+        self.offset = round_up(self.offset, self.block_size as u64);
         pwrite_all(self.outfd, buf, self.offset)?;
         self.offset += buf.len() as u64;
         Ok(())
@@ -175,6 +432,7 @@ impl<'fd> Qcow2Image<'fd> {
 
     fn flush_l2(&mut self) -> Result<()> {
         if let Some(idx) = self.l1_index {
+            self.offset = round_up(self.offset, self.block_size as u64);
             self.l1_table[idx as usize] = self.offset | QCOW_OFLAG_COPIED;
 
             let mut buf = vec![0u8; self.block_size as usize];
@@ -189,7 +447,7 @@ impl<'fd> Qcow2Image<'fd> {
         Ok(())
     }
 
-    fn add_l2(&mut self, src_blk: u64, dst_offset: u64) -> Result<()> {
+    fn add_l2(&mut self, src_blk: u64, entry: u64) -> Result<()> {
         let l2_size = self.block_size as u64 / 8;
         let l1_index = (src_blk / l2_size) as u32;
         let l2_index = (src_blk % l2_size) as usize;
@@ -199,39 +457,93 @@ impl<'fd> Qcow2Image<'fd> {
             self.l1_index = Some(l1_index);
         }
 
-        self.l2_table[l2_index] = dst_offset | QCOW_OFLAG_COPIED;
+        self.l2_table[l2_index] = entry;
+        Ok(())
+    }
+
+    /// Write a batch of encoded clusters with a single write: uncompressed
+    /// clusters first, since they have to be aligned, then compressed
+    /// clusters packed after them.
+    fn write_encoded(&mut self, clusters: &[EncodedCluster]) -> Result<()> {
+        let bs = self.block_size as u64;
+        let start = round_up(self.offset, bs);
+        let mut buf = Vec::new();
+        let mut entries = Vec::with_capacity(clusters.len());
+
+        for c in clusters.iter().filter(|c| !c.compressed) {
+            entries.push((c.src_blk, (start + buf.len() as u64) | QCOW_OFLAG_COPIED));
+            buf.extend_from_slice(&c.data);
+        }
+
+        for c in clusters.iter().filter(|c| c.compressed) {
+            let offset = start + buf.len() as u64;
+            entries.push((c.src_blk, compressed_l2_entry(self.block_size, offset, c.data.len())));
+            buf.extend_from_slice(&c.data);
+        }
+
+        pwrite_all(self.outfd, &buf, start)?;
+        self.offset = start + buf.len() as u64;
+
+        // add_l2() wants them in order, it only has one L2 table at a time:
+        entries.sort_unstable_by_key(|e| e.0);
+        for (src_blk, entry) in entries {
+            self.add_l2(src_blk, entry)?;
+        }
         Ok(())
     }
 
     /// Write a buffer to the image, mapping src_offset blocks to the
     /// output position. buf.len() must be a multiple of block_size.
     pub fn write_buf(&mut self, buf: &[u8], src_offset: u64) -> Result<()> {
-        let dst_offset = self.offset;
-        self.write_raw(buf)?;
+        assert!(buf.len() as u64 % self.block_size as u64 == 0);
 
-        let bs = self.block_size as u64;
-        let nblocks = buf.len() as u64 / bs;
-        for i in 0..nblocks {
-            self.add_l2((src_offset + i * bs) / bs, dst_offset + i * bs)?;
+        if self.encoder.is_none() {
+            self.encoder = Some(ClusterEncoder::new(self.block_size, self.compress)?);
         }
-        Ok(())
+
+        let mut clusters = Vec::with_capacity(buf.len() / self.block_size as usize);
+        self.encoder.as_mut().unwrap().encode(buf, src_offset, &mut clusters);
+        self.write_encoded(&clusters)
     }
 
     /// Write ranges read from the input device to the image.
     /// Rounds up and merges the ranges in place.
+    ///
+    /// Ranges are split into chunks that are read and compressed in parallel,
+    /// a few per thread at a time; they're written out in order, so that L2
+    /// tables are filled in one at a time.
     pub fn write_ranges(&mut self, ranges: &mut Ranges) -> Result<()> {
         ranges_roundup(ranges, self.block_size as u64);
         ranges_sort_merge(ranges);
 
-        let bs = self.block_size as usize;
-        let mut buf = vec![0u8; bs];
+        let chunk_bytes = QCOW2_CHUNK_BYTES.max(self.block_size as u64);
+        let chunks: Vec<Range<u64>> = ranges.iter()
+            .flat_map(|r| (r.start..r.end).step_by(chunk_bytes as usize)
+                      .map(move |s| s..(s + chunk_bytes).min(r.end)))
+            .collect();
+
+        self.write_chunks(&chunks, None)
+    }
+
+    /// Write ranges read from the input device to the image, passing each
+    /// range's data through @filter first (e.g. to sanitize it): ranges are
+    /// read and filtered whole, in parallel, and aren't merged or split, so
+    /// they must be block aligned.
+    pub fn write_ranges_filtered(&mut self, ranges: &Ranges, filter: RangeFilter) -> Result<()> {
+        let bs = self.block_size as u64;
+        assert!(ranges.iter().all(|r| r.start % bs == 0 && r.end % bs == 0));
+
+        self.write_chunks(ranges, Some(filter))
+    }
+
+    fn write_chunks(&mut self, chunks: &[Range<u64>], filter: Option<RangeFilter>) -> Result<()> {
+        let nr_threads = nr_threads(chunks.len()).min(self.threads);
 
-        for r in ranges.iter() {
-            let mut src_offset = r.start;
-            while src_offset < r.end {
-                pread_exact(self.infd, &mut buf, src_offset)?;
-                self.write_buf(&buf, src_offset)?;
-                src_offset += bs as u64;
+        for window in chunks.chunks(nr_threads * 2) {
+            let encoded = read_encode_chunks(self.infd, self.block_size, self.compress,
+                                             window, filter, nr_threads)?;
+            for clusters in encoded {
+                self.write_encoded(&clusters)?;
             }
         }
         Ok(())
@@ -243,11 +555,11 @@ impl<'fd> Qcow2Image<'fd> {
         self.flush_l2()?;
 
         // Write L1 table (big-endian)
-        let l1_offset = self.offset;
+        let l1_offset = round_up(self.offset, self.block_size as u64);
         let l1_bytes: Vec<u8> = self.l1_table.iter()
             .flat_map(|v| v.to_be_bytes())
             .collect();
-        self.offset += round_up(l1_bytes.len() as u64, self.block_size as u64);
+        self.offset = l1_offset + round_up(l1_bytes.len() as u64, self.block_size as u64);
         pwrite_all(self.outfd, &l1_bytes, l1_offset)?;
 
         // Write header
@@ -267,7 +579,60 @@ impl<'fd> Qcow2Image<'fd> {
     }
 }
 
+/// Decode and write out a slice of the image's clusters, as (raw offset,
+/// L2 entry) pairs: runs of adjacent uncompressed clusters are copied with
+/// one read and write.
+fn qcow2_clusters_to_raw(infd: BorrowedFd<'_>, outfd: BorrowedFd<'_>,
+                         block_size: u32, in_size: u64,
+                         clusters: &[(u64, u64)]) -> Result<()> {
+    let bs = block_size as u64;
+    let mut inflate = None;
+    let mut data_buf = vec![0u8; bs as usize];
+    let mut cbuf = Vec::new();
+    let mut i = 0;
+
+    while i < clusters.len() {
+        let (dst_offset, l2_entry) = clusters[i];
+
+        if l2_entry & QCOW_OFLAG_COMPRESSED != 0 {
+            let (src_offset, len) = compressed_l2_entry_decode(block_size, l2_entry);
+            let len = len.min(in_size.saturating_sub(src_offset)) as usize;
+
+            cbuf.resize(len, 0);
+            pread_exact(infd, &mut cbuf, src_offset)?;
+
+            if inflate.is_none() {
+                inflate = Some(Inflate::new()?);
+            }
+            inflate.as_mut().unwrap().decompress(&cbuf, &mut data_buf)
+                .map_err(|e| anyhow!("{e} at offset {dst_offset}"))?;
+            pwrite_all(outfd, &data_buf, dst_offset)?;
+            i += 1;
+            continue;
+        }
+
+        let src_offset = l2_entry & !QCOW_OFLAG_COPIED;
+        let mut nr = 1;
+        while i + nr < clusters.len() &&
+              (nr as u64 + 1) * bs <= QCOW2_CHUNK_BYTES &&
+              clusters[i + nr].0 == dst_offset + nr as u64 * bs &&
+              clusters[i + nr].1 == l2_entry + nr as u64 * bs {
+            nr += 1;
+        }
+
+        let mut buf = vec![0u8; nr * bs as usize];
+        pread_exact(infd, &mut buf, src_offset)?;
+        pwrite_all(outfd, &buf, dst_offset)?;
+        i += nr;
+    }
+
+    Ok(())
+}
+
 /// Convert a qcow2 image back to a raw device image.
+///
+/// The L1 and L2 tables are read first; clusters are then split evenly
+/// across threads, which read, decompress and write them independently.
 pub fn qcow2_to_raw(infd: BorrowedFd<'_>, outfd: BorrowedFd<'_>) -> Result<()> {
     let mut hdr_buf = [0u8; QCOW2_HDR_BYTES];
     pread_exact(infd, &mut hdr_buf, 0)?;
@@ -284,7 +649,12 @@ pub fn qcow2_to_raw(infd: BorrowedFd<'_>, outfd: BorrowedFd<'_>) -> Result<()> {
     let size = read_be_u64(&hdr_buf, 24);
     rustix::fs::ftruncate(outfd, size)?;
 
-    let block_size = 1u32 << read_be_u32(&hdr_buf, 20);
+    let block_bits = read_be_u32(&hdr_buf, 20);
+    if !(9..=21).contains(&block_bits) {
+        return Err(anyhow!("invalid qcow2 cluster size 1 << {block_bits}"));
+    }
+
+    let block_size = 1u32 << block_bits;
     let l1_size = read_be_u32(&hdr_buf, 36) as usize;
     let l2_size = block_size as usize / 8;
 
@@ -294,7 +664,7 @@ pub fn qcow2_to_raw(infd: BorrowedFd<'_>, outfd: BorrowedFd<'_>) -> Result<()> {
     pread_exact(infd, &mut l1_buf, l1_offset)?;
 
     let mut l2_buf = vec![0u8; block_size as usize];
-    let mut data_buf = vec![0u8; block_size as usize];
+    let mut clusters = Vec::new();
 
     for i in 0..l1_size {
         let l1_entry = read_be_u64(&l1_buf, i * 8);
@@ -306,18 +676,30 @@ pub fn qcow2_to_raw(infd: BorrowedFd<'_>, outfd: BorrowedFd<'_>) -> Result<()> {
 
         for j in 0..l2_size {
             let l2_entry = read_be_u64(&l2_buf, j * 8);
-            let src_offset = l2_entry & !QCOW_OFLAG_COPIED;
-            if src_offset == 0 {
+            if l2_entry & !QCOW_OFLAG_COPIED == 0 {
                 continue;
             }
 
             let dst_offset = (i as u64 * l2_size as u64 + j as u64) * block_size as u64;
-            pread_exact(infd, &mut data_buf, src_offset)?;
-            pwrite_all(outfd, &data_buf, dst_offset)?;
+            clusters.push((dst_offset, l2_entry));
         }
     }
 
-    Ok(())
+    let in_size = file_size_fd(infd)?;
+    let nr_threads = nr_threads(clusters.len() * block_size as usize / QCOW2_CHUNK_BYTES as usize);
+    let per_thread = clusters.len().div_ceil(nr_threads).max(1);
+
+    std::thread::scope(|scope| {
+        let threads: Vec<_> = clusters.chunks(per_thread)
+            .map(|clusters| scope.spawn(move ||
+                qcow2_clusters_to_raw(infd, outfd, block_size, in_size, clusters)))
+            .collect();
+
+        for t in threads {
+            t.join().map_err(|_| anyhow!("qcow2 worker thread panicked"))??;
+        }
+        Ok(())
+    })
 }
 
 fn round_up(v: u64, align: u64) -> u64 {
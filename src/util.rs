@@ -27,6 +27,9 @@ impl AlignedBuf {
     }
 }
 
+// Owns its allocation outright, so it can be handed to another thread
+unsafe impl Send for AlignedBuf {}
+
 impl std::ops::Deref for AlignedBuf {
     type Target = [u8];
     fn deref(&self) -> &[u8] {
@@ -99,6 +102,19 @@ pub fn fmt_num_human(n: u64) -> String {
     format!("{}", n)
 }
 
+const TIME_UNITS: &[(&str, u64)] = &[
+    ("ns", 1), ("us", 1_000), ("ms", 1_000_000), ("s", 1_000_000_000),
+];
+
+pub fn fmt_duration(ns: u64) -> String {
+    if ns == 0 { return "0".to_string() }
+    let (name, scale) = TIME_UNITS.iter()
+        .rev()
+        .find(|(_, s)| ns >= s * 10)
+        .unwrap_or(&TIME_UNITS[0]);
+    format!("{}{}", ns / scale, name)
+}
+
 /// Get the size of a file or block device in bytes.
 pub fn file_size(f: &File) -> Result<u64> {
     let meta = f.metadata()?;
@@ -6,6 +6,7 @@ use std::path::Path;
 
 use bch_bindgen::c::{
     bch_data_type,
+    bch_ioctl_compression_dict,
     bch_ioctl_dev_usage, bch_ioctl_dev_usage_v2,
     bch_ioctl_dev_usage_bch_ioctl_dev_usage_type,
     bch_ioctl_disk, bch_ioctl_disk_v2,
@@ -67,6 +68,8 @@ type DiskResizeV2Opcode    = WriteOpcode<0xbc, 27, bch_ioctl_disk_resize_v2>;
 type DiskResizeJournalOpcode   = WriteOpcode<0xbc, 15, bch_ioctl_disk_resize_journal>;
 type DiskResizeJournalV2Opcode = WriteOpcode<0xbc, 28, bch_ioctl_disk_resize_journal_v2>;
 
+type CompressionDictAddOpcode  = WriteOpcode<0xbc, 34, bch_ioctl_compression_dict>;
+
 const SYSFS_BASE: &str = "/sys/fs/bcachefs/";
 
 /// BCH_IOCTL_QUERY_UUID: _IOR(0xbc, 1, struct bch_ioctl_query_uuid)
@@ -416,6 +419,18 @@ impl BcachefsHandle {
         )
     }
 
+    /// Add a trained zstd dictionary, used for new writes with
+    /// compression=zstd_dict.
+    pub(crate) fn compression_dict_add(&self, dict: &[u8]) -> Result<(), Errno> {
+        let arg = bch_ioctl_compression_dict {
+            flags: 0,
+            len:   dict.len() as u32,
+            dict:  dict.as_ptr() as u64,
+        };
+        unsafe { ioctl::ioctl(self.ioctl_fd(), Setter::<CompressionDictAddOpcode, _>::new(arg)) }
+            .map_err(|e| Errno(e.raw_os_error()))
+    }
+
     /// Read the filesystem superblock via BCH_IOCTL_READ_SUPER.
     ///
     /// Returns a heap-allocated buffer containing the raw superblock.
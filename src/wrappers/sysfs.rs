@@ -4,7 +4,9 @@ use std::os::fd::BorrowedFd;
 use std::os::unix::fs::{FileTypeExt, MetadataExt};
 use std::path::{Path, PathBuf};
 
-use anyhow::{Context, Result};
+use anyhow::{anyhow, Context, Result};
+
+const SYSFS_BASE: &str = "/sys/fs/bcachefs";
 
 /// Resolve the block device name for a bcachefs sysfs device directory.
 ///
@@ -30,6 +32,25 @@ pub fn sysfs_path_from_fd(fd: BorrowedFd) -> Result<PathBuf> {
     fs::read_link(&link).with_context(|| format!("resolving sysfs fd {}", raw))
 }
 
+/// List the sysfs directories of all mounted bcachefs filesystems, sorted.
+pub fn find_all_sysfs_dirs() -> Result<Vec<PathBuf>> {
+    let base = Path::new(SYSFS_BASE);
+    if !base.exists() {
+        return Err(anyhow!("No bcachefs filesystems found ({}/ does not exist)", SYSFS_BASE));
+    }
+
+    let mut results: Vec<PathBuf> = fs::read_dir(base)
+        .context("reading sysfs bcachefs directory")?
+        .filter_map(|e| e.ok().map(|e| e.path()))
+        .collect();
+
+    if results.is_empty() {
+        return Err(anyhow!("No mounted bcachefs filesystems found"));
+    }
+    results.sort();
+    Ok(results)
+}
+
 /// Read a sysfs attribute as a u64.
 pub fn read_sysfs_u64(path: &Path) -> io::Result<u64> {
     let s = fs::read_to_string(path)?;